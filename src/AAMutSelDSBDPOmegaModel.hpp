@@ -160,6 +160,9 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
 
     PathSuffStatArray *sitepathsuffstatarray;
     PathSuffStatArray *componentpathsuffstatarray;
+    // component suff stats collapsed at the amino-acid level, for moves on
+    // fitness profiles (see AAMutSelPathSuffStat)
+    AAMutSelPathSuffStatArray *componentaamutselsuffstatarray;
 
     PolySuffStatArray *sitepolysuffstatarray{nullptr};
     PolySuffStatArray *componentpolysuffstatarray{nullptr};
@@ -487,6 +490,7 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
 
         sitepathsuffstatarray = new PathSuffStatArray(Nsite);
         componentpathsuffstatarray = new PathSuffStatArray(Ncat);
+        componentaamutselsuffstatarray = new AAMutSelPathSuffStatArray(Ncat);
     }
 
     //-------------------
@@ -633,6 +637,19 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
         UpdateCodonMatricesNoFitnessRecomput();
     }
 
+    //! save the state of the codon matrices (see SubMatrix::Backup), before a move
+    //! on the nucleotide rates
+    void BackupCodonMatrices() { componentcodonmatrixarray->BackupCodonMatrices(); }
+
+    //! \brief undo a rejected move on the nucleotide rates
+    //!
+    //! The nucleotide matrix is recomputed, and the codon matrices get back the
+    //! state saved by BackupCodonMatrices.
+    void RestoreMatrices() {
+        UpdateNucMatrix();
+        componentcodonmatrixarray->RestoreCodonMatrices();
+    }
+
     //! \brief dummy function that does not do anything.
     //!
     //! Used for the templates of ScalingMove, SlidingMove and ProfileMove
@@ -824,6 +841,15 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
                ComponentPolySuffStatLogProb(k);
     }
 
+    //! return log prob of the substitution mappings over sites allocated to
+    //! component k of the mixture, computed from the amino-acid level suff stats
+    //! (see CollectAAMutSelSuffStat), without computing the codon matrix
+    double AAMutSelSuffStatLogProb(int k) const {
+        return componentaamutselsuffstatarray->GetVal(k).GetLogProb(
+                   componentcodonmatrixarray->GetVal(k)) +
+               ComponentPolySuffStatLogProb(k);
+    }
+
     //! return log prob of first-level mixture components (i.e. all amino-acid
     //! profiles drawn from component k of the base distribution), as a function
     //! of the center and concentration parameters of this component
@@ -874,6 +900,14 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
         }
     }
 
+    //! collapse component suff stats at the amino-acid level (valid as long as
+    //! the nucleotide matrix and the component suff stats do not change)
+    void CollectAAMutSelSuffStat() {
+        componentaamutselsuffstatarray->Clear();
+        componentaamutselsuffstatarray->AddSuffStat(
+            *componentcodonmatrixarray, *componentpathsuffstatarray, *occupancy);
+    }
+
     //! gather site-specific sufficient statistics component-wise
     void CollectComponentPathSuffStat() {
         componentpathsuffstatarray->Clear();
@@ -1110,16 +1144,26 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
     //! MH move on nucleotide rate parameters
     void MoveNucRates() {
         Move::Profile(nucrelrate, 0.1, 1, 3, &AAMutSelDSBDPOmegaModel::NucRatesLogProb,
-            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput, this);
+            &AAMutSelDSBDPOmegaModel::BackupCodonMatrices,
+            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput,
+            &AAMutSelDSBDPOmegaModel::RestoreMatrices, this);
         Move::Profile(nucrelrate, 0.03, 3, 3, &AAMutSelDSBDPOmegaModel::NucRatesLogProb,
-            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput, this);
+            &AAMutSelDSBDPOmegaModel::BackupCodonMatrices,
+            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput,
+            &AAMutSelDSBDPOmegaModel::RestoreMatrices, this);
         Move::Profile(nucrelrate, 0.01, 3, 3, &AAMutSelDSBDPOmegaModel::NucRatesLogProb,
-            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput, this);
+            &AAMutSelDSBDPOmegaModel::BackupCodonMatrices,
+            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput,
+            &AAMutSelDSBDPOmegaModel::RestoreMatrices, this);
 
         Move::Profile(nucstat, 0.1, 1, 3, &AAMutSelDSBDPOmegaModel::NucRatesLogProb,
-            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput, this);
+            &AAMutSelDSBDPOmegaModel::BackupCodonMatrices,
+            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput,
+            &AAMutSelDSBDPOmegaModel::RestoreMatrices, this);
         Move::Profile(nucstat, 0.01, 1, 3, &AAMutSelDSBDPOmegaModel::NucRatesLogProb,
-            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput, this);
+            &AAMutSelDSBDPOmegaModel::BackupCodonMatrices,
+            &AAMutSelDSBDPOmegaModel::UpdateMatricesNoFitnessRecomput,
+            &AAMutSelDSBDPOmegaModel::RestoreMatrices, this);
     }
 
     //! MCMC module for the mixture amino-acid fitness profiles
@@ -1144,6 +1188,7 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
 
     //! MH move on amino-acid fitness profiles (occupied components only)
     void MoveAAProfiles() {
+        CollectAAMutSelSuffStat();
         CompMoveAAProfiles(3);
         MulMoveAAProfiles(3);
     }
@@ -1187,11 +1232,11 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
                 std::vector<double> &aa = (*componentaafitnessarray)[i];
                 for (int rep = 0; rep < nrep; rep++) {
                     for (int l = 0; l < Naa; l++) { bk[l] = aa[l]; }
-                    double deltalogprob = -AALogPrior(i) - PathSuffStatLogProb(i);
+                    double deltalogprob = -AALogPrior(i) - AAMutSelSuffStatLogProb(i);
                     double loghastings = Random::ProfileProposeMove(aa, Naa, tuning, n);
                     deltalogprob += loghastings;
                     UpdateCodonMatrix(i);
-                    deltalogprob += AALogPrior(i) + PathSuffStatLogProb(i);
+                    deltalogprob += AALogPrior(i) + AAMutSelSuffStatLogProb(i);
                     int accepted = (log(Random::Uniform()) < deltalogprob);
                     if (accepted) {
                         nacc++;
@@ -1238,7 +1283,7 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
 
                 for (int rep = 0; rep < nrep; rep++) {
                     double deltalogprob =
-                        -GammaAALogPrior(x, aacenter, aaconc) - PathSuffStatLogProb(i);
+                        -GammaAALogPrior(x, aacenter, aaconc) - AAMutSelSuffStatLogProb(i);
 
                     double loghastings = 0;
                     z = 0;
@@ -1258,7 +1303,8 @@ class AAMutSelDSBDPOmegaModel : public ChainComponent {
 
                     UpdateCodonMatrix(i);
 
-                    deltalogprob += GammaAALogPrior(x, aacenter, aaconc) + PathSuffStatLogProb(i);
+                    deltalogprob +=
+                        GammaAALogPrior(x, aacenter, aaconc) + AAMutSelSuffStatLogProb(i);
 
                     int accepted = (log(Random::Uniform()) < deltalogprob);
                     if (accepted) {
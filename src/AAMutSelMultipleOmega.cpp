@@ -1,6 +1,7 @@
 #include <cmath>
 #include <fstream>
 #include "AAMutSelMultipleOmegaModel.hpp"
+#include "ThreadPool.hpp"
 #include "components/ChainCheckpoint.hpp"
 #include "components/ChainDriver.hpp"
 #include "components/ConsoleLogger.hpp"
@@ -67,6 +68,8 @@ int main(int argc, char *argv[]) {
         InferenceAppArgParse args(cmd);
         AAMutselArgParse aamutsel_args(cmd);
         cmd.parse();
+        if (args.seed.isSet()) { Random::InitRandom(args.seed.getValue()); }
+        ThreadPool::SetNthreads(args.threads.getValue());
         chain_driver =
             new ChainDriver(cmd.chain_name(), args.every.getValue(), args.until.getValue());
         model = new AAMutSelMultipleOmegaModel(args.alignment.getValue(), args.treefile.getValue(),
@@ -227,6 +227,10 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
     // an array of codon matrices (one for each distinct aa fitness profile)
     AAMutSelCodonMatrixBidimArray *componentcodonmatrixbidimarray;
 
+    // site suff stats collapsed at the amino-acid level, for each (profile, omega)
+    // component, for moves on fitness profiles (see AAMutSelPathSuffStat)
+    AAMutSelPathSuffStatBidimArray *componentaamutselsuffstatbidimarray;
+
     // this one is used by PhyloProcess: has to be a Selector<SubMatrix>
     DoubleMixtureSelector<SubMatrix> *sitesubmatrixarray;
     DoubleMixtureSelector<AAMutSelOmegaCodonSubMatrix> *sitecodonsubmatrixarray;
@@ -487,6 +491,7 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
         phyloprocess->Unfold();
 
         sitepathsuffstatarray = new PathSuffStatArray(Nsite);
+        componentaamutselsuffstatbidimarray = new AAMutSelPathSuffStatBidimArray(Ncat, omegaNcat);
 
         siteomegapathsuffstatarray = new OmegaPathSuffStatArray(Nsite);
         componentomegapathsuffstatarray = new OmegaPathSuffStatArray(omegaNcat);
@@ -743,6 +748,14 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
         return tot;
     }
 
+    //! return log prob of the substitution mappings over sites allocated to
+    //! profile component k, computed from the amino-acid level suff stats (see
+    //! CollectAAMutSelSuffStat), without computing the codon matrices
+    double AAMutSelSuffStatLogProb(int k) const {
+        return componentaamutselsuffstatbidimarray->GetRowLogProb(
+            k, *componentcodonmatrixbidimarray);
+    }
+
     //! return log prob of the substitution mappings over sites allocated to omega
     //! component k of the omega mixture
     double PathSuffStatOmegaLogProb(int k) const {
@@ -791,6 +804,15 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
         sitepathsuffstatarray->AddSuffStat(*phyloprocess);
     }
 
+    //! collapse site suff stats at the amino-acid level, for each (profile,
+    //! omega) component (valid as long as the nucleotide matrix, the site suff
+    //! stats and the allocations do not change)
+    void CollectAAMutSelSuffStat() {
+        componentaamutselsuffstatbidimarray->Clear();
+        componentaamutselsuffstatbidimarray->AddSuffStat(
+            *componentcodonmatrixbidimarray, *sitepathsuffstatarray, *profile_alloc, *omega_alloc);
+    }
+
     //! collect omega sufficient statistics of substitution mappings across sites
     void CollectSiteOmegaPathSuffStat() {
         siteomegapathsuffstatarray->Clear();
@@ -910,6 +932,7 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
 
     //! MH move on amino-acid fitness profiles (occupied components only)
     void MoveAAProfiles() {
+        CollectAAMutSelSuffStat();
         CompMoveAAProfiles(3);
         MulMoveAAProfiles(3);
     }
@@ -941,11 +964,11 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
                 std::vector<double> &aa = (*componentaafitnessarray)[i];
                 for (int rep = 0; rep < nrep; rep++) {
                     for (int l = 0; l < Naa; l++) { bk[l] = aa[l]; }
-                    double deltalogprob = -AALogPrior(i) - PathSuffStatLogProb(i);
+                    double deltalogprob = -AALogPrior(i) - AAMutSelSuffStatLogProb(i);
                     double loghastings = Random::ProfileProposeMove(aa, Naa, tuning, n);
                     deltalogprob += loghastings;
                     CorruptProfileCodonMatrices(i);
-                    deltalogprob += AALogPrior(i) + PathSuffStatLogProb(i);
+                    deltalogprob += AALogPrior(i) + AAMutSelSuffStatLogProb(i);
                     int accepted = (log(Random::Uniform()) < deltalogprob);
                     if (accepted) {
                         nacc++;
@@ -992,7 +1015,7 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
 
                 for (int rep = 0; rep < nrep; rep++) {
                     double deltalogprob =
-                        -GammaAALogPrior(x, aacenter, aaconc) - PathSuffStatLogProb(i);
+                        -GammaAALogPrior(x, aacenter, aaconc) - AAMutSelSuffStatLogProb(i);
 
                     double loghastings = 0;
                     z = 0;
@@ -1012,7 +1035,8 @@ class AAMutSelMultipleOmegaModel : public ChainComponent {
 
                     CorruptProfileCodonMatrices(i);
 
-                    deltalogprob += GammaAALogPrior(x, aacenter, aaconc) + PathSuffStatLogProb(i);
+                    deltalogprob +=
+                        GammaAALogPrior(x, aacenter, aaconc) + AAMutSelSuffStatLogProb(i);
 
                     int accepted = (log(Random::Uniform()) < deltalogprob);
                     if (accepted) {
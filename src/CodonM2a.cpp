@@ -1,6 +1,7 @@
 #include <cmath>
 #include <fstream>
 #include "CodonM2aModel.hpp"
+#include "ThreadPool.hpp"
 #include "components/ChainCheckpoint.hpp"
 #include "components/ChainDriver.hpp"
 #include "components/ConsoleLogger.hpp"
@@ -29,6 +30,8 @@ int main(int argc, char *argv[]) {
             cmd.get()};
 
         cmd.parse();
+        if (args.seed.isSet()) { Random::InitRandom(args.seed.getValue()); }
+        ThreadPool::SetNthreads(args.threads.getValue());
         chain_driver =
             new ChainDriver(cmd.chain_name(), args.every.getValue(), args.until.getValue());
         model =
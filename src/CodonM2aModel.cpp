@@ -85,6 +85,7 @@ void CodonM2aModel::Allocate() {
         new MixtureSelector<MGOmegaCodonSubMatrix>(componentcodonmatrixarray, sitealloc);
 
     phyloprocess = new PhyloProcess(tree.get(), codondata, branchlength, 0, sitesubmatrixarray);
+    phyloprocess->SetPatternCompression(true);
     phyloprocess->Unfold();
 
     lengthpathsuffstatarray = new PoissonSuffStatBranchArray(*tree);
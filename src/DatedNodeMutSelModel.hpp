@@ -12,6 +12,7 @@
 #include "GammaSuffStat.hpp"
 #include "IIDDirichlet.hpp"
 #include "IIDGamma.hpp"
+#include "MemoryUsage.hpp"
 #include "Move.hpp"
 #include "MultinomialAllocationVector.hpp"
 #include "MultivariateProcess.hpp"
@@ -229,6 +230,12 @@ class DatedNodeMutSelModel : public ChainComponent {
     // each aa fitness profile)
     MutSelNeCodonMatrixBidimArray *branchcomponentcodonmatrixarray;
     AAMutSelNeCodonSubMatrixArray *rootcomponentcodonmatrixarray;
+    // maximum number of branch x component codon matrices keeping their dense
+    // arrays, about 160 kB each (only those of occupied components are needed)
+    static constexpr int MaxDenseCodonMatrices = 2048;
+    // and maximum memory taken by the powers of their uniformized matrices
+    // (about 30 kB per power, see SubMatrix::TrimPowerCaches)
+    static constexpr size_t MaxCodonPowerCacheSize = size_t(512) << 20;
 
     // this one is used by PhyloProcess: has to be a BranchComponentMatrixSelector<SubMatrix>
     BranchComponentMatrixSelector<SubMatrix> *branchsitecodonmatrixarray;
@@ -254,6 +261,16 @@ class DatedNodeMutSelModel : public ChainComponent {
     PathSuffStatArray *rootcomponentpathsuffstatarray;
     PathSuffStatArray *rootsitepathsuffstatarray;
 
+    // component suff stats collapsed at the amino-acid level, for moves on
+    // fitness profiles (see AAMutSelPathSuffStat)
+    AAMutSelPathSuffStatBidimArray *branchcomponentaamutselsuffstatbidimarray;
+    AAMutSelPathSuffStatArray *rootcomponentaamutselsuffstatarray;
+
+    // suff stats of a single site (across branches, and at the root) collapsed
+    // at the amino-acid level, for resampling site allocations
+    AAMutSelPathSuffStatArray *branchaamutselsuffstatarray;
+    AAMutSelPathSuffStat *rootaamutselsuffstat;
+
     PolySuffStatBidimArray *taxoncomponentpolysuffstatbidimarray{nullptr};
     PolySuffStatBidimArray *taxonsitepolysuffstatbidimarray{nullptr};
 
@@ -461,9 +478,11 @@ class DatedNodeMutSelModel : public ChainComponent {
         // occupancy suff stats of site allocations (for resampling weights)
         occupancy = new OccupancySuffStat(Ncat);
 
-        // codon matrices per branch and per site
-        branchcomponentcodonmatrixarray = new MutSelNeCodonMatrixBidimArray(
-            GetCodonStateSpace(), nucmatrix, componentaafitnessarray, branchpopsize->GetArray());
+        // codon matrices per branch and per component (dense arrays kept for at most
+        // MaxDenseCodonMatrices of them, see MutSelNeCodonMatrixBidimArray::Trim)
+        branchcomponentcodonmatrixarray = new MutSelNeCodonMatrixBidimArray(GetCodonStateSpace(),
+            nucmatrix, componentaafitnessarray, branchpopsize->GetArray(), MaxDenseCodonMatrices,
+            MaxCodonPowerCacheSize);
 
         // sub matrices per branch and per site
         branchsitecodonmatrixarray = new BranchComponentMatrixSelector<SubMatrix>(
@@ -499,6 +518,11 @@ class DatedNodeMutSelModel : public ChainComponent {
         branchsitepathsuffstatbidimarray = new PathSuffStatBidimArray(Nbranch, Nsite);
         rootcomponentpathsuffstatarray = new PathSuffStatArray(Ncat);
         rootsitepathsuffstatarray = new PathSuffStatArray(Nsite);
+        branchcomponentaamutselsuffstatbidimarray =
+            new AAMutSelPathSuffStatBidimArray(Nbranch, Ncat);
+        rootcomponentaamutselsuffstatarray = new AAMutSelPathSuffStatArray(Ncat);
+        branchaamutselsuffstatarray = new AAMutSelPathSuffStatArray(Nbranch);
+        rootaamutselsuffstat = new AAMutSelPathSuffStat;
 
         scattersuffstat = new ScatterSuffStat(*tree);
         branchlengthpathsuffstatarray = new PoissonSuffStatBranchArray(*tree);
@@ -605,6 +629,8 @@ class DatedNodeMutSelModel : public ChainComponent {
             info, "ChronoMove", [&]() { return chronomove / (chronomove + chronoresamblesub); });
         model_stat(info, "ChronoResampleSub",
             [&]() { return chronoresamblesub / (chronomove + chronoresamblesub); });
+        // Descriptive statistics - memory (peak resident set size, in MB)
+        model_stat(info, "PeakRSS", []() { return MemoryUsage::GetPeakRSS(); });
         for (auto const &chrono : moves_chrono_time) {
             model_stat(info, "Chrono" + chrono.first, moves_chrono_time[chrono.first]);
         }
@@ -955,6 +981,31 @@ class DatedNodeMutSelModel : public ChainComponent {
         rootcomponentpathsuffstatarray->Add(*rootsitepathsuffstatarray, *sitealloc);
     }
 
+    //! collapse component suff stats at the amino-acid level (valid as long as
+    //! the nucleotide matrix, Ne and the component suff stats do not change)
+    void CollectAAMutSelSuffStat() {
+        branchcomponentaamutselsuffstatbidimarray->Clear();
+        branchcomponentaamutselsuffstatbidimarray->AddSuffStat(
+            *branchcomponentcodonmatrixarray, *branchcomponentpathsuffstatbidimarray, *occupancy);
+        rootcomponentaamutselsuffstatarray->Clear();
+        rootcomponentaamutselsuffstatarray->AddSuffStat(
+            *rootcomponentcodonmatrixarray, *rootcomponentpathsuffstatarray, *occupancy);
+    }
+
+    //! collapse the suff stats of a given site at the amino-acid level (the
+    //! codon matrices being used only for the nucleotide matrix)
+    void CollectSiteAAMutSelSuffStat(int site) {
+        for (Tree::BranchIndex branch = 0; branch < Nbranch; branch++) {
+            (*branchaamutselsuffstatarray)[branch].Clear();
+            (*branchaamutselsuffstatarray)[branch].AddSuffStat(
+                (*branchcomponentcodonmatrixarray)(branch, 0),
+                branchsitepathsuffstatbidimarray->GetVal(branch, site));
+        }
+        rootaamutselsuffstat->Clear();
+        rootaamutselsuffstat->AddSuffStat(
+            (*rootcomponentcodonmatrixarray)[0], rootsitepathsuffstatarray->GetVal(site));
+    }
+
     //! collect sufficient statistics at the tips of the tree
     void CollectSitePolySuffStat() {
         if (PolymorphismAware()) {
@@ -1068,6 +1119,12 @@ class DatedNodeMutSelModel : public ChainComponent {
         return rootcomponentpathsuffstatarray->GetLogProb(*rootcomponentcodonmatrixarray);
     }
 
+    //! same as RootPathSuffStatLogProb, but computed from the amino-acid level
+    //! suff stats (see CollectAAMutSelSuffStat)
+    double RootAAMutSelSuffStatLogProb() const {
+        return rootcomponentaamutselsuffstatarray->GetLogProb(*rootcomponentcodonmatrixarray);
+    }
+
     //! return log prob of the substitution mappings, for a given sites if allocated to component
     //! cat of the mixture
     double SitePathSuffStatLogProbGivenComponent(int site, int cat) const {
@@ -1078,6 +1135,19 @@ class DatedNodeMutSelModel : public ChainComponent {
                SitePolySuffStatLogProbGivenComponent(site, cat);
     }
 
+    //! same as SitePathSuffStatLogProbGivenComponent, but computed from the
+    //! amino-acid level suff stats of the site (see CollectSiteAAMutSelSuffStat),
+    //! without computing the codon matrices
+    double SiteAAMutSelSuffStatLogProbGivenComponent(int site, int cat) const {
+        double total = 0;
+        for (Tree::BranchIndex branch = 0; branch < Nbranch; branch++) {
+            total += branchaamutselsuffstatarray->GetVal(branch).GetLogProb(
+                branchcomponentcodonmatrixarray->GetVal(branch, cat));
+        }
+        return total + rootaamutselsuffstat->GetLogProb(rootcomponentcodonmatrixarray->GetVal(cat)) +
+               SitePolySuffStatLogProbGivenComponent(site, cat);
+    }
+
     //! return log prob of the substitution mappings over sites allocated to
     //! component k of the mixture
     double ComponentPathSuffStatLogProb(int cat) const {
@@ -1088,6 +1158,17 @@ class DatedNodeMutSelModel : public ChainComponent {
                ComponentPolySuffStatLogProb(cat);
     }
 
+    //! return log prob of the substitution mappings over sites allocated to
+    //! component k of the mixture, computed from the amino-acid level suff stats
+    //! (see CollectAAMutSelSuffStat), without computing the codon matrices
+    double ComponentAAMutSelSuffStatLogProb(int cat) const {
+        return branchcomponentaamutselsuffstatbidimarray->GetColLogProb(
+                   cat, *branchcomponentcodonmatrixarray) +
+               rootcomponentaamutselsuffstatarray->GetVal(cat).GetLogProb(
+                   rootcomponentcodonmatrixarray->GetVal(cat)) +
+               ComponentPolySuffStatLogProb(cat);
+    }
+
     //! return log prob of first-level mixture components (i.e. all amino-acid
     //! profiles drawn from component k of the base distribution), as a function
     //! of the center and concentration parameters of this component
@@ -1160,7 +1241,7 @@ class DatedNodeMutSelModel : public ChainComponent {
         }
         if (tree->is_root(node)) {
             // for the root we use the rootpathsuffstat
-            tot += RootPathSuffStatLogProb();
+            tot += RootAAMutSelSuffStatLogProb();
         } else {
             // for the branch attached to the node
             tot += NodePopSizeSuffStatLogProb(tree->branch_index(node));
@@ -1173,8 +1254,11 @@ class DatedNodeMutSelModel : public ChainComponent {
 
     //! \brief return log prob of current substitution mapping (on focal branch), as a function of
     //! Ne of a given branch
+    //!
+    //! computed from the amino-acid level suff stats (see CollectAAMutSelSuffStat),
+    //! so that the codon matrices of the branch need not be computed
     double NodePopSizeSuffStatLogProb(Tree::BranchIndex branch) const {
-        return branchcomponentpathsuffstatbidimarray->GetRowLogProb(
+        return branchcomponentaamutselsuffstatbidimarray->GetRowLogProb(
             branch, *branchcomponentcodonmatrixarray);
     }
 
@@ -1233,7 +1317,11 @@ class DatedNodeMutSelModel : public ChainComponent {
     //! Gibbs resample substitution mappings conditional on current parameter
     //! configuration
     void ResampleSub(double frac) {
+        branchcomponentcodonmatrixarray->Trim();
         UpdateMatrices();
+        // all matrices needed by the pruning at once, across threads (the root
+        // matrices only give their equilibrium frequencies)
+        branchcomponentcodonmatrixarray->UpdateDiagonalisations(*occupancy);
         phyloprocess->Move(frac);
         assert(CheckMapping());
     }
@@ -1265,6 +1353,9 @@ class DatedNodeMutSelModel : public ChainComponent {
     void MoveParameters(int nrep) {
         CollectSitePolySuffStat();
         for (int rep = 0; rep < nrep; rep++) {
+            // the allocations change at each repetition: only the codon matrices of
+            // the components currently occupied are needed in dense form
+            branchcomponentcodonmatrixarray->Trim();
             CollectComponentPolySuffStat();
             CollectLengthSuffStat();
 
@@ -1290,6 +1381,9 @@ class DatedNodeMutSelModel : public ChainComponent {
                 ChronoStop("NucRates");
             }
             if (!clamp_pop_sizes) {
+                // moves on Ne evaluated on amino-acid level suff stats (nucleotide
+                // matrix fixed from now on)
+                CollectAAMutSelSuffStat();
                 if (move_root_pop_size) {
                     ChronoStart("NodeRootPopSizes");
                     MoveRootPopSize(0.4, 6);
@@ -1478,7 +1572,7 @@ class DatedNodeMutSelModel : public ChainComponent {
     //! MH moves on branch Ne (brownian process)
     void MoveRootPopSize(double tuning, int nrep) {
         double rate = Move::Scaling(root_popsize, tuning, nrep,
-            &DatedNodeMutSelModel::RootPathSuffStatLogProb,
+            &DatedNodeMutSelModel::RootAAMutSelSuffStatLogProb,
             &DatedNodeMutSelModel::UpdateRootPopSize, this);
         MoveAcceptation(MoveName("RootPopSize", tuning), rate);
     }
@@ -1552,6 +1646,7 @@ class DatedNodeMutSelModel : public ChainComponent {
 
     //! MH move on amino-acid fitness profiles (occupied components only)
     void MoveAAProfiles() {
+        CollectAAMutSelSuffStat();
         CompMoveAAProfiles(3);
         MulMoveAAProfiles(3);
     }
@@ -1581,11 +1676,11 @@ class DatedNodeMutSelModel : public ChainComponent {
                 std::vector<double> &aa = (*componentaafitnessarray)[i];
                 for (int rep = 0; rep < nrep; rep++) {
                     for (int l = 0; l < Naa; l++) { bk[l] = aa[l]; }
-                    double deltalogprob = -AALogPrior(i) - ComponentPathSuffStatLogProb(i);
+                    double deltalogprob = -AALogPrior(i) - ComponentAAMutSelSuffStatLogProb(i);
                     double loghastings = Random::ProfileProposeMove(aa, Naa, tuning, n);
                     deltalogprob += loghastings;
                     UpdateCatCodonMatrix(i);
-                    deltalogprob += AALogPrior(i) + ComponentPathSuffStatLogProb(i);
+                    deltalogprob += AALogPrior(i) + ComponentAAMutSelSuffStatLogProb(i);
                     bool accepted = (log(Random::Uniform()) < deltalogprob);
                     if (!accepted) {
                         for (int l = 0; l < Naa; l++) { aa[l] = bk[l]; }
@@ -1629,7 +1724,7 @@ class DatedNodeMutSelModel : public ChainComponent {
 
                 for (int rep = 0; rep < nrep; rep++) {
                     double deltalogprob =
-                        -GammaAALogPrior(x, aacenter, aaconc) - ComponentPathSuffStatLogProb(i);
+                        -GammaAALogPrior(x, aacenter, aaconc) - ComponentAAMutSelSuffStatLogProb(i);
 
                     double loghastings = 0;
                     z = 0;
@@ -1650,7 +1745,7 @@ class DatedNodeMutSelModel : public ChainComponent {
                     UpdateCatCodonMatrix(i);
 
                     deltalogprob +=
-                        GammaAALogPrior(x, aacenter, aaconc) + ComponentPathSuffStatLogProb(i);
+                        GammaAALogPrior(x, aacenter, aaconc) + ComponentAAMutSelSuffStatLogProb(i);
 
                     bool accepted = (log(Random::Uniform()) < deltalogprob);
                     if (accepted) {
@@ -1690,8 +1785,11 @@ class DatedNodeMutSelModel : public ChainComponent {
         double max = 0;
         const std::vector<double> &w = weight->GetArray();
 
+        // amino-acid level suff stats, so that the codon matrices of empty
+        // components are not computed
+        CollectSiteAAMutSelSuffStat(site);
         for (int cat = 0; cat < Ncat; cat++) {
-            double tmp = SitePathSuffStatLogProbGivenComponent(site, cat);
+            double tmp = SiteAAMutSelSuffStatLogProbGivenComponent(site, cat);
             postprob[cat] = tmp;
             if ((!cat) || (max < tmp)) { max = tmp; }
         }
@@ -1,6 +1,7 @@
 #include <cmath>
 #include <fstream>
 #include "DatedNodeOmegaModel.hpp"
+#include "ThreadPool.hpp"
 #include "components/ChainCheckpoint.hpp"
 #include "components/ChainDriver.hpp"
 #include "components/ConsoleLogger.hpp"
@@ -39,6 +40,8 @@ int main(int argc, char *argv[]) {
         InferenceAppArgParse inference_args(cmd);
         DatedNodeOmegaArgParse args(cmd);
         cmd.parse();
+        if (inference_args.seed.isSet()) { Random::InitRandom(inference_args.seed.getValue()); }
+        ThreadPool::SetNthreads(inference_args.threads.getValue());
         chain_driver = new ChainDriver(
             cmd.chain_name(), inference_args.every.getValue(), inference_args.until.getValue());
         model = std::make_unique<DatedNodeOmegaModel>(inference_args.alignment.getValue(),
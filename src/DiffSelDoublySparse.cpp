@@ -1,6 +1,7 @@
 #include <cmath>
 #include <fstream>
 #include "DiffSelDoublySparseModel.hpp"
+#include "ThreadPool.hpp"
 #include "components/ChainCheckpoint.hpp"
 #include "components/ChainDriver.hpp"
 #include "components/ConsoleLogger.hpp"
@@ -89,6 +90,8 @@ int main(int argc, char *argv[]) {
         InferenceAppArgParse args(cmd);
         DiffSelDoublySparseAppArgParse ddargs(cmd);
         cmd.parse();
+        if (args.seed.isSet()) { Random::InitRandom(args.seed.getValue()); }
+        ThreadPool::SetNthreads(args.threads.getValue());
         chain_driver =
             new ChainDriver(cmd.chain_name(), args.every.getValue(), args.until.getValue());
         model = unique_ptr<DiffSelDoublySparseModel>(new DiffSelDoublySparseModel(
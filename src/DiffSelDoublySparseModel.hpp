@@ -623,6 +623,18 @@ class DiffSelDoublySparseModel : public ChainComponent {
         condsubmatrixarray->CorruptColumn(i);
     }
 
+    //! save the state of the matrices of site i (see SubMatrix::Backup), before a
+    //! move on its fitness parameters
+    void BackupSite(int i) { condsubmatrixarray->BackupColumn(i); }
+
+    //! undo a rejected move on the fitness parameters of site i: the fitness
+    //! profiles are recomputed, and the matrices get back the state saved by
+    //! BackupSite
+    void RestoreSite(int i) {
+        fitnessprofile->UpdateColumn(i);
+        condsubmatrixarray->RestoreColumn(i);
+    }
+
     // ---------------
     // log priors
     // ---------------
@@ -835,6 +847,8 @@ class DiffSelDoublySparseModel : public ChainComponent {
     //! parameter configuration
     void ResampleSub(double frac) {
         CorruptMatrices();
+        // all matrices needed by the pruning at once, across threads
+        condsubmatrixarray->UpdateDiagonalisations();
         phyloprocess->Move(frac);
     }
 
@@ -983,6 +997,7 @@ class DiffSelDoublySparseModel : public ChainComponent {
                 double loghastings = Random::PosRealVectorProposeMove(x, Naa, tuning, n);
                 deltalogprob += loghastings;
 
+                BackupSite(i);
                 UpdateSite(i);
 
                 deltalogprob += fitness->GetLogProb(0, i) + SiteSuffStatLogProb(i);
@@ -992,7 +1007,7 @@ class DiffSelDoublySparseModel : public ChainComponent {
                     nacc++;
                 } else {
                     x = bk;
-                    UpdateSite(i);
+                    RestoreSite(i);
                 }
                 ntot++;
             }
@@ -1020,6 +1035,7 @@ class DiffSelDoublySparseModel : public ChainComponent {
                 double loghastings = Random::PosRealVectorProposeMove(fit, Naa, tuning, mask);
                 deltalogprob += loghastings;
 
+                BackupSite(i);
                 UpdateSite(i);
 
                 deltalogprob += fitness->GetLogProb(0, i, mask) + SiteSuffStatLogProb(i);
@@ -1029,7 +1045,7 @@ class DiffSelDoublySparseModel : public ChainComponent {
                     nacc++;
                 } else {
                     fit = bk;
-                    UpdateSite(i);
+                    RestoreSite(i);
                 }
                 ntot++;
             }
@@ -1091,6 +1107,7 @@ class DiffSelDoublySparseModel : public ChainComponent {
 
                     deltalogprob += loghastings;
 
+                    BackupSite(i);
                     UpdateSite(i);
 
                     // log prob after the move
@@ -1101,7 +1118,7 @@ class DiffSelDoublySparseModel : public ChainComponent {
                         nacc++;
                     } else {
                         x = bk;
-                        UpdateSite(i);
+                        RestoreSite(i);
                     }
                     ntot++;
                 }
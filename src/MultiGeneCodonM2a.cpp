@@ -2,6 +2,7 @@
 #include <fstream>
 #include "MultiGeneCodonM2aModel.hpp"
 #include "SlaveChainDriver.hpp"
+#include "ThreadPool.hpp"
 #include "components/ChainCheckpoint.hpp"
 #include "components/ChainDriver.hpp"
 #include "components/ConsoleLogger.hpp"
@@ -58,6 +59,8 @@ AppData<D, M> load_appdata(ChainCmdLine& cmd) {
         InferenceAppArgParse app(cmd);
         MultiGeneCodonM2aArgParse args(cmd);
         cmd.parse();
+        if (app.seed.isSet()) { Random::InitRandom(app.seed.getValue()); }
+        ThreadPool::SetNthreads(app.threads.getValue());
         d.chain_driver =
             unique_ptr<D>(new D(cmd.chain_name(), app.every.getValue(), app.until.getValue()));
         d.model = unique_ptr<M>(new M(
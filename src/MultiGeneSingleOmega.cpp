@@ -2,6 +2,7 @@
 #include <fstream>
 #include "MultiGeneSingleOmegaModel.hpp"
 #include "SlaveChainDriver.hpp"
+#include "ThreadPool.hpp"
 #include "components/ChainCheckpoint.hpp"
 #include "components/ChainDriver.hpp"
 #include "components/ConsoleLogger.hpp"
@@ -77,6 +78,8 @@ AppData<D, M> load_appdata(ChainCmdLine& cmd) {
         InferenceAppArgParse app(cmd);
         MultiGeneSingleOmegaArgParse args(cmd);
         cmd.parse();
+        if (app.seed.isSet()) { Random::InitRandom(app.seed.getValue()); }
+        ThreadPool::SetNthreads(app.threads.getValue());
         d.chain_driver =
             unique_ptr<D>(new D(cmd.chain_name(), app.every.getValue(), app.until.getValue()));
         d.model = unique_ptr<M>(new M(app.alignment.getValue(), app.treefile.getValue(),
@@ -0,0 +1,161 @@
+// Microbenchmark of the construction of mutation-selection codon matrices (see
+// AAMutSelOmegaCodonSubMatrix and FixationKernels)
+//
+// For random fitness profiles, times the former construction of the rate
+// matrix (one exponential per non-synonymous neighbour, neighbours found by
+// comparing codons) against the construction from the fixation table (one
+// exponential per pair of amino-acids, computed by the kernels, neighbours
+// read from the flat neighbour array of the codon state space), for each
+// instruction set supported by the CPU, and checks that all agree.
+//
+// usage: mutselbench [nmatrices]
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "lib/AAMutSelOmegaCodonSubMatrix.hpp"
+#include "lib/FixationKernels.hpp"
+#include "lib/GTRSubMatrix.hpp"
+#include "lib/PropagationKernels.hpp"
+#include "lib/Random.hpp"
+
+using namespace std;
+
+// gives access to the rows of the rate matrix, for the reference implementation
+class BenchMatrix : public AAMutSelOmegaCodonSubMatrix {
+  public:
+    BenchMatrix(const CodonStateSpace *instatespace, const SubMatrix *inNucMatrix,
+        const vector<double> &inaa, double inNe)
+        : SubMatrix(instatespace->GetNstate(), false),
+          CodonSubMatrix(instatespace, false),
+          NucCodonSubMatrix(instatespace, inNucMatrix, false),
+          OmegaCodonSubMatrix(instatespace, 1.0, false),
+          AAMutSelOmegaCodonSubMatrix(instatespace, inNucMatrix, inaa, 1.0, inNe, false) {}
+
+    void LegacyMatrix(double *out) const {
+        vector<double> fit(Naa);
+        vector<double> logfit(Naa);
+        for (int a = 0; a < Naa; a++) {
+            fit[a] = exp(Ne * log(aa[a])) + 1e-8;
+            logfit[a] = log(fit[a]);
+        }
+        for (int i = 0; i < Nstate; i++) {
+            double *row = out + i * Nstate;
+            double total = 0;
+            for (int j = 0; j < Nstate; j++) {
+                row[j] = 0;
+                if (i == j) { continue; }
+                int pos = GetDifferingPosition(i, j);
+                if ((pos != -1) && (pos != 3)) {
+                    int a = GetCodonPosition(pos, i);
+                    int b = GetCodonPosition(pos, j);
+                    row[j] = (*NucMatrix)(a, b);
+                    if (!Synonymous(i, j)) {
+                        double deltaS = logfit[GetCodonStateSpace()->Translation(j)] -
+                                        logfit[GetCodonStateSpace()->Translation(i)];
+                        double pfix;
+                        if ((fabs(deltaS)) < 1e-30) {
+                            pfix = 1 + deltaS / 2;
+                        } else if (deltaS > 50) {
+                            pfix = deltaS;
+                        } else if (deltaS < -50) {
+                            pfix = 0;
+                        } else {
+                            pfix = deltaS / (1.0 - exp(-deltaS));
+                        }
+                        row[j] *= pfix * GetOmega();
+                    }
+                }
+                total += row[j];
+            }
+            row[i] = -total;
+        }
+    }
+
+    void KernelMatrix(double *out) {
+        CorruptMatrix();
+        for (int i = 0; i < Nstate; i++) {
+            ComputeArray(i);
+            for (int j = 0; j < Nstate; j++) { out[i * Nstate + j] = 0; }
+            out[i * Nstate + i] = Q(i, i);
+            const CodonStateSpace::Neighbor *neighbor = statespace->GetNeighborArray(i);
+            for (int k = 0; k < statespace->GetNneighbor(i); k++) {
+                out[i * Nstate + neighbor[k].codon] = Q(i, neighbor[k].codon);
+            }
+        }
+    }
+};
+
+// time (in ns per matrix) of f applied to each profile in turn (copied into
+// the profile seen by the matrix)
+template <class F>
+double Time(int nmatrices, int Nstate, const vector<vector<double>> &profiles,
+    vector<double> &current, vector<double> &out, F f) {
+    auto start = chrono::high_resolution_clock::now();
+    for (int n = 0; n < nmatrices; n++) {
+        int k = n % profiles.size();
+        current = profiles[k];
+        f(out.data() + k * Nstate * Nstate);
+    }
+    auto stop = chrono::high_resolution_clock::now();
+    return chrono::duration<double, nano>(stop - start).count() / nmatrices;
+}
+
+double MaxRelDiff(const vector<double> &x, const vector<double> &y) {
+    double max = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        double d = fabs(x[i] - y[i]) / (fabs(x[i]) + 1e-300);
+        if ((x[i] != y[i]) && (max < d)) { max = d; }
+    }
+    return max;
+}
+
+int main(int argc, char *argv[]) {
+    Random::InitRandom(42);
+    int nmatrices = (argc > 1) ? atoi(argv[1]) : 20000;
+    const int nprofile = 32;
+    const PropagationKernels::InstructionSet best = PropagationKernels::GetInstructionSet();
+
+    CodonStateSpace statespace(Universal);
+    vector<double> rr(Nrr);
+    for (auto &r : rr) { r = Random::sExpo(); }
+    vector<double> stat(Nnuc, 1.0 / Nnuc);
+    GTRSubMatrix nucmatrix(Nnuc, rr, stat, true);
+
+    // profiles more or less concentrated (weak to strong selection)
+    for (double conc : {20.0, 1.0, 0.1}) {
+        vector<vector<double>> profiles(nprofile, vector<double>(Naa));
+        for (auto &profile : profiles) {
+            double tot = 0;
+            for (auto &x : profile) {
+                x = Random::sGamma(conc);
+                tot += x;
+            }
+            for (auto &x : profile) { x /= tot; }
+        }
+        vector<double> current = profiles[0];
+        BenchMatrix matrix(&statespace, &nucmatrix, current, 1.0);
+        int Nstate = matrix.GetNstate();
+        vector<double> ref(nprofile * Nstate * Nstate, 0);
+        vector<double> out(ref.size(), 0);
+
+        cout << "profile concentration " << conc << "\n";
+        double tref = Time(nmatrices, Nstate, profiles, current, ref,
+            [&](double *m) { matrix.LegacyMatrix(m); });
+        cout << "  legacy   " << tref << " ns/matrix\n";
+        for (auto set :
+            {PropagationKernels::GENERIC, PropagationKernels::AVX2, PropagationKernels::AVX512}) {
+            if (!PropagationKernels::SetInstructionSet(set)) { continue; }
+            double t = Time(nmatrices, Nstate, profiles, current, out,
+                [&](double *m) { matrix.KernelMatrix(m); });
+            cout << "  " << PropagationKernels::GetName(set);
+            for (int k = strlen(PropagationKernels::GetName(set)); k < 9; k++) { cout << ' '; }
+            cout << t << " ns/matrix (x" << tref / t << ", max rel diff " << MaxRelDiff(ref, out)
+                 << ")\n";
+        }
+        PropagationKernels::SetInstructionSet(best);
+    }
+}
@@ -0,0 +1,118 @@
+// Benchmark of the sampling of substitution histories (PhyloProcess::ResampleSub)
+// under codon mutation-selection matrices
+//
+// For a codon alignment and tree, with one AAMutSelOmegaCodonSubMatrix per
+// site (random fitness profiles), times ResampleSub per cycle with dense
+// sampling (full rows of the generator, dense powers of the uniformized
+// matrix) against sparse sampling (rows restricted to the nearest neighbors of
+// each codon, see SubMatrix::IsSparse). As in an MCMC, the matrices are changed
+// before each cycle, so that the powers of the uniformized matrices are
+// recomputed; the diagonalisations (identical in both cases) are done before
+// starting the clock. Sparse sampling is then run again with an adaptive
+// maximum number of accept-reject trials per branch (see
+// PhyloProcess::SetAdaptivePathSampling) instead of a fixed one. The mean
+// number of substitutions per cycle should agree between all samplers. All
+// branches have the same length (0.2 by default): the longer the branches, the
+// more time is spent in the jumps of accept-reject sampling (see
+// SubMatrix::DrawOneStep), and in failed accept-reject trials. Also reports the
+// largest total size of the powers of the uniformized matrices cached during
+// a cycle (see SubMatrix::GetPowerCacheSize).
+//
+// usage: resamplesubbench [ncycle] [branchlength] [alignment] [tree]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "lib/BranchArray.hpp"
+#include "lib/CodonSequenceAlignment.hpp"
+#include "lib/CodonSubMatrixArray.hpp"
+#include "lib/GTRSubMatrix.hpp"
+#include "lib/PathSuffStat.hpp"
+#include "lib/PhyloProcess.hpp"
+#include "lib/Random.hpp"
+#include "tree/implem.hpp"
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    Random::InitRandom(42);
+    int ncycle = (argc > 1) ? atoi(argv[1]) : 20;
+    double length = (argc > 2) ? atof(argv[2]) : 0.2;
+    string datafile = (argc > 3) ? argv[3] : "data/bglobin/bglobin.phy";
+    string treefile = (argc > 4) ? argv[4] : "data/bglobin/bglobin.tre";
+
+    FileSequenceAlignment data(datafile);
+    CodonSequenceAlignment codondata(&data, true);
+    const CodonStateSpace *statespace = codondata.GetCodonStateSpace();
+    ifstream treestream(treefile);
+    NHXParser parser{treestream};
+    auto tree = make_from_parser(parser);
+    int nsite = codondata.GetNsite();
+
+    vector<double> rr(Nrr);
+    for (auto &r : rr) { r = Random::sExpo(); }
+    vector<double> stat(Nnuc, 1.0 / Nnuc);
+    GTRSubMatrix nucmatrix(Nnuc, rr, stat, true);
+
+    SimpleArray<vector<double>> fitness(nsite, vector<double>(Naa));
+    auto drawfitness = [&]() {
+        for (int i = 0; i < nsite; i++) {
+            double tot = 0;
+            for (auto &x : fitness[i]) {
+                x = Random::sGamma(1.0);
+                tot += x;
+            }
+            for (auto &x : fitness[i]) { x /= tot; }
+        }
+    };
+    drawfitness();
+    AAMutSelOmegaCodonSubMatrixArray matrixarray(statespace, &nucmatrix, &fitness, 1.0);
+    vector<const SubMatrix *> matrices;
+    for (int i = 0; i < nsite; i++) { matrices.push_back(&matrixarray.GetVal(i)); }
+
+    SimpleBranchArray<double> branchlength(*tree, length);
+    PhyloProcess process(tree.get(), &codondata, &branchlength, nullptr, &matrixarray);
+    process.Unfold();
+
+    cout << nsite << " codon sites, " << tree->nb_nodes() << " nodes\n";
+    for (int mode = 0; mode < 3; mode++) {
+        bool sparse = (mode > 0);
+        bool adaptive = (mode == 2);
+        SubMatrix::SetSparseSampling(sparse);
+        process.SetAdaptivePathSampling(adaptive);
+        PhyloProcess::PathSamplingStat before = process.GetPathSamplingStat();
+        Random::InitRandom(7);
+        double time = 0;
+        double nsub = 0;
+        size_t powcache = 0;
+        for (int cycle = 0; cycle < ncycle; cycle++) {
+            drawfitness();
+            matrixarray.UpdateCodonMatrices();
+            SubMatrix::UpdateDiagonalisations(matrices);
+            auto start = chrono::high_resolution_clock::now();
+            process.ResampleSub();
+            auto stop = chrono::high_resolution_clock::now();
+            time += chrono::duration<double, milli>(stop - start).count();
+            powcache = max(powcache, SubMatrix::GetPowerCacheSize());
+
+            PathSuffStat suffstat;
+            suffstat.AddSuffStat(process);
+            for (int k = 0; k < suffstat.GetNpair(); k++) { nsub += suffstat.GetPairCountAt(k); }
+        }
+        PhyloProcess::PathSamplingStat stat = process.GetPathSamplingStat();
+        double npath = stat.npath - before.npath;
+        double nuni = stat.nuni - before.nuni;
+        cout << (sparse ? (adaptive ? "  adaptive " : "  sparse   ") : "  dense    ")
+             << time / ncycle << " ms/cycle (" << nsub / ncycle << " substitutions per cycle; "
+             << (stat.ntrial - before.ntrial) / npath << " accept-reject trials and "
+             << (stat.njump - before.njump) / npath << " jumps per path, "
+             << 100 * nuni / npath << "% uniformized with "
+             << (stat.nunievent - before.nunievent) / nuni << " events; "
+             << stat.artime - before.artime << " ms in accept-reject, "
+             << stat.unitime - before.unitime << " ms in uniformization; "
+             << powcache / 1048576.0 << " MB of cached powers at most)\n";
+    }
+    SubMatrix::SetSparseSampling(true);
+}
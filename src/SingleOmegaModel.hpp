@@ -154,6 +154,7 @@ class SingleOmegaModel : public ChainComponent {
         codonmatrix = new MGOmegaCodonSubMatrix(GetCodonStateSpace(), nucmatrix, omega);
 
         phyloprocess = new PhyloProcess(tree.get(), codondata, branchlength, 0, codonmatrix);
+        phyloprocess->SetPatternCompression(true);
         phyloprocess->Unfold();
     }
 
@@ -2,6 +2,8 @@
 
 #include "components/test.cpp"
 
+#include "lib/test.cpp"
+
 #include "operations/test.cpp"
 
 #include "tags/test.cpp"
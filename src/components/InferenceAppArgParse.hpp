@@ -18,4 +18,12 @@ class InferenceAppArgParse : public TreeAppArgParse {
     explicit InferenceAppArgParse(ChainCmdLine &cmd) : TreeAppArgParse(cmd) {}
     ValueArg<std::string> alignment{
         "a", "alignment", "Alignment file (PHYLIP)", true, "", "string", cmd};
+    ValueArg<int> threads{"", "threads",
+        "Number of threads across which sites are distributed for likelihood computation and "
+        "substitution mapping (not saved in the checkpoint: a restarted chain runs on 1 thread)",
+        false, 1, "int", cmd};
+    ValueArg<int> seed{"", "seed",
+        "Random seed (by default, drawn from the clock); for a given seed, the chain does not "
+        "depend on the number of threads",
+        false, -1, "int", cmd};
 };
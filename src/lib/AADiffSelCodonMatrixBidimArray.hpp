@@ -83,6 +83,29 @@ class AADiffSelCodonMatrixBidimArray : public BidimArray<SubMatrix>,
         for (int i = 0; i < GetNrow(); i++) { matrixarray[i][j]->CorruptMatrix(); }
     }
 
+    //! diagonalise all matrices, in parallel (see
+    //! SubMatrix::UpdateDiagonalisations)
+    void UpdateDiagonalisations() const {
+        std::vector<const SubMatrix *> matrices;
+        for (int i = 0; i < GetNrow(); i++) {
+            for (int j = 0; j < GetNcol(); j++) { matrices.push_back(matrixarray[i][j]); }
+        }
+        // shared by all matrices
+        nucmatrix.UpdateMatrix();
+        SubMatrix::UpdateDiagonalisations(matrices);
+    }
+
+    //! save the state of the matrices of column (site) j (see SubMatrix::Backup)
+    void BackupColumn(int j) {
+        for (int i = 0; i < GetNrow(); i++) { matrixarray[i][j]->Backup(); }
+    }
+
+    //! restore the state of the matrices of column (site) j saved by BackupColumn
+    //! (see SubMatrix::Restore)
+    void RestoreColumn(int j) {
+        for (int i = 0; i < GetNrow(); i++) { matrixarray[i][j]->Restore(); }
+    }
+
     //! signal corruption for column (site) j, and only for those rows
     //! (conditions) that are flagged
     void CorruptColumn(int j, const std::vector<int> &flag) {
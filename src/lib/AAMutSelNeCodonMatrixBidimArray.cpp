@@ -1,17 +1,27 @@
+#include <algorithm>
 #include <cassert>
 
 #include "AAMutSelNeCodonMatrixBidimArray.hpp"
 
 MutSelNeCodonMatrixBidimArray::MutSelNeCodonMatrixBidimArray(
     const CodonStateSpace *codonstatespace, const SubMatrix *nucmatrix,
-    const Selector<std::vector<double>> *fitnessarray, const std::vector<double> &pop_size_array)
+    const Selector<std::vector<double>> *fitnessarray, const std::vector<double> &pop_size_array,
+    int inmaxdense, size_t inmaxpowercache)
     : matrixbidimarray(pop_size_array.size(),
-          std::vector<AAMutSelOmegaCodonSubMatrix *>(fitnessarray->GetSize(), nullptr)) {
+          std::vector<AAMutSelOmegaCodonSubMatrix *>(fitnessarray->GetSize(), nullptr)),
+      maxdense(inmaxdense),
+      maxpowercache(inmaxpowercache),
+      period(1),
+      lastuse(pop_size_array.size() * fitnessarray->GetSize()),
+      nrelease(0) {
     std::cout << GetNrow() << "\t" << GetNcol() << "\n";
     for (int i = 0; i < GetNrow(); i++) {
         for (int j = 0; j < GetNcol(); j++) {
             matrixbidimarray[i][j] = new AAMutSelOmegaCodonSubMatrix(
                 codonstatespace, nucmatrix, fitnessarray->GetVal(j), 1.0, pop_size_array.at(i));
+            // dense arrays allocated on first use
+            matrixbidimarray[i][j]->ReleaseDenseStorage();
+            lastuse[i * GetNcol() + j] = 0;
         }
     }
     assert(static_cast<int>(matrixbidimarray.size()) == GetNrow());
@@ -26,6 +36,11 @@ MutSelNeCodonMatrixBidimArray::~MutSelNeCodonMatrixBidimArray() {
 const AAMutSelOmegaCodonSubMatrix &MutSelNeCodonMatrixBidimArray::GetVal(int i, int j) const {
     assert(0 <= i and i < GetNrow());
     assert(0 <= j and j < GetNcol());
+    // only write when needed, so as not to invalidate cache lines shared across threads
+    std::atomic<uint64_t> &last = lastuse[i * GetNcol() + j];
+    if (last.load(std::memory_order_relaxed) != period) {
+        last.store(period, std::memory_order_relaxed);
+    }
     return *matrixbidimarray.at(i).at(j);
 }
 
@@ -58,6 +73,67 @@ void MutSelNeCodonMatrixBidimArray::UpdateColCodonMatrices(const Selector<int> &
     }
 }
 
+int MutSelNeCodonMatrixBidimArray::GetNdense() const {
+    int ndense = 0;
+    for (int i = 0; i < GetNrow(); i++) {
+        for (int j = 0; j < GetNcol(); j++) { ndense += matrixbidimarray[i][j]->HasDenseStorage(); }
+    }
+    return ndense;
+}
+
+void MutSelNeCodonMatrixBidimArray::UpdateDiagonalisations(
+    const Selector<int> &occupancy) const {
+    std::vector<const SubMatrix *> matrices;
+    for (int i = 0; i < GetNrow(); i++) {
+        for (int j = 0; j < GetNcol(); j++) {
+            if (occupancy.GetVal(j)) { matrices.push_back(&GetVal(i, j)); }
+        }
+    }
+    if (!matrices.empty()) {
+        // shared by all matrices
+        matrixbidimarray[0][0]->GetNucMatrix()->UpdateMatrix();
+    }
+    SubMatrix::UpdateDiagonalisations(matrices);
+}
+
+void MutSelNeCodonMatrixBidimArray::Trim() {
+    // matrices whose values are out of date are released (they would have to be
+    // recomputed anyway), and the others sorted by period of last use
+    std::vector<std::pair<uint64_t, int>> dense;
+    for (int i = 0; i < GetNrow(); i++) {
+        for (int j = 0; j < GetNcol(); j++) {
+            AAMutSelOmegaCodonSubMatrix *matrix = matrixbidimarray[i][j];
+            if (matrix->HasDenseContent()) {
+                int k = i * GetNcol() + j;
+                dense.emplace_back(lastuse[k].load(std::memory_order_relaxed), k);
+            } else if (matrix->HasDenseStorage()) {
+                matrix->ReleaseDenseStorage();
+                nrelease++;
+            }
+        }
+    }
+    int nexcess = static_cast<int>(dense.size()) - maxdense;
+    if ((maxdense == 0) || (nexcess < 0)) { nexcess = 0; }
+    if (nexcess > 0) {
+        std::nth_element(dense.begin(), dense.begin() + nexcess, dense.end());
+        for (int n = 0; n < nexcess; n++) {
+            int k = dense[n].second;
+            matrixbidimarray[k / GetNcol()][k % GetNcol()]->ReleaseDenseStorage();
+        }
+        nrelease += nexcess;
+    }
+    if (maxpowercache > 0) {
+        // the matrices still dense, least recently used first
+        std::sort(dense.begin() + nexcess, dense.end());
+        std::vector<const SubMatrix *> matrices;
+        for (auto it = dense.begin() + nexcess; it != dense.end(); ++it) {
+            matrices.push_back(matrixbidimarray[it->second / GetNcol()][it->second % GetNcol()]);
+        }
+        SubMatrix::TrimPowerCaches(matrices, maxpowercache);
+    }
+    period++;
+}
+
 AAMutSelNeCodonSubMatrixArray::AAMutSelNeCodonSubMatrixArray(
     const CodonStateSpace *codonstatespace, const SubMatrix *nucmatrix,
     const Selector<std::vector<double>> *aafitnessarray, double ne)
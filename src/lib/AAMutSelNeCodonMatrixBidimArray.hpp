@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include "AAMutSelOmegaCodonSubMatrix.hpp"
 #include "BidimArray.hpp"
 
@@ -11,16 +13,40 @@
  * constructs a 2-dimensional-array of AAMutSelOmegaCodonSubMatrix where the number of columns
  * is the size of the fitness profiles array (number of sites or component) and the number of rows
  * equal the size of the population size array (number of branches or condition).
+ *
+ * With 2*Ntaxa branches and up to 100 components, keeping the dense arrays of all
+ * matrices (rates, eigen decomposition, etc, about 160 kB per codon matrix) would
+ * take gigabytes, whereas only those of the components currently occupied are
+ * needed for the likelihood and the substitution mappings (the moves on fitness
+ * profiles and Ne being done on amino-acid level suff stats, see
+ * AAMutSelPathSuffStat). Matrices thus keep only their parameters (Ne, fitness
+ * profile, shared nucleotide matrix), their dense arrays being allocated on
+ * first use (see SubMatrix::ReleaseDenseStorage), and released by Trim when
+ * their values are out of date (e.g. for components that are no longer
+ * occupied), or, if a maximum number of dense matrices is given, for the least
+ * recently used matrices beyond this number. Accesses are recorded by GetVal
+ * (concurrently), by periods delimited by the calls to Trim, which should be
+ * done once per cycle, at a point where no matrix is being used (e.g. before
+ * each resampling of the substitution mappings): between two calls, the bound
+ * is thus exceeded if more matrices are needed at once. Similarly, the powers
+ * of the uniformized matrices cached for sampling substitution histories (about
+ * 30 kB per power, tens of powers per matrix along long branches) can be
+ * bounded in total, those of the least recently used matrices being released
+ * first (see SubMatrix::TrimPowerCaches).
  */
 
 class MutSelNeCodonMatrixBidimArray : public BidimArray<SubMatrix>,
                                       public BidimArray<AAMutSelOmegaCodonSubMatrix> {
   public:
     //! constructor parameterized by a codon state space, a single nucleotide matrix, an array of
-    //! fitness profiles and an array of population size.
+    //! fitness profiles, an array of population size, the maximum number of matrices
+    //! keeping their dense arrays after a call to Trim (0: no maximum) and the maximum
+    //! memory (in bytes) taken by the powers of the uniformized matrices after a call to
+    //! Trim (0: no maximum)
     MutSelNeCodonMatrixBidimArray(const CodonStateSpace *incodonstatespace,
         const SubMatrix *innucmatrix, const Selector<std::vector<double>> *infitnessarray,
-        const std::vector<double> &pop_size_array);
+        const std::vector<double> &pop_size_array, int inmaxdense = 0,
+        size_t inmaxpowercache = 0);
 
     ~MutSelNeCodonMatrixBidimArray() override;
 
@@ -29,7 +55,8 @@ class MutSelNeCodonMatrixBidimArray : public BidimArray<SubMatrix>,
     //! return the number of columns (number of cat)
     int GetNcol() const override { return matrixbidimarray.begin()->size(); }
 
-    //! const access to the matrix for row (branch) i and column (cat) j
+    //! const access to the matrix for row (branch) i and column (cat) j (recorded as
+    //! a use of the matrix, see Trim)
     const AAMutSelOmegaCodonSubMatrix &GetVal(int i, int j) const override;
 
     //! non const access to the matrix for row (branch) i and column (cat) j
@@ -50,8 +77,43 @@ class MutSelNeCodonMatrixBidimArray : public BidimArray<SubMatrix>,
     //! signal corruption for row (branch) i and column (cat) j
     void UpdateMatrix(int i, int j);
 
+    //! diagonalise all matrices of the columns (cats) for which occupancy[j] != 0,
+    //! in parallel (see SubMatrix::UpdateDiagonalisations)
+    void UpdateDiagonalisations(const Selector<int> &occupancy) const;
+
+    //! \brief release the dense arrays of the matrices whose values are out of
+    //! date, and then of the least recently used matrices beyond GetMaxDense(),
+    //! and the powers of the least recently used matrices beyond
+    //! GetMaxPowerCacheSize()
+    //!
+    //! Starts a new period for recording the use of the matrices; should not be
+    //! called concurrently with any access to the matrices.
+    void Trim();
+
+    //! maximum number of dense matrices kept by Trim (0: no maximum)
+    int GetMaxDense() const { return maxdense; }
+
+    //! maximum memory (in bytes) taken by the powers of the uniformized matrices
+    //! (of all matrices, see SubMatrix::GetPowerCacheSize) after Trim (0: no
+    //! maximum)
+    size_t GetMaxPowerCacheSize() const { return maxpowercache; }
+
+    //! number of matrices with their dense arrays currently allocated
+    int GetNdense() const;
+
+    //! total number of matrices released by Trim so far
+    int GetNrelease() const { return nrelease; }
+
   private:
     std::vector<std::vector<AAMutSelOmegaCodonSubMatrix *>> matrixbidimarray;
+
+    // period of last use of each matrix (row-major), the current period being
+    // incremented by each call to Trim
+    int maxdense;
+    size_t maxpowercache;
+    uint64_t period;
+    mutable std::vector<std::atomic<uint64_t>> lastuse;
+    int nrelease;
 };
 
 /**
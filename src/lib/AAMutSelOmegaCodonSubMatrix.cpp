@@ -17,30 +17,33 @@ void AAMutSelOmegaCodonSubMatrix::ComputeStationary() const {
     for (int i = 0; i < Nstate; i++) { mStationary[i] /= total; }
 }
 
+void AAMutSelOmegaCodonSubMatrix::UpdateFixation() const {
+    int npair = statespace->GetNaaPair();
+    fixation.resize(2 * npair);
+    double *deltaS = ScratchMemory::Get(ScratchMemory::FIXATION, npair);
+    for (int k = 0; k < npair; k++) {
+        deltaS[k] =
+            GetLogFitness(statespace->GetAAPairTo(k)) - GetLogFitness(statespace->GetAAPairFrom(k));
+    }
+    FixationKernels::Compute(npair, deltaS, fixation.data(), fixation.data() + npair);
+    fixationflag = true;
+}
+
 void AAMutSelOmegaCodonSubMatrix::ComputeArray(int i) const {
+    if (!fixationflag) { UpdateFixation(); }
+    double omega = GetOmega();
     double total = 0;
-    for (auto j : statespace->GetNeighbors(i)) {
-        int pos = GetDifferingPosition(i, j);
-        int a = GetCodonPosition(pos, i);
-        int b = GetCodonPosition(pos, j);
-
-        Q(i, j) = (*NucMatrix)(a, b);
-
-        if (!Synonymous(i, j)) {
-            double deltaS = GetLogFitness(GetCodonStateSpace()->Translation(j)) -
-                            GetLogFitness(GetCodonStateSpace()->Translation(i));
-            if ((fabs(deltaS)) < 1e-30) {
-                Q(i, j) *= 1 + deltaS / 2;
-            } else if (deltaS > 50) {
-                Q(i, j) *= deltaS;
-            } else if (deltaS < -50) {
-                Q(i, j) = 0;
-            } else {
-                Q(i, j) *= deltaS / (1.0 - exp(-deltaS));
-            }
-
-            Q(i, j) *= GetOmega();
+    const CodonStateSpace::Neighbor *neighbor = statespace->GetNeighborArray(i);
+    int nneighbor = statespace->GetNneighbor(i);
+    double *sparserow = sparseQ + sparsestart[i];
+    for (int k = 0; k < nneighbor; k++) {
+        int j = neighbor[k].codon;
+        Q(i, j) = (*NucMatrix)(neighbor[k].nucfrom, neighbor[k].nucto);
+        if (neighbor[k].aapair != -1) {
+            Q(i, j) *= fixation[neighbor[k].aapair];
+            Q(i, j) *= omega;
         }
+        sparserow[k] = Q(i, j);
 
         total += Q(i, j);
 
@@ -54,31 +57,18 @@ void AAMutSelOmegaCodonSubMatrix::ComputeArray(int i) const {
 
 std::tuple<double, double> AAMutSelOmegaCodonSubMatrix::GetFlowDNDS() const {
     UpdateStationary();
+    if (!fixationflag) { UpdateFixation(); }
     double totom = 0;
     double totweight = 0;
     for (int i = 0; i < Nstate; i++) {
         double weight = 0;
         double om = 0;
-        for (auto j : statespace->GetNeighbors(i)) {
-            if (!Synonymous(i, j)) {
-                int pos = GetDifferingPosition(i, j);
-                int a = GetCodonPosition(pos, i);
-                int b = GetCodonPosition(pos, j);
-
-                double nucrate = (*NucMatrix)(a, b);
-
-                double deltaS = GetLogFitness(GetCodonStateSpace()->Translation(j)) -
-                                GetLogFitness(GetCodonStateSpace()->Translation(i));
-                double pfix;
-                if ((fabs(deltaS)) < 1e-30) {
-                    pfix = 1 + deltaS / 2;
-                } else if (deltaS > 50) {
-                    pfix = deltaS;
-                } else if (deltaS < -50) {
-                    pfix = 0;
-                } else {
-                    pfix = deltaS / (1.0 - exp(-deltaS));
-                }
+        const CodonStateSpace::Neighbor *neighbor = statespace->GetNeighborArray(i);
+        int nneighbor = statespace->GetNneighbor(i);
+        for (int k = 0; k < nneighbor; k++) {
+            if (neighbor[k].aapair != -1) {
+                double nucrate = (*NucMatrix)(neighbor[k].nucfrom, neighbor[k].nucto);
+                double pfix = fixation[neighbor[k].aapair];
 
                 om += nucrate * pfix;
                 weight += nucrate;
@@ -2,6 +2,7 @@
 
 #include "CodonSubMatrix.hpp"
 #include <cassert>
+#include "FixationKernels.hpp"
 
 /**
  * \brief A mutation-selection codon substitution process.
@@ -47,6 +48,12 @@ class AAMutSelOmegaCodonSubMatrix : public virtual NucCodonSubMatrix,
         return logfitnesses[a];
     }
 
+    //! \brief relative fixation rate of a non-synonymous mutation, given the
+    //! difference deltaS between the log fitnesses of the new and the old amino
+    //! acids (S / (1 - e^{-S}), with safeguards for small and large |S|, see
+    //! FixationKernels)
+    static double FixationFactor(double deltaS) { return FixationKernels::Scalar(deltaS); }
+
     std::tuple<double, double> GetFlowDNDS() const;
     double GetPredictedDNDS() const;
 
@@ -58,21 +65,45 @@ class AAMutSelOmegaCodonSubMatrix : public virtual NucCodonSubMatrix,
     void CorruptMatrixNoFitnessRecomput() { SubMatrix::CorruptMatrix(); }
 
     void CorruptMatrix() override {
-        for (size_t a{0}; a < aa.size(); a++) {
-            fitnesses[a] = exp(Ne * log(aa[a])) + 1e-8;
-            logfitnesses[a] = log(fitnesses[a]);
-        }
+        UpdateFitnesses();
+        fixationflag = false;
         SubMatrix::CorruptMatrix();
     }
 
+    //! restore the state saved by Backup, the fitness profile and Ne having been
+    //! set back by the caller (the fixation factors, which are not saved, are
+    //! recomputed if needed)
+    void Restore() override {
+        UpdateFitnesses();
+        fixationflag = false;
+        SubMatrix::Restore();
+    }
+
   protected:
     void ComputeArray(int i) const override;
     void ComputeStationary() const override;
 
+    // compute the fixation factors of all amino-acid replacements that can be
+    // made by a single nucleotide substitution (see
+    // CodonStateSpace::GetNeighborArray), once for all rows of the matrix
+    void UpdateFixation() const;
+
+    void UpdateFitnesses() {
+        for (size_t a{0}; a < aa.size(); a++) {
+            fitnesses[a] = ((Ne == 1.0) ? aa[a] : exp(Ne * log(aa[a]))) + 1e-8;
+            logfitnesses[a] = log(fitnesses[a]);
+        }
+    }
+
     // fitness precomputation
     std::vector<double> fitnesses;
     std::vector<double> logfitnesses;
 
+    // fixation factors, indexed as CodonStateSpace::Neighbor::aapair (depend
+    // only on the fitnesses, and thus are kept by CorruptMatrixNoFitnessRecomput)
+    mutable std::vector<double> fixation;
+    mutable bool fixationflag{false};
+
     // data members
     const std::vector<double> &aa;
     double Ne;
@@ -1,4 +1,5 @@
 #include "CodonStateSpace.hpp"
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
@@ -125,6 +126,38 @@ CodonStateSpace::CodonStateSpace(GeneticCodeType type) {
         assert(!neighbors_vector.empty());
         assert(neighbors_vector[from].size() <= 9);
     }
+
+    // flat neighbor array, and indexing of amino-acid replacements
+    vector<int> aapairindex(Naa * Naa, -1);
+    for (int from{0}; from < Nstate; from++) {
+        for (int to : neighbors_vector[from]) {
+            int a = std::min(CodonCode[from], CodonCode[to]);
+            int b = std::max(CodonCode[from], CodonCode[to]);
+            if ((a != b) && (aapairindex[a * Naa + b] == -1)) {
+                aapairindex[a * Naa + b] = aapairfrom.size();
+                aapairfrom.push_back(a);
+                aapairto.push_back(b);
+            }
+        }
+    }
+    neighboroffset.assign(Nstate + 1, 0);
+    for (int from{0}; from < Nstate; from++) {
+        neighboroffset[from + 1] = neighboroffset[from] + neighbors_vector[from].size();
+        for (int to : neighbors_vector[from]) {
+            int pos = differing_pos[from][to];
+            int a = CodonCode[from];
+            int b = CodonCode[to];
+            int aapair = -1;
+            if (a < b) {
+                aapair = aapairindex[a * Naa + b];
+            } else if (a > b) {
+                aapair = GetNaaPair() + aapairindex[b * Naa + a];
+            }
+            neighborarray.push_back(
+                Neighbor{to, CodonPos[pos][from], CodonPos[pos][to], aapair});
+            neighborcodon.push_back(to);
+        }
+    }
 }
 
 CodonStateSpace::~CodonStateSpace() throw() {
@@ -231,4 +264,3 @@ int CodonStateSpace::ComputeDifferingPosition(int i, int j) const {
     return 3;
 }
 
-vector<int> CodonStateSpace::GetNeighbors(int i) const { return neighbors_vector[i]; }
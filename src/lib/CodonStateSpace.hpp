@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <vector>
 #include "Random.hpp"
 #include "StateSpace.hpp"
 
@@ -19,6 +20,19 @@ class CodonStateSpace : public StateSpace {
   public:
     static const int Npos = 3;
 
+    //! \brief a nearest neighbor of a codon (see GetNeighborArray)
+    //!
+    //! aapair is the index, in a fixation table of size 2*GetNaaPair(), of the
+    //! amino-acid replacement made by the substitution toward this neighbor: k
+    //! for a replacement from GetAAPairFrom(k) to GetAAPairTo(k), GetNaaPair()+k
+    //! for the reverse replacement, and -1 for a synonymous substitution.
+    struct Neighbor {
+        int codon;
+        int nucfrom;
+        int nucto;
+        int aapair;
+    };
+
     //! constructor: should always specify the genetic code (en enum type:
     //! Universal, MtMam or MtInv, see BiologicalSequences.h)
     explicit CodonStateSpace(GeneticCodeType type);
@@ -65,7 +79,41 @@ class CodonStateSpace : public StateSpace {
     int ComputeDifferingPosition(int i, int j) const;
 
     //! \brief return the vector of codons differing at exactly one position
-    std::vector<int> GetNeighbors(int i) const;
+    const std::vector<int> &GetNeighbors(int i) const { return neighbors_vector[i]; }
+
+    //! \brief return the nearest neighbors of codon i, as a contiguous array of
+    //! GetNneighbor(i) entries (in the same order as GetNeighbors), giving the
+    //! neighbor, the nucleotides before and after the substitution and the
+    //! amino-acid replacement
+    //!
+    //! Neighbors of all codons are stored in one flat array, built once by the
+    //! constructor, so that matrix constructions (see
+    //! AAMutSelOmegaCodonSubMatrix::ComputeArray) only do linear scans.
+    const Neighbor *GetNeighborArray(int i) const {
+        return neighborarray.data() + neighboroffset[i];
+    }
+
+    //! number of nearest neighbors of codon i
+    int GetNneighbor(int i) const { return neighboroffset[i + 1] - neighboroffset[i]; }
+
+    //! offsets of the neighbors of each codon in the flat neighbor array
+    //! (Nstate+1 entries), i.e. the row offsets of the CSR structure of codon
+    //! matrices (see SubMatrix::SetSparseStructure)
+    const int *GetNeighborOffsets() const { return neighboroffset.data(); }
+
+    //! neighbor codons of all codons, in the order of the flat neighbor array
+    //! (i.e. the column indices of the CSR structure of codon matrices)
+    const int *GetNeighborCodons() const { return neighborcodon.data(); }
+
+    //! number of unordered pairs of distinct amino-acids a < b such that a can
+    //! be replaced by b through a single nucleotide substitution
+    int GetNaaPair() const { return aapairfrom.size(); }
+
+    //! first (smaller) amino-acid of pair k
+    int GetAAPairFrom(int k) const { return aapairfrom[k]; }
+
+    //! second (larger) amino-acid of pair k
+    int GetAAPairTo(int k) const { return aapairto[k]; }
 
     //! return the integer encoding for the nucleotide at requested position
     //! pos=0,1, or 2
@@ -138,5 +186,10 @@ class CodonStateSpace : public StateSpace {
 
     mutable std::map<int, int> degeneracy;
     std::vector<std::vector<int>> neighbors_vector;
+    std::vector<int> neighboroffset;
+    std::vector<Neighbor> neighborarray;
+    std::vector<int> neighborcodon;
+    std::vector<int> aapairfrom;
+    std::vector<int> aapairto;
     int **differing_pos;
 };
\ No newline at end of file
@@ -3,6 +3,8 @@ using namespace std;
 
 void MGCodonSubMatrix::ComputeArray(int i) const {
     double total = 0;
+    double *sparserow = sparseQ + sparsestart[i];
+    int k = 0;
     for (auto j : statespace->GetNeighbors(i)) {
         int pos = GetDifferingPosition(i, j);
         int a = GetCodonPosition(pos, i);
@@ -10,6 +12,7 @@ void MGCodonSubMatrix::ComputeArray(int i) const {
 
         assert(a != b);
         Q(i, j) = (*NucMatrix)(a, b);
+        sparserow[k++] = Q(i, j);
         total += Q(i, j);
     }
     Q(i, i) = -total;
@@ -32,6 +35,8 @@ void MGCodonSubMatrix::ComputeStationary() const {
 
 void MGOmegaCodonSubMatrix::ComputeArray(int i) const {
     double total = 0;
+    double *sparserow = sparseQ + sparsestart[i];
+    int k = 0;
     for (auto j : statespace->GetNeighbors(i)) {
         int pos = GetDifferingPosition(i, j);
         int a = GetCodonPosition(pos, i);
@@ -40,6 +45,7 @@ void MGOmegaCodonSubMatrix::ComputeArray(int i) const {
         assert(a != b);
         Q(i, j) = (*NucMatrix)(a, b);
         if (!Synonymous(i, j)) { Q(i, j) *= GetOmega(); }
+        sparserow[k++] = Q(i, j);
 
         total += Q(i, j);
     }
@@ -17,9 +17,13 @@ const double omegamin = 1e-5;
 class CodonSubMatrix : public virtual SubMatrix {
   public:
     //! constructor parameterized by codon state space (itself specifying the
-    //! genetic code)
+    //! genetic code); codon matrices are sparse, with the nearest neighbors
+    //! of each codon as their only non-null off-diagonal rates (see
+    //! SubMatrix::SetSparseStructure)
     CodonSubMatrix(const CodonStateSpace *instatespace, bool innormalise)
-        : SubMatrix(instatespace->GetNstate(), innormalise), statespace(instatespace) {}
+        : SubMatrix(instatespace->GetNstate(), innormalise), statespace(instatespace) {
+        SetSparseStructure(statespace->GetNeighborOffsets(), statespace->GetNeighborCodons());
+    }
 
     const CodonStateSpace *GetCodonStateSpace() const { return statespace; }
 
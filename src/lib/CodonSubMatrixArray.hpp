@@ -168,6 +168,20 @@ class AAMutSelOmegaCodonSubMatrixArray : public Array<SubMatrix>,
         }
     }
 
+    //! save the state of all matrices (see SubMatrix::Backup)
+    void BackupCodonMatrices() {
+        for (int i = 0; i < GetSize(); i++) { (*this)[i].Backup(); }
+    }
+
+    //! restore the state of all matrices saved by BackupCodonMatrices, with the
+    //! current value(s) of omega (see SubMatrix::Restore)
+    void RestoreCodonMatrices() {
+        for (int i = 0; i < GetSize(); i++) {
+            (*this)[i].SetOmega(omegaarray ? omegaarray->GetVal(i) : omega);
+            (*this)[i].Restore();
+        }
+    }
+
     //! update only those matrices for which occupancy[i] != 0
     void UpdateCodonMatrices(const Selector<int> &occupancy) {
         if (omegaarray) {
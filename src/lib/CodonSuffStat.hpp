@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <typeinfo>
 #include "CodonSubMatrixArray.hpp"
@@ -51,19 +52,17 @@ class NucPathSuffStat : public SuffStat {
         const SubMatrix *nucmatrix = codonmatrix.GetNucMatrix();
 
         // root part
-        const std::map<int, int> &codonrootcount = codonpathsuffstat.GetRootCountMap();
-        for (std::map<int, int>::const_iterator i = codonrootcount.begin();
-             i != codonrootcount.end(); i++) {
-            int codon = i->first;
-            rootcount[cod->GetCodonPosition(0, codon)] += i->second;
-            rootcount[cod->GetCodonPosition(1, codon)] += i->second;
-            rootcount[cod->GetCodonPosition(2, codon)] += i->second;
-        }
-
-        const std::map<int, double> &waitingtime = codonpathsuffstat.GetWaitingTimeMap();
-        for (std::map<int, double>::const_iterator i = waitingtime.begin(); i != waitingtime.end();
-             i++) {
-            int codon = i->first;
+        for (int codon = 0; codon < codonpathsuffstat.GetNstate(); codon++) {
+            int count = codonpathsuffstat.GetRootCount(codon);
+            if (count == 0) { continue; }
+            rootcount[cod->GetCodonPosition(0, codon)] += count;
+            rootcount[cod->GetCodonPosition(1, codon)] += count;
+            rootcount[cod->GetCodonPosition(2, codon)] += count;
+        }
+
+        for (int codon = 0; codon < codonpathsuffstat.GetNstate(); codon++) {
+            double waitingtime = codonpathsuffstat.GetWaitingTime(codon);
+            if (waitingtime == 0) { continue; }
             for (int c2 = 0; c2 < cod->GetNstate(); c2++) {
                 if (c2 != codon) {
                     int pos = cod->GetDifferingPosition(codon, c2);
@@ -71,18 +70,15 @@ class NucPathSuffStat : public SuffStat {
                         int n1 = cod->GetCodonPosition(pos, codon);
                         int n2 = cod->GetCodonPosition(pos, c2);
                         pairbeta[n1][n2] +=
-                            i->second * codonmatrix(codon, c2) / (*nucmatrix)(n1, n2);
+                            waitingtime * codonmatrix(codon, c2) / (*nucmatrix)(n1, n2);
                     }
                 }
             }
         }
 
-        const std::map<std::pair<int, int>, int> &codonpaircount =
-            codonpathsuffstat.GetPairCountMap();
-        for (std::map<std::pair<int, int>, int>::const_iterator i = codonpaircount.begin();
-             i != codonpaircount.end(); i++) {
-            int cod1 = i->first.first;
-            int cod2 = i->first.second;
+        for (int k = 0; k < codonpathsuffstat.GetNpair(); k++) {
+            int cod1 = codonpathsuffstat.GetPairFrom(k);
+            int cod2 = codonpathsuffstat.GetPairTo(k);
             int pos = cod->GetDifferingPosition(cod1, cod2);
             if (pos == 3) {
                 std::cerr << "error in codon conj path suffstat\n";
@@ -90,7 +86,7 @@ class NucPathSuffStat : public SuffStat {
             }
             int n1 = cod->GetCodonPosition(pos, cod1);
             int n2 = cod->GetCodonPosition(pos, cod2);
-            paircount[n1][n2] += i->second;
+            paircount[n1][n2] += codonpathsuffstat.GetPairCountAt(k);
         }
     }
 
@@ -142,17 +138,19 @@ class NucPathSuffStat : public SuffStat {
         // root part
         int nroot = 0;
         auto rootstat = mat.GetStationary();
+        const double *logrootstat = mat.GetLogStationary();
         for (int i = 0; i < Nnuc; i++) {
-            total += rootcount[i] * log(rootstat[i]);
+            total += rootcount[i] * logrootstat[i];
             nroot += rootcount[i];
         }
         total -= nroot / 3 * log(cod.GetNormStat(rootstat));
 
         // non root part
         for (int i = 0; i < Nnuc; i++) {
+            const double *logrow = mat.GetLogRow(i);
             for (int j = 0; j < Nnuc; j++) {
                 if (i != j) {
-                    total += paircount[i][j] * log(mat(i, j));
+                    total += paircount[i][j] * logrow[j];
                     total -= pairbeta[i][j] * mat(i, j);
                 }
             }
@@ -222,14 +220,11 @@ class OmegaPathSuffStat : public PoissonSuffStat {
         int ncodon = codonsubmatrix.GetNstate();
         const CodonStateSpace *statespace = codonsubmatrix.GetCodonStateSpace();
 
-        const std::map<std::pair<int, int>, int> &paircount = pathsuffstat.GetPairCountMap();
-        const std::map<int, double> &waitingtime = pathsuffstat.GetWaitingTimeMap();
-
         double tmpbeta = 0;
-        for (std::map<int, double>::const_iterator i = waitingtime.begin(); i != waitingtime.end();
-             i++) {
+        for (int a = 0; a < pathsuffstat.GetNstate(); a++) {
+            double waitingtime = pathsuffstat.GetWaitingTime(a);
+            if (waitingtime == 0) { continue; }
             double totnonsynrate = 0;
-            int a = i->first;
             for (int b = 0; b < ncodon; b++) {
                 if (b != a) {
                     if (codonsubmatrix(a, b) != 0) {
@@ -239,14 +234,15 @@ class OmegaPathSuffStat : public PoissonSuffStat {
                     }
                 }
             }
-            tmpbeta += i->second * totnonsynrate;
+            tmpbeta += waitingtime * totnonsynrate;
         }
         tmpbeta /= codonsubmatrix.GetOmega();
 
         int tmpcount = 0;
-        for (std::map<std::pair<int, int>, int>::const_iterator i = paircount.begin();
-             i != paircount.end(); i++) {
-            if (!statespace->Synonymous(i->first.first, i->first.second)) { tmpcount += i->second; }
+        for (int k = 0; k < pathsuffstat.GetNpair(); k++) {
+            if (!statespace->Synonymous(pathsuffstat.GetPairFrom(k), pathsuffstat.GetPairTo(k))) {
+                tmpcount += pathsuffstat.GetPairCountAt(k);
+            }
         }
 
         PoissonSuffStat::AddSuffStat(tmpcount, tmpbeta);
@@ -455,3 +451,282 @@ class OmegaPathSuffStatBranchArray : public SimpleBranchArray<OmegaPathSuffStat>
   private:
     const Tree &tree;
 };
+
+/**
+ * \brief A sufficient statistic for substitution histories, as a function of
+ * the amino-acid fitness profile and omega of a mutation-selection codon model
+ *
+ * When Q is an AAMutSelOmegaCodonSubMatrix, the log probability of a
+ * substitution history (S) only depends on the amino-acid fitnesses F (and on
+ * omega) through 20x20 aggregated statistics: for each pair of amino-acids
+ * (a,b), the number of non-synonymous substitutions from a to b, and the total
+ * mutational opportunity from a to b (waiting times multiplied by nucleotide
+ * mutation rates, summed over all codon pairs encoding a->b), together with
+ * the root counts per amino-acid and the mutational weight of each
+ * amino-acid at equilibrium (sum of the nucleotide stationary products over
+ * its codons). All other terms of log p(S | Q) only depend on the nucleotide
+ * matrix and are summed up into a constant.
+ *
+ * Once computed from a PathSuffStat (see AddSuffStat), log p(S | F, omega) can
+ * thus be evaluated directly from the fitness parameters of the matrix, which
+ * is typically what is needed by MCMC moves on the fitness profiles: the codon
+ * matrix only needs to be corrupted (which recomputes the 20 fitnesses), and
+ * its rows are never computed. The suff stat is valid as long as the
+ * nucleotide matrix and the substitution histories do not change.
+ */
+
+class AAMutSelPathSuffStat : public SuffStat {
+  public:
+    AAMutSelPathSuffStat()
+        : rootcount(Naa, 0), aamass(Naa, 0), paircount(Naa * Naa, 0), pairbeta(Naa * Naa, 0) {}
+
+    ~AAMutSelPathSuffStat() {}
+
+    //! set suff stat to 0
+    void Clear() {
+        for (int a = 0; a < Naa; a++) {
+            rootcount[a] = 0;
+            aamass[a] = 0;
+        }
+        for (int ab : pairs) {
+            paircount[ab] = 0;
+            pairbeta[ab] = 0;
+        }
+        pairs.clear();
+        nroot = 0;
+        nnonsyn = 0;
+        constant = 0;
+    }
+
+    //! \brief compute the 20x20 suff stat out of a 61x61 codon path suff stat
+    //!
+    //! The codon matrix is only used for its nucleotide matrix and its genetic
+    //! code (all suff stats added up into this one should share the same
+    //! nucleotide matrix); its rows are not accessed.
+    void AddSuffStat(
+        const AAMutSelOmegaCodonSubMatrix &codonmatrix, const PathSuffStat &codonpathsuffstat) {
+        if (codonmatrix.isNormalised()) {
+            std::cerr << "error in AAMutSelPathSuffStat: codon matrix should not be normalised\n";
+            exit(1);
+        }
+        const CodonStateSpace *cod = codonmatrix.GetCodonStateSpace();
+        const SubMatrix &nucmatrix = *codonmatrix.GetNucMatrix();
+        int ncodon = cod->GetNstate();
+
+        // equilibrium: pi_c = nucstat(c) F(aa(c)) / sum_a aamass(a) F(a)
+        for (int a = 0; a < Naa; a++) { aamass[a] = 0; }
+        for (int c = 0; c < ncodon; c++) {
+            aamass[cod->Translation(c)] += NucStat(nucmatrix, *cod, c);
+        }
+
+        // root part
+        for (int c = 0; c < codonpathsuffstat.GetNstate(); c++) {
+            int count = codonpathsuffstat.GetRootCount(c);
+            if (count == 0) { continue; }
+            rootcount[cod->Translation(c)] += count;
+            nroot += count;
+            constant += count * log(NucStat(nucmatrix, *cod, c));
+        }
+
+        // waiting times: Q_cc = - sum_j mu_cj (synonymous)
+        //                       - omega sum_j mu_cj pfix(S_aa(j) - S_aa(c)) (non-syn)
+        for (int c = 0; c < codonpathsuffstat.GetNstate(); c++) {
+            double waitingtime = codonpathsuffstat.GetWaitingTime(c);
+            if (waitingtime == 0) { continue; }
+            int a = cod->Translation(c);
+            const CodonStateSpace::Neighbor *neighbor = cod->GetNeighborArray(c);
+            for (int k = 0; k < cod->GetNneighbor(c); k++) {
+                double mu = nucmatrix(neighbor[k].nucfrom, neighbor[k].nucto);
+                if (neighbor[k].aapair == -1) {
+                    constant -= waitingtime * mu;
+                } else {
+                    int ab = GetPair(a, cod->Translation(neighbor[k].codon));
+                    pairbeta[ab] += waitingtime * mu;
+                }
+            }
+        }
+
+        // substitutions: log Q_cj = log mu_cj (+ log omega + log pfix, non-syn)
+        for (int k = 0; k < codonpathsuffstat.GetNpair(); k++) {
+            int c = codonpathsuffstat.GetPairFrom(k);
+            int c2 = codonpathsuffstat.GetPairTo(k);
+            int count = codonpathsuffstat.GetPairCountAt(k);
+            int pos = cod->GetDifferingPosition(c, c2);
+            if (pos == 3) {
+                std::cerr << "error in AAMutSelPathSuffStat: codons differ at more than one "
+                             "position\n";
+                exit(1);
+            }
+            constant += count * log(nucmatrix(
+                                    cod->GetCodonPosition(pos, c), cod->GetCodonPosition(pos, c2)));
+            if (!cod->Synonymous(c, c2)) {
+                paircount[GetPair(cod->Translation(c), cod->Translation(c2))] += count;
+                nnonsyn += count;
+            }
+        }
+    }
+
+    //! \brief return log p(S | F, omega), with F and omega given by the current
+    //! parameters of the codon matrix (whose rows are not computed)
+    //!
+    //! Up to numerical errors, this is equal to PathSuffStat::GetLogProb, for
+    //! the codon path suff stat from which this suff stat was computed.
+    double GetLogProb(const AAMutSelOmegaCodonSubMatrix &codonmatrix) const {
+        double total = constant;
+
+        double norm = 0;
+        for (int a = 0; a < Naa; a++) {
+            norm += aamass[a] * codonmatrix.GetFitness(a);
+            if (rootcount[a]) { total += rootcount[a] * codonmatrix.GetLogFitness(a); }
+        }
+        total -= nroot * log(norm);
+
+        double omega = codonmatrix.GetOmega();
+        double beta = 0;
+        for (int ab : pairs) {
+            double pfix = AAMutSelOmegaCodonSubMatrix::FixationFactor(
+                codonmatrix.GetLogFitness(ab % Naa) - codonmatrix.GetLogFitness(ab / Naa));
+            beta += pairbeta[ab] * pfix;
+            if (paircount[ab]) { total += paircount[ab] * log(pfix); }
+        }
+        total -= omega * beta;
+        if (nnonsyn) { total += nnonsyn * log(omega); }
+        return total;
+    }
+
+  private:
+    // index of the (a,b) amino-acid pair in the flat pair arrays, registering
+    // the pair in the list of visited pairs if needed
+    int GetPair(int a, int b) {
+        int ab = a * Naa + b;
+        if ((pairbeta[ab] == 0) && (paircount[ab] == 0)) {
+            if (std::find(pairs.begin(), pairs.end(), ab) == pairs.end()) { pairs.push_back(ab); }
+        }
+        return ab;
+    }
+
+    // product of the nucleotide equilibrium frequencies at the 3 positions
+    static double NucStat(const SubMatrix &nucmatrix, const CodonStateSpace &cod, int codon) {
+        return nucmatrix.Stationary(cod.GetCodonPosition(0, codon)) *
+               nucmatrix.Stationary(cod.GetCodonPosition(1, codon)) *
+               nucmatrix.Stationary(cod.GetCodonPosition(2, codon));
+    }
+
+    std::vector<int> rootcount;
+    std::vector<double> aamass;
+    // flat Naa*Naa arrays (non-synonymous pairs only), and list of the visited
+    // pairs, over which log probs are computed
+    std::vector<int> paircount;
+    std::vector<double> pairbeta;
+    std::vector<int> pairs;
+    int nroot{0};
+    int nnonsyn{0};
+    double constant{0};
+};
+
+/**
+ * \brief An array of mutation-selection suff stats (e.g. one per component of
+ * a mixture of amino-acid fitness profiles)
+ */
+
+class AAMutSelPathSuffStatArray : public SimpleArray<AAMutSelPathSuffStat> {
+  public:
+    //! constructor (param: array size)
+    AAMutSelPathSuffStatArray(int insize) : SimpleArray<AAMutSelPathSuffStat>(insize) {}
+    ~AAMutSelPathSuffStatArray() {}
+
+    //! set all suff stats to 0
+    void Clear() {
+        for (int i = 0; i < GetSize(); i++) { (*this)[i].Clear(); }
+    }
+
+    //! compute the 20x20 suff stats, member-wise, out of an array of 61x61
+    //! codon path suff stats (only for those entries for which occupancy is
+    //! non-zero)
+    void AddSuffStat(const Selector<AAMutSelOmegaCodonSubMatrix> &codonmatrixarray,
+        const Selector<PathSuffStat> &pathsuffstatarray, const Selector<int> &occupancy) {
+        for (int i = 0; i < GetSize(); i++) {
+            if (occupancy.GetVal(i)) {
+                (*this)[i].AddSuffStat(codonmatrixarray.GetVal(i), pathsuffstatarray.GetVal(i));
+            }
+        }
+    }
+
+    //! return total log prob, summed over all entries of the array
+    double GetLogProb(const Selector<AAMutSelOmegaCodonSubMatrix> &codonmatrixarray) const {
+        double total = 0;
+        for (int i = 0; i < GetSize(); i++) {
+            total += GetVal(i).GetLogProb(codonmatrixarray.GetVal(i));
+        }
+        return total;
+    }
+};
+
+/**
+ * \brief A bi-dimensional array of mutation-selection suff stats (e.g. over
+ * branches and components, or over components of two independent mixtures)
+ */
+
+class AAMutSelPathSuffStatBidimArray : public SimpleBidimArray<AAMutSelPathSuffStat> {
+  public:
+    //! constructor (params: number of rows and columns)
+    AAMutSelPathSuffStatBidimArray(int innrow, int inncol)
+        : SimpleBidimArray<AAMutSelPathSuffStat>(innrow, inncol, AAMutSelPathSuffStat()) {}
+    ~AAMutSelPathSuffStatBidimArray() {}
+
+    //! set all suff stats to 0
+    void Clear() {
+        for (int i = 0; i < GetNrow(); i++) {
+            for (int j = 0; j < GetNcol(); j++) { (*this)(i, j).Clear(); }
+        }
+    }
+
+    //! compute the 20x20 suff stats, member-wise, out of a bi-dimensional array
+    //! of 61x61 codon path suff stats (only for those columns for which
+    //! occupancy is non-zero)
+    void AddSuffStat(const BidimSelector<AAMutSelOmegaCodonSubMatrix> &codonmatrixarray,
+        const BidimSelector<PathSuffStat> &pathsuffstatarray, const Selector<int> &occupancy) {
+        for (int i = 0; i < GetNrow(); i++) {
+            for (int j = 0; j < GetNcol(); j++) {
+                if (occupancy.GetVal(j)) {
+                    (*this)(i, j).AddSuffStat(
+                        codonmatrixarray.GetVal(i, j), pathsuffstatarray.GetVal(i, j));
+                }
+            }
+        }
+    }
+
+    //! compute the 20x20 suff stats out of an array of site-specific 61x61 codon
+    //! path suff stats, each site being allocated to entry (rowalloc[site],
+    //! colalloc[site]) (double mixture models)
+    void AddSuffStat(const BidimSelector<AAMutSelOmegaCodonSubMatrix> &codonmatrixarray,
+        const Selector<PathSuffStat> &sitepathsuffstatarray, const Selector<int> &rowalloc,
+        const Selector<int> &colalloc) {
+        for (int site = 0; site < sitepathsuffstatarray.GetSize(); site++) {
+            int i = rowalloc.GetVal(site);
+            int j = colalloc.GetVal(site);
+            (*this)(i, j).AddSuffStat(
+                codonmatrixarray.GetVal(i, j), sitepathsuffstatarray.GetVal(site));
+        }
+    }
+
+    //! return log prob summed over a given row
+    double GetRowLogProb(
+        int row, const BidimSelector<AAMutSelOmegaCodonSubMatrix> &codonmatrixarray) const {
+        double total = 0;
+        for (int j = 0; j < GetNcol(); j++) {
+            total += GetVal(row, j).GetLogProb(codonmatrixarray.GetVal(row, j));
+        }
+        return total;
+    }
+
+    //! return log prob summed over a given column
+    double GetColLogProb(
+        int col, const BidimSelector<AAMutSelOmegaCodonSubMatrix> &codonmatrixarray) const {
+        double total = 0;
+        for (int i = 0; i < GetNrow(); i++) {
+            total += GetVal(i, col).GetLogProb(codonmatrixarray.GetVal(i, col));
+        }
+        return total;
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * \brief A contiguous and aligned storage for the conditional likelihood
+ * vectors used by PhyloProcess
+ *
+ * Instead of allocating one Nstate+1 vector per node (each at a random
+ * location on the heap), all conditional likelihoods are kept in a single
+ * block of memory, for all nodes of the tree and for a block of Nsite
+ * consecutive sites. The vector for a given (node, site) pair is found at
+ * offset (node * Nsite + site) * stride, where stride is Nstate+1 (the extra
+ * entry holding the log of the scaling factor) rounded up to a whole number of
+ * cache lines. Thus, the vectors of all sites of a block are contiguous for a
+ * given node, and a postorder traversal of the tree (see
+ * Tree::leaves_root_to_iter()) processing all sites of the block at each node
+ * walks linearly through memory.
+ */
+
+class CondLArena {
+  public:
+    //! alignment (in bytes) of the arena and of each conditional likelihood
+    //! vector
+    static const int Alignment = 64;
+
+    //! constructor parameterized by the number of nodes, the number of sites of
+    //! the block and the number of states
+    CondLArena(int inNnode, int inNsite, int inNstate)
+        : Nnode(inNnode), Nsite(inNsite), Nstate(inNstate) {
+        int perline = Alignment / sizeof(double);
+        stride = ((Nstate + 1 + perline - 1) / perline) * perline;
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, Alignment, GetSize() * sizeof(double))) {
+            std::cerr << "error in CondLArena: could not allocate " << GetSize()
+                      << " conditional likelihoods\n";
+            exit(1);
+        }
+        data = static_cast<double *>(ptr);
+        for (size_t i = 0; i < GetSize(); i++) { data[i] = 0; }
+    }
+
+    ~CondLArena() { free(data); }
+
+    CondLArena(const CondLArena &) = delete;
+    CondLArena &operator=(const CondLArena &) = delete;
+
+    //! return number of nodes
+    int GetNnode() const { return Nnode; }
+    //! return number of sites of the block
+    int GetNsite() const { return Nsite; }
+    //! return number of states
+    int GetNstate() const { return Nstate; }
+    //! return the distance (in doubles) between the vectors of two consecutive
+    //! sites
+    int GetStride() const { return stride; }
+    //! return total number of doubles held by the arena
+    size_t GetSize() const { return static_cast<size_t>(Nnode) * Nsite * stride; }
+
+    //! access to the conditional likelihood vector of a given node and site
+    //! (the site being given relative to the beginning of the block)
+    double *operator()(int node, int site) {
+        return data + (static_cast<size_t>(node) * Nsite + site) * stride;
+    }
+
+    //! const access to the conditional likelihood vector of a given node and
+    //! site
+    const double *operator()(int node, int site) const {
+        return data + (static_cast<size_t>(node) * Nsite + site) * stride;
+    }
+
+  private:
+    int Nnode;
+    int Nsite;
+    int Nstate;
+    int stride;
+    double *data;
+};
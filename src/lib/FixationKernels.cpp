@@ -0,0 +1,62 @@
+#include "FixationKernels.hpp"
+#include <cmath>
+#include <cstring>
+#include "PropagationKernels.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FIXATION_X86
+#endif
+
+namespace generic {
+#define VECSIZE 2
+#define KERNEL_TARGET
+#include "FixationKernelsImpl.hpp"
+#undef KERNEL_TARGET
+#undef VECSIZE
+}  // namespace generic
+
+#ifdef FIXATION_X86
+namespace avx2 {
+#define VECSIZE 4
+#define KERNEL_TARGET __attribute__((target("avx2,fma")))
+#include "FixationKernelsImpl.hpp"
+#undef KERNEL_TARGET
+#undef VECSIZE
+}  // namespace avx2
+
+namespace avx512 {
+#define VECSIZE 8
+#define KERNEL_TARGET __attribute__((target("avx512f,fma")))
+#include "FixationKernelsImpl.hpp"
+#undef KERNEL_TARGET
+#undef VECSIZE
+}  // namespace avx512
+#endif
+
+void FixationKernels::Compute(int n, const double *deltaS, double *forward, double *backward) {
+#ifdef FIXATION_X86
+    switch (PropagationKernels::GetInstructionSet()) {
+        case PropagationKernels::AVX512:
+            avx512::Compute(n, deltaS, forward, backward);
+            return;
+        case PropagationKernels::AVX2:
+            avx2::Compute(n, deltaS, forward, backward);
+            return;
+        default:
+            break;
+    }
+#endif
+    generic::Compute(n, deltaS, forward, backward);
+}
+
+double FixationKernels::Scalar(double deltaS) {
+    if (std::fabs(deltaS) < SeriesThreshold) {
+        double s2 = deltaS * deltaS;
+        return (1 + s2 * (1.0 / 12 + s2 * (-1.0 / 720 + s2 * (1.0 / 30240)))) + 0.5 * deltaS;
+    } else if (deltaS > 50) {
+        return deltaS;
+    } else if (deltaS < -50) {
+        return 0;
+    }
+    return deltaS / (1.0 - std::exp(-deltaS));
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/**
+ * \brief SIMD kernel computing the relative fixation rates of mutation-selection
+ * codon models
+ *
+ * Under a mutation-selection model, the rate of a non-synonymous substitution
+ * is the mutation rate multiplied by the relative fixation rate
+ * S / (1 - e^{-S}), where S is the difference between the scaled log fitnesses
+ * of the new and the old amino-acids (see AAMutSelOmegaCodonSubMatrix). The
+ * kernel computes these factors, for an array of S values, in both directions
+ * at once (the factor for -S being the factor for S multiplied by e^{-S}, a
+ * single exponential is needed for each pair), using a polynomial exponential
+ * written with explicit vectors (see FixationKernelsImpl.hpp), and a series
+ * expansion for small |S|, where the direct formula suffers from cancellation.
+ * Factors are 0 (resp. S) for S < -50 (resp. S > 50).
+ *
+ * As for PropagationKernels (whose instruction set selection is shared), the
+ * kernel is compiled for several instruction sets, and the best one supported
+ * by the CPU is used.
+ */
+
+class FixationKernels {
+  public:
+    //! forward[k] = f(deltaS[k]) and backward[k] = f(-deltaS[k]), for k=0..n-1,
+    //! where f(S) = S / (1 - e^{-S}) (arrays need not be aligned or padded)
+    static void Compute(int n, const double *deltaS, double *forward, double *backward);
+
+    //! scalar version of f(S), giving the same results up to rounding errors
+    static double Scalar(double deltaS);
+
+    //! threshold on |S| below which the series expansion is used
+    static constexpr double SeriesThreshold = 1e-2;
+};
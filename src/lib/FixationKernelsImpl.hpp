@@ -0,0 +1,81 @@
+// Fixation factor kernel, written with explicit vectors of VECSIZE doubles
+// (GCC vector extensions). This file is included by FixationKernels.cpp once
+// per instruction set, each time within its own namespace, with VECSIZE and
+// KERNEL_TARGET (the target attribute of all functions) defined accordingly.
+
+typedef double vec __attribute__((vector_size(VECSIZE * sizeof(double))));
+typedef long long ivec __attribute__((vector_size(VECSIZE * sizeof(double))));
+
+KERNEL_TARGET inline vec Broadcast(double x) {
+    vec v;
+    for (int l = 0; l < VECSIZE; l++) { v[l] = x; }
+    return v;
+}
+
+// e^x for |x| <= 700: x = n log 2 + r, with |r| <= log(2)/2, e^r by its Taylor
+// expansion up to degree 13 (relative error below 1e-17), and 2^n built
+// directly in the exponent bits
+KERNEL_TARGET inline vec Exp(vec x) {
+    // adding and subtracting 1.5 * 2^52 rounds to the nearest integer
+    const vec shifter = Broadcast(6755399441055744.0);
+    vec n = (x * Broadcast(1.4426950408889634) + shifter) - shifter;
+    // log(2) split in two parts, the first one with trailing zero bits, so
+    // that n * log2hi is exact
+    vec r = (x - n * Broadcast(6.93147180369123816490e-01)) -
+            n * Broadcast(1.90821492927058770002e-10);
+    static const double coeff[14] = {1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120,
+        1.0 / 720, 1.0 / 5040, 1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800,
+        1.0 / 479001600, 1.0 / 6227020800};
+    vec p = Broadcast(coeff[13]);
+    for (int k = 12; k >= 0; k--) { p = p * r + Broadcast(coeff[k]); }
+    ivec bits = (__builtin_convertvector(n, ivec) + 1023) << 52;
+    return p * reinterpret_cast<vec &>(bits);
+}
+
+KERNEL_TARGET inline void Fixation(vec s, vec &forward, vec &backward) {
+    const vec zero = Broadcast(0);
+    const vec one = Broadcast(1);
+    const vec max = Broadcast(50);
+
+    vec sc = (s > max) ? max : s;
+    sc = (sc < -max) ? -max : sc;
+    vec abs = (s < zero) ? -s : s;
+    auto small = abs < Broadcast(FixationKernels::SeriesThreshold);
+
+    // S / (1 - e^{-S}) and S e^{-S} / (1 - e^{-S})
+    vec e = Exp(-sc);
+    vec den = small ? one : one - e;
+    vec f = sc / den;
+    vec b = f * e;
+
+    // series: 1 +/- S/2 + S^2/12 - S^4/720 + S^6/30240
+    vec s2 = s * s;
+    vec even = one + s2 * (Broadcast(1.0 / 12) +
+                              s2 * (Broadcast(-1.0 / 720) + s2 * Broadcast(1.0 / 30240)));
+    vec odd = Broadcast(0.5) * s;
+    f = small ? even + odd : f;
+    b = small ? even - odd : b;
+
+    forward = (s > max) ? s : ((s < -max) ? zero : f);
+    backward = (s > max) ? zero : ((s < -max) ? -s : b);
+}
+
+KERNEL_TARGET void Compute(int n, const double *deltaS, double *forward, double *backward) {
+    vec s, f, b;
+    int k = 0;
+    for (; k + VECSIZE <= n; k += VECSIZE) {
+        std::memcpy(&s, deltaS + k, sizeof(vec));
+        Fixation(s, f, b);
+        std::memcpy(forward + k, &f, sizeof(vec));
+        std::memcpy(backward + k, &b, sizeof(vec));
+    }
+    if (k < n) {
+        s = Broadcast(0);
+        for (int l = 0; l < n - k; l++) { s[l] = deltaS[k + l]; }
+        Fixation(s, f, b);
+        for (int l = 0; l < n - k; l++) {
+            forward[k + l] = f[l];
+            backward[k + l] = b[l];
+        }
+    }
+}
@@ -31,19 +31,17 @@ class RelRateSuffStat : public SuffStat {
 
     void AddSuffStat(
         const GTRSubMatrix &matrix, const PathSuffStat &pathsuffstat, double rate = 1) {
-        const std::map<int, double> &waitingtime = pathsuffstat.GetWaitingTimeMap();
-        for (std::map<int, double>::const_iterator i = waitingtime.begin(); i != waitingtime.end();
-             i++) {
-            int a = i->first;
+        for (int a = 0; a < pathsuffstat.GetNstate(); a++) {
+            double waitingtime = pathsuffstat.GetWaitingTime(a);
+            if (waitingtime == 0) { continue; }
             for (int b = 0; b < nstate; b++) {
-                if (b != a) { rrbeta[rrindex(a, b)] += matrix.Stationary(b) * i->second * rate; }
+                if (b != a) { rrbeta[rrindex(a, b)] += matrix.Stationary(b) * waitingtime * rate; }
             }
         }
 
-        const std::map<pair<int, int>, int> &paircount = pathsuffstat.GetPairCountMap();
-        for (std::map<pair<int, int>, int>::const_iterator i = paircount.begin();
-             i != paircount.end(); i++) {
-            rrcount[rrindex(i->first.first, i->first.second)] += i->second;
+        for (int k = 0; k < pathsuffstat.GetNpair(); k++) {
+            rrcount[rrindex(pathsuffstat.GetPairFrom(k), pathsuffstat.GetPairTo(k))] +=
+                pathsuffstat.GetPairCountAt(k);
         }
     }
 
@@ -63,22 +61,20 @@ class RelRateSuffStat : public SuffStat {
 
     void AddSuffStat(
         const AASubSelSubMatrix &matrix, const PathSuffStat &pathsuffstat, double rate = 1) {
-        const std::map<int, double> &waitingtime = pathsuffstat.GetWaitingTimeMap();
-        for (std::map<int, double>::const_iterator i = waitingtime.begin(); i != waitingtime.end();
-             i++) {
-            int a = i->first;
+        for (int a = 0; a < pathsuffstat.GetNstate(); a++) {
+            double waitingtime = pathsuffstat.GetWaitingTime(a);
+            if (waitingtime == 0) { continue; }
             for (int b = 0; b < nstate; b++) {
                 if (b != a) {
                     rrbeta[rrindex(a, b)] +=
-                        matrix(a, b) / matrix.RelativeRate(a, b) * i->second * rate;
+                        matrix(a, b) / matrix.RelativeRate(a, b) * waitingtime * rate;
                 }
             }
         }
 
-        const std::map<pair<int, int>, int> &paircount = pathsuffstat.GetPairCountMap();
-        for (std::map<pair<int, int>, int>::const_iterator i = paircount.begin();
-             i != paircount.end(); i++) {
-            rrcount[rrindex(i->first.first, i->first.second)] += i->second;
+        for (int k = 0; k < pathsuffstat.GetNpair(); k++) {
+            rrcount[rrindex(pathsuffstat.GetPairFrom(k), pathsuffstat.GetPairTo(k))] +=
+                pathsuffstat.GetPairCountAt(k);
         }
     }
 
@@ -141,24 +137,20 @@ class ProfileSuffStat : public SuffStat {
 
     void AddSuffStat(
         const GTRSubMatrix &matrix, const PathSuffStat &pathsuffstat, double rate = 1) {
-        const std::map<int, int> &rootcount = pathsuffstat.GetRootCountMap();
-        for (std::map<int, int>::const_iterator i = rootcount.begin(); i != rootcount.end(); i++) {
-            profilecount[i->first] += i->second;
+        for (int a = 0; a < pathsuffstat.GetNstate(); a++) {
+            profilecount[a] += pathsuffstat.GetRootCount(a);
         }
 
-        const std::map<int, double> &waitingtime = pathsuffstat.GetWaitingTimeMap();
-        for (std::map<int, double>::const_iterator i = waitingtime.begin(); i != waitingtime.end();
-             i++) {
-            int a = i->first;
+        for (int a = 0; a < pathsuffstat.GetNstate(); a++) {
+            double waitingtime = pathsuffstat.GetWaitingTime(a);
+            if (waitingtime == 0) { continue; }
             for (int b = 0; b < nstate; b++) {
-                if (b != a) { profilebeta[b] += matrix.RelativeRate(a, b) * i->second * rate; }
+                if (b != a) { profilebeta[b] += matrix.RelativeRate(a, b) * waitingtime * rate; }
             }
         }
 
-        const std::map<pair<int, int>, int> &paircount = pathsuffstat.GetPairCountMap();
-        for (std::map<pair<int, int>, int>::const_iterator i = paircount.begin();
-             i != paircount.end(); i++) {
-            profilecount[i->first.second] += i->second;
+        for (int k = 0; k < pathsuffstat.GetNpair(); k++) {
+            profilecount[pathsuffstat.GetPairTo(k)] += pathsuffstat.GetPairCountAt(k);
         }
     }
 
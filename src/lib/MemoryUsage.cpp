@@ -0,0 +1,14 @@
+#include "MemoryUsage.hpp"
+#include <sys/resource.h>
+
+double MemoryUsage::GetPeakRSS() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#ifdef __APPLE__
+    // in bytes
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    // in kB
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * \brief Memory usage of the program
+ *
+ * Reports the peak resident set size (the maximum amount of physical memory
+ * used so far by the process), e.g. to monitor the memory taken by large
+ * arrays of substitution matrices (see MutSelNeCodonMatrixBidimArray).
+ */
+
+class MemoryUsage {
+  public:
+    //! peak resident set size of the process so far, in MB (0 if not available)
+    static double GetPeakRSS();
+};
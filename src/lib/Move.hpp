@@ -236,4 +236,34 @@ class Move {
         }
         return nacc / ntot;
     }
+
+    //! \brief same as above, except that the state of the model is saved before
+    //! each proposal (by backupf) and, if the proposal is rejected, brought back
+    //! by restoref instead of being recomputed by updatef (see SubMatrix::Backup)
+    template <class C>
+    static double Profile(std::vector<double> &x, double tuning, int n, int nrep,
+        LogProbF<C> logprobf, UpdateF<C> backupf, UpdateF<C> updatef, UpdateF<C> restoref,
+        C *This) {
+        double nacc = 0;
+        double ntot = 0;
+        std::vector<double> bk(x.size(), 0);
+        for (int rep = 0; rep < nrep; rep++) {
+            bk = x;
+            double deltalogprob = -(This->*logprobf)();
+            double loghastings = Random::ProfileProposeMove(x, x.size(), tuning, n);
+            (This->*backupf)();
+            (This->*updatef)();
+            deltalogprob += (This->*logprobf)();
+            deltalogprob += loghastings;
+            int accepted = (log(Random::Uniform()) < deltalogprob);
+            if (accepted) {
+                nacc++;
+            } else {
+                x = bk;
+                (This->*restoref)();
+            }
+            ntot++;
+        }
+        return nacc / ntot;
+    }
 };
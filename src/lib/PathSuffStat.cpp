@@ -0,0 +1,96 @@
+#include "PathSuffStat.hpp"
+#include <cmath>
+
+using namespace std;
+
+void PathSuffStat::Add(const PathSuffStat &from) {
+    int nstate = from.GetNstate();
+    if (GetNstate() < nstate) { Resize(nstate); }
+    int *root = rootcount.data();
+    double *wait = waitingtime.data();
+    const int *fromroot = from.rootcount.data();
+    const double *fromwait = from.waitingtime.data();
+    for (int i = 0; i < nstate; i++) { root[i] += fromroot[i]; }
+    for (int i = 0; i < nstate; i++) { wait[i] += fromwait[i]; }
+
+    // pairs: in the steady state, all pairs of from are generally already
+    // there, and counts can be added in place
+    int npair = GetNpair();
+    int nfrompair = from.GetNpair();
+    bool included = true;
+    int k = 0;
+    for (int l = 0; (l < nfrompair) && included; l++) {
+        k = FindPair(from.pairfrom[l], from.pairto[l]);
+        included = (k < npair) && (pairfrom[k] == from.pairfrom[l]) &&
+                   (pairto[k] == from.pairto[l]);
+    }
+    if (included) {
+        k = 0;
+        for (int l = 0; l < nfrompair; l++) {
+            while ((pairfrom[k] != from.pairfrom[l]) || (pairto[k] != from.pairto[l])) { k++; }
+            paircount[k] += from.paircount[l];
+        }
+        return;
+    }
+
+    if (npair == 0) {
+        pairfrom = from.pairfrom;
+        pairto = from.pairto;
+        paircount = from.paircount;
+        return;
+    }
+
+    // otherwise, merge the two sorted lists
+    thread_local vector<int> mergedfrom, mergedto, mergedcount;
+    mergedfrom.clear();
+    mergedto.clear();
+    mergedcount.clear();
+    auto before = [](int from1, int to1, int from2, int to2) {
+        return (from1 < from2) || ((from1 == from2) && (to1 < to2));
+    };
+    k = 0;
+    int l = 0;
+    while ((k < npair) || (l < nfrompair)) {
+        bool takethis = (l == nfrompair) ||
+                        ((k < npair) &&
+                            !before(from.pairfrom[l], from.pairto[l], pairfrom[k], pairto[k]));
+        bool takefrom = (k == npair) ||
+                        ((l < nfrompair) &&
+                            !before(pairfrom[k], pairto[k], from.pairfrom[l], from.pairto[l]));
+        mergedfrom.push_back(takethis ? pairfrom[k] : from.pairfrom[l]);
+        mergedto.push_back(takethis ? pairto[k] : from.pairto[l]);
+        int count = 0;
+        if (takethis) { count += paircount[k++]; }
+        if (takefrom) { count += from.paircount[l++]; }
+        mergedcount.push_back(count);
+    }
+    pairfrom.swap(mergedfrom);
+    pairto.swap(mergedto);
+    paircount.swap(mergedcount);
+}
+
+double PathSuffStat::GetLogProb(const SubMatrix &mat) const {
+    // only visited states are considered, so that rows of the matrix that are
+    // computed on demand (see SubMatrix::UpdateRow) are not needlessly
+    // computed; logs of rates and of equilibrium frequencies are cached by the
+    // matrix (see SubMatrix::GetLogRow)
+    double total = 0;
+    int nstate = GetNstate();
+    const double *logstat = mat.GetLogStationary();
+    for (int i = 0; i < nstate; i++) {
+        if (rootcount[i]) { total += rootcount[i] * logstat[i]; }
+    }
+    for (int i = 0; i < nstate; i++) {
+        if (waitingtime[i] != 0) { total += waitingtime[i] * mat(i, i); }
+    }
+    int npair = GetNpair();
+    int k = 0;
+    while (k < npair) {
+        int from = pairfrom[k];
+        const double *logrow = mat.GetLogRow(from);
+        for (; (k < npair) && (pairfrom[k] == from); k++) {
+            total += paircount[k] * logrow[pairto[k]];
+        }
+    }
+    return total;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <vector>
 #include "Array.hpp"
 #include "BidimArray.hpp"
 #include "BranchArray.hpp"
@@ -37,101 +38,156 @@
  * omega parameter of the Q matrix, leading to even more compact suff stats (see
  * OmegaPathSuffStat and NucPathSuffStat).
  *
- * In terms of implementation, these suffstats are encoded as sparse data
- * structures (since a very small subset of all possible pairs of codons will
- * typcially be visited by the substitution history of a given site, for
- * instance). This sparse encoding is crucial for efficiency (both in terms of
- * time and in terms of RAM usage).
+ * In terms of implementation, root counts and waiting times are stored as
+ * dense arrays over states (grown on demand up to the largest state seen),
+ * and pair counts as a sparse list of the (a,b) pairs actually visited,
+ * sorted by a and then b: since substitutions only occur between neighbouring
+ * states (e.g. codons differing at one position), only a very small subset of
+ * all possible pairs is typically visited by the substitution histories of a
+ * given site. Merging two suffstats is then a linear pass over the dense
+ * arrays and a merge of the sorted lists, and log p(S | Q) is a linear scan
+ * of the visited states and pairs. All arrays keep their memory when cleared,
+ * so that collecting suffstats at each MCMC cycle does not allocate memory in
+ * the steady state.
  */
 
 class PathSuffStat : public SuffStat {
   public:
     PathSuffStat() {}
+
+    //! constructor preallocating the dense arrays for Nstate states
+    explicit PathSuffStat(int Nstate) : rootcount(Nstate, 0), waitingtime(Nstate, 0) {}
     ~PathSuffStat() {}
 
     //! set suff stats to 0
     void Clear() {
-        rootcount.clear();
+        std::fill(rootcount.begin(), rootcount.end(), 0);
+        std::fill(waitingtime.begin(), waitingtime.end(), 0);
+        pairfrom.clear();
+        pairto.clear();
         paircount.clear();
-        waitingtime.clear();
     }
 
-    void IncrementRootCount(int state) { rootcount[state]++; }
+    //! number of states covered by the dense arrays (at least 1 + the largest
+    //! state seen so far)
+    int GetNstate() const { return rootcount.size(); }
 
-    void IncrementPairCount(int state1, int state2) {
-        paircount[std::pair<int, int>(state1, state2)]++;
+    void IncrementRootCount(int state) {
+        if (state >= GetNstate()) { Resize(state + 1); }
+        rootcount[state]++;
     }
 
-    void AddRootCount(int state, int in) { rootcount[state] += in; }
+    void IncrementPairCount(int state1, int state2) { AddPairCount(state1, state2, 1); }
+
+    void AddRootCount(int state, int in) {
+        if (state >= GetNstate()) { Resize(state + 1); }
+        rootcount[state] += in;
+    }
 
     void AddPairCount(int state1, int state2, int in) {
-        paircount[std::pair<int, int>(state1, state2)] += in;
+        int k = FindPair(state1, state2);
+        if ((k < GetNpair()) && (pairfrom[k] == state1) && (pairto[k] == state2)) {
+            paircount[k] += in;
+        } else {
+            InsertPair(k, state1, state2, in);
+        }
     }
 
-    void AddWaitingTime(int state, double in) { waitingtime[state] += in; }
+    void AddWaitingTime(int state, double in) {
+        if (state >= GetNstate()) { Resize(state + 1); }
+        waitingtime[state] += in;
+    }
 
     //! add path sufficient statistics from PhyloProcess (site-homogeneous case)
     void AddSuffStat(const PhyloProcess &process) { process.AddPathSuffStat(*this); }
 
-    void Add(const PathSuffStat &suffstat) {
-        for (auto const &i : suffstat.GetRootCountMap()) { AddRootCount(i.first, i.second); }
-        for (auto const &i : suffstat.GetPairCountMap()) {
-            AddPairCount(i.first.first, i.first.second, i.second);
-        }
-        for (auto const &i : suffstat.GetWaitingTimeMap()) { AddWaitingTime(i.first, i.second); }
-    }
+    void Add(const PathSuffStat &suffstat);
 
     PathSuffStat &operator+=(const PathSuffStat &from) {
         Add(from);
         return *this;
     }
 
-    int GetRootCount(int state) const {
-        auto i = rootcount.find(state);
-        if (i == rootcount.end()) { return 0; }
-        return i->second;
-    }
+    int GetRootCount(int state) const { return (state < GetNstate()) ? rootcount[state] : 0; }
 
     int GetPairCount(int state1, int state2) const {
-        auto i = paircount.find(std::pair<int, int>(state1, state2));
-        if (i == paircount.end()) { return 0; }
-        return i->second;
+        int k = FindPair(state1, state2);
+        if ((k < GetNpair()) && (pairfrom[k] == state1) && (pairto[k] == state2)) {
+            return paircount[k];
+        }
+        return 0;
     }
 
     double GetWaitingTime(int state) const {
-        auto i = waitingtime.find(state);
-        if (i == waitingtime.end()) { return 0; }
-        return i->second;
+        return (state < GetNstate()) ? waitingtime[state] : 0;
     }
 
+    //! number of distinct pairs of states visited (with a non-zero pair count)
+    int GetNpair() const { return paircount.size(); }
+
+    //! initial state of the k-th visited pair (pairs are sorted by initial and
+    //! then final state)
+    int GetPairFrom(int k) const { return pairfrom[k]; }
+
+    //! final state of the k-th visited pair
+    int GetPairTo(int k) const { return pairto[k]; }
+
+    //! count of the k-th visited pair
+    int GetPairCountAt(int k) const { return paircount[k]; }
+
     //! return log p(S | Q) as a function of the Q matrix given as the argument
-    double GetLogProb(const SubMatrix &mat) const {
-        double total = 0;
-        auto stat = mat.GetStationary();
-        for (auto const &i : rootcount) { total += i.second * log(stat[i.first]); }
-        for (auto const &i : waitingtime) { total += i.second * mat(i.first, i.first); }
-        for (auto const &i : paircount) {
-            total += i.second * log(mat(i.first.first, i.first.second));
+    double GetLogProb(const SubMatrix &mat) const;
+
+    //! \brief MPI serialization (see BufferManager)
+    //!
+    //! The arrays are registered as they are: sender and receiver must have the
+    //! same number of states and the same list of visited pairs (e.g. the
+    //! receiver is a copy of the sender made before the exchange).
+    template <class T>
+    void serialization_interface(T &x) {
+        x.add(rootcount, waitingtime, pairfrom, pairto, paircount);
+    }
+
+  private:
+    void Resize(int Nstate) {
+        rootcount.resize(Nstate, 0);
+        waitingtime.resize(Nstate, 0);
+    }
+
+    //! position of pair (state1,state2) in the sorted list, or of the first
+    //! pair coming after it
+    int FindPair(int state1, int state2) const {
+        int lo = 0;
+        int hi = GetNpair();
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if ((pairfrom[mid] < state1) ||
+                ((pairfrom[mid] == state1) && (pairto[mid] < state2))) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
         }
-        return total;
+        return lo;
     }
 
-    //! const access to the ordered map giving the root count stat (sparse data
-    //! structure)
-    const std::map<int, int> &GetRootCountMap() const { return rootcount; }
-    //! const access to the ordered map giving the pair count stat (sparse data
-    //! structure)
-    const std::map<std::pair<int, int>, int> &GetPairCountMap() const { return paircount; }
-    //! const access to the ordered map giving the waiting time stat (sparse data
-    //! structure)
-    const std::map<int, double> &GetWaitingTimeMap() const { return waitingtime; }
+    void InsertPair(int k, int state1, int state2, int in) {
+        pairfrom.insert(pairfrom.begin() + k, state1);
+        pairto.insert(pairto.begin() + k, state2);
+        paircount.insert(paircount.begin() + k, in);
+    }
 
-  private:
-    std::map<int, int> rootcount;
-    std::map<std::pair<int, int>, int> paircount;
-    std::map<int, double> waitingtime;
+    std::vector<int> rootcount;
+    std::vector<double> waitingtime;
+    // visited pairs, sorted by initial and then final state
+    std::vector<int> pairfrom;
+    std::vector<int> pairto;
+    std::vector<int> paircount;
 };
 
+template <>
+struct has_custom_serialization<PathSuffStat> : std::true_type {};
+
 /**
  * \brief An array of substitution path sufficient statistics
  *
@@ -1,11 +1,17 @@
 #include "PhyloProcess.hpp"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include "PathSuffStat.hpp"
+#include "PoissonSuffStat.hpp"
 #include "PolySuffStat.hpp"
 #include "global/logging.hpp"
 
 using namespace std;
 
+int PhyloProcess::ninstance = 0;
+const double PhyloProcess::LazyScalingThreshold = ldexp(1.0, -256);
+
 PhyloProcess::PhyloProcess(const Tree *intree, const SequenceAlignment *indata,
     const BranchSelector<double> *inbranchlength, const Selector<double> *insiterate,
     PolyProcess *inpolyprocess) : taxon_map(intree, indata->GetTaxonSet()) {
@@ -13,9 +19,29 @@ PhyloProcess::PhyloProcess(const Tree *intree, const SequenceAlignment *indata,
     data = indata;
     Nstate = data->GetNstate();
     maxtrial = DEFAULTMAXTRIAL;
+    adaptivepathsampling = true;
+    blocksize = DEFAULTBLOCKSIZE;
     branchlength = inbranchlength;
     siterate = insiterate;
     polyprocess = inpolyprocess;
+    patterncompression = false;
+    Npattern = 0;
+    nprunedsite = 0;
+    tipstate = nullptr;
+    lazyscaling = true;
+    incremental = false;
+    fullarena = nullptr;
+    updatedfraction = 1.0;
+    usetransmatrix = false;
+    ntransmatrixhit = 0;
+    ntransmatrixmiss = 0;
+    ntransmatrixsite = 0;
+    nbranchsite = 0;
+    instance = ninstance++;
+    iteration = 0;
+    streamkey = 0;
+    pathmap = nullptr;
+    statemap = nullptr;
 }
 
 PhyloProcess::PhyloProcess(const Tree *intree, const SequenceAlignment *indata,
@@ -74,34 +100,140 @@ PhyloProcess::~PhyloProcess() {
     if (allocrootsubmatrixarray) { delete rootsubmatrixarray; }
 }
 
-void PhyloProcess::SetData(const SequenceAlignment *indata) { data = indata; }
+void PhyloProcess::SetData(const SequenceAlignment *indata) {
+    data = indata;
+    if (tipstate != nullptr) {
+        DeleteTipStates();
+        CreateTipStates();
+    }
+}
 
 void PhyloProcess::Unfold() {
     sitearray = new int[GetNsite()];
     sitelnL = new double[GetNsite()];
-    for (int i = 0; i < GetNsite(); i++) { sitearray[i] = 1; }
+    siteorder = new int[GetNsite()];
+    siteposition = new int[GetNsite()];
+    for (int i = 0; i < GetNsite(); i++) {
+        sitearray[i] = 1;
+        siteorder[i] = i;
+        siteposition[i] = i;
+    }
+    nsitegroup = 0;
     statemap = new int *[GetNnode()];
-    uppercondlmap = new double *[GetNnode()];
-    lowercondlmap = new double *[GetNnode()];
-    pathmap = new BranchSitePath **[GetNnode()];
 
     CreateMissingMap();
     FillMissingMap();
+    CreateTipStates();
+    CreatePatterns();
     INFO("Recursive create");
     RecursiveCreate(GetRoot());
+    if (!isStreaming()) { CreatePathMap(); }
     INFO("Create tbl");
-    RecursiveCreateTBL(GetRoot());
+    CreateTBL();
     INFO("Clamp data");
     ClampData();
     INFO("Clamp data ok");
 }
 
 void PhyloProcess::Cleanup() {
+    if (nbranchsite > 0) {
+        INFO("Transition matrix cache: {} hits, {} misses ({:.1f}% hit rate), {:.1f}% of "
+             "branch-site propagations using cached transition matrices",
+            ntransmatrixhit, ntransmatrixmiss, 100 * GetTransitionMatrixHitRate(),
+            100 * GetTransitionMatrixUsage());
+    }
+    UpdatePathSampling();
+    if (totalpathstat.npath > 0) {
+        const PathSamplingStat &stat = totalpathstat;
+        vector<int> trials(pathmaxtrial);
+        sort(trials.begin(), trials.end());
+        INFO("Path sampling ({}): {} paths, {:.1f}% by accept-reject ({:.2f} trials per path, "
+             "{:.1f} ms), {:.1f}% by uniformization ({:.2f} events per path, {:.1f} ms)",
+            adaptivepathsampling ? "adaptive" : "fixed", stat.npath,
+            100.0 * stat.naccept / stat.npath, static_cast<double>(stat.ntrial) / stat.npath,
+            stat.artime, 100.0 * stat.nuni / stat.npath,
+            stat.nuni ? static_cast<double>(stat.nunievent) / stat.nuni : 0.0, stat.unitime);
+        INFO("Path sampling: maximum number of accept-reject trials per branch and kind of end "
+             "states: min {}, median {}, max {} (out of {})",
+            trials.front(), trials[trials.size() / 2], trials.back(), maxtrial);
+    }
     DeleteMissingMap();
-    RecursiveDeleteTBL(GetRoot());
+    DeleteTipStates();
+    DeletePatterns();
+    DeleteTBL();
     RecursiveDelete(GetRoot());
+    DeletePathMap();
     delete[] sitearray;
     delete[] sitelnL;
+    delete[] siteorder;
+    delete[] siteposition;
+}
+
+void PhyloProcess::CreatePatterns() {
+    sitepattern = new int[GetNsite()];
+    prunesite = new int[GetNsite()];
+    prunemask = new int[GetNsite()];
+    if (patterncompression && (polyprocess == nullptr)) {
+        map<vector<int>, int> patternmap;
+        vector<int> column(GetNtaxa());
+        for (int i = 0; i < GetNsite(); i++) {
+            for (int j = 0; j < GetNtaxa(); j++) { column[j] = GetTaxonData(j, i); }
+            auto it = patternmap.find(column);
+            if (it == patternmap.end()) {
+                int index = patternmap.size();
+                patternmap[column] = index;
+                sitepattern[i] = index;
+            } else {
+                sitepattern[i] = it->second;
+            }
+        }
+        Npattern = patternmap.size();
+        INFO("Pattern compression: {} sites, {} distinct patterns", GetNsite(), Npattern);
+    } else {
+        for (int i = 0; i < GetNsite(); i++) { sitepattern[i] = i; }
+        Npattern = GetNsite();
+    }
+    patternsites.assign(Npattern, vector<int>());
+}
+
+void PhyloProcess::DeletePatterns() {
+    delete[] sitepattern;
+    delete[] prunesite;
+    delete[] prunemask;
+}
+
+bool PhyloProcess::SameProcess(int site1, int site2) const {
+    if (GetSiteRate(site1) != GetSiteRate(site2)) { return false; }
+    if (&rootsubmatrixarray->GetVal(site1) != &rootsubmatrixarray->GetVal(site2)) {
+        return false;
+    }
+    for (Tree::NodeIndex node : tree->leaves_root_to_iter()) {
+        if (!tree->is_root(node) && (&GetSubMatrix(node, site1) != &GetSubMatrix(node, site2))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PhyloProcess::SelectPatternSites() const {
+    for (auto &sites : patternsites) { sites.clear(); }
+    nprunedsite = 0;
+    for (int i = 0; i < GetNsite(); i++) {
+        prunesite[i] = i;
+        prunemask[i] = 0;
+        if (sitearray[i] != 0) {
+            auto &sites = patternsites[sitepattern[i]];
+            auto it = sites.begin();
+            while ((it != sites.end()) && !SameProcess(*it, i)) { it++; }
+            if (it == sites.end()) {
+                sites.push_back(i);
+                prunemask[i] = 1;
+                nprunedsite++;
+            } else {
+                prunesite[i] = *it;
+            }
+        }
+    }
 }
 
 void PhyloProcess::CreateMissingMap() {
@@ -117,6 +249,35 @@ void PhyloProcess::DeleteMissingMap() {
     delete[] missingmap;
 }
 
+void PhyloProcess::CreateTipStates() {
+    tipstate = new int[static_cast<size_t>(GetNnode()) * GetNsite()];
+    for (int node = 0; node < GetNnode(); node++) {
+        for (int site = 0; site < GetNsite(); site++) {
+            int &tip = tipstate[static_cast<size_t>(node) * GetNsite() + site];
+            tip = TipDense;
+            if (tree->is_leaf(node) && (polyprocess == nullptr)) {
+                int ncomp = 0;
+                for (int k = 0; k < GetNstate(); k++) {
+                    if (isDataCompatible(node, site, k)) {
+                        ncomp++;
+                        tip = k;
+                    }
+                }
+                if (ncomp == GetNstate()) {
+                    tip = TipMissing;
+                } else if (ncomp != 1) {
+                    tip = TipDense;
+                }
+            }
+        }
+    }
+}
+
+void PhyloProcess::DeleteTipStates() {
+    delete[] tipstate;
+    tipstate = nullptr;
+}
+
 void PhyloProcess::FillMissingMap() {
     /*
         for (size_t j=0; j<GetTree()->nb_nodes(); j++)	{
@@ -181,11 +342,6 @@ void PhyloProcess::ForwardFillMissingMap(Tree::NodeIndex from, Tree::NodeIndex u
 void PhyloProcess::RecursiveCreate(Tree::NodeIndex from) {
     auto state = new int[GetNsite()];
     statemap[from] = state;
-
-    auto array = new BranchSitePath *[GetNsite()];
-    for (int i = 0; i < GetNsite(); i++) { array[i] = 0; }
-    pathmap[from] = array;
-
     for (auto c : tree->children(from)) { RecursiveCreate(c); }
 }
 
@@ -193,42 +349,259 @@ void PhyloProcess::RecursiveDelete(Tree::NodeIndex from) {
     for (auto c : tree->children(from)) { RecursiveDelete(c); }
 
     delete[] statemap[from];
+}
 
-    BranchSitePath **path = pathmap[from];
-    for (int i = 0; i < GetNsite(); i++) { delete path[i]; }
-    delete[] path;
+void PhyloProcess::CreatePathMap() {
+    pathmap = new BranchSitePath *[GetNnode()];
+    for (int node = 0; node < GetNnode(); node++) { pathmap[node] = new BranchSitePath[GetNsite()]; }
 }
 
-void PhyloProcess::RecursiveCreateTBL(Tree::NodeIndex from) {
-    uppercondlmap[from] = new double[GetNstate() + 1];
-    lowercondlmap[from] = new double[GetNstate() + 1];
-    for (auto c : tree->children(from)) { RecursiveCreateTBL(c); }
+void PhyloProcess::DeletePathMap() {
+    if (pathmap) {
+        for (int node = 0; node < GetNnode(); node++) { delete[] pathmap[node]; }
+        delete[] pathmap;
+        pathmap = nullptr;
+    }
 }
 
-void PhyloProcess::RecursiveDeleteTBL(Tree::NodeIndex from) {
-    for (auto c : tree->children(from)) { RecursiveDeleteTBL(c); }
-    delete[] uppercondlmap[from];
-    delete[] lowercondlmap[from];
+void PhyloProcess::CheckPathMap(const char *caller) const {
+    if (!pathmap) {
+        cerr << "error in PhyloProcess::" << caller
+             << ": substitution histories are not stored when streaming sufficient statistics\n";
+        exit(1);
+    }
 }
 
-double PhyloProcess::SiteLogLikelihood(int site) const {
-    Pruning(GetRoot(), site);
-    double ret = 0;
-    double *t = uppercondlmap[GetRoot()];
-    const EVector &stat = GetRootFreq(site);
+void PhyloProcess::SetSuffStatSinks(const SuffStatSinks &insinks) {
+    sinks = insinks;
+    // statemap is allocated at Unfold
+    if (statemap) {
+        if (isStreaming()) {
+            DeletePathMap();
+        } else if (!pathmap) {
+            CreatePathMap();
+        }
+    }
+}
 
-    for (int k = 0; k < GetNstate(); k++) { ret += t[k] * stat[k]; }
-    if (ret == 0) {
-        cerr << "pruning : 0 \n";
-        for (int k = 0; k < GetNstate(); k++) { cerr << t[k] << '\t' << stat[k] << '\n'; }
-        exit(1);
+bool PhyloProcess::isStreaming() const {
+    return sinks.path || sinks.sitepath || sinks.length || sinks.rate || sinks.poly;
+}
+
+void PhyloProcess::CreateTBL() {
+    if (blocksize < 1) { blocksize = 1; }
+    if (blocksize > GetNsite()) { blocksize = GetNsite(); }
+    nthread = ThreadPool::GetNthreads();
+    condlarena = new CondLArena *[nthread];
+    lowercondl = new double *[nthread];
+    lowerblock = new double *[nthread];
+    for (int thread = 0; thread < nthread; thread++) {
+        condlarena[thread] = new CondLArena(GetNnode(), blocksize, GetNstate());
+        lowercondl[thread] = new double[GetNstate() + 1];
+        lowerblock[thread] = new double[GetNstate() * blocksize];
+    }
+    transmatrix = new const double *[static_cast<size_t>(GetNnode()) * GetNsite()];
+    if (incremental && (polyprocess == nullptr)) {
+        size_t n = static_cast<size_t>(GetNnode()) * GetNsite();
+        fullarena = new CondLArena(GetNnode(), GetNsite(), GetNstate());
+        partialvalid = new char[n];
+        partialversion = new uint64_t[n];
+        partiallength = new double[n];
+        updatemask = new int[n];
+        InvalidatePartials();
+    }
+    usetransmatrix = false;
+    mintransmatrixsite = std::max(GetNstate() / 8, 1);
+    threadpathstat.assign(nthread, vector<PathSamplingStat>(2 * GetNnode()));
+    lastpathstat.assign(2 * GetNnode(), PathSamplingStat());
+    pathmaxtrial.assign(2 * GetNnode(), maxtrial);
+}
+
+void PhyloProcess::DeleteTBL() {
+    for (int thread = 0; thread < nthread; thread++) {
+        delete condlarena[thread];
+        delete[] lowercondl[thread];
+        delete[] lowerblock[thread];
+    }
+    delete[] condlarena;
+    delete[] lowercondl;
+    delete[] lowerblock;
+    delete[] transmatrix;
+    if (fullarena != nullptr) {
+        delete fullarena;
+        delete[] partialvalid;
+        delete[] partialversion;
+        delete[] partiallength;
+        delete[] updatemask;
+        fullarena = nullptr;
+    }
+}
+
+void PhyloProcess::InvalidatePartials() {
+    if (fullarena != nullptr) {
+        for (size_t i = 0; i < static_cast<size_t>(GetNnode()) * GetNsite(); i++) {
+            partialvalid[i] = 0;
+            partialversion[i] = 0;
+            partiallength[i] = 0;
+            updatemask[i] = 0;
+        }
+    }
+}
+
+void PhyloProcess::UpdateSubMatrices() const {
+    if (std::min(nthread, ThreadPool::GetNthreads()) == 1) { return; }
+    for (int site = 0; site < GetNsite(); site++) {
+        if (sitearray[site] != 0) {
+            rootsubmatrixarray->GetVal(site).UpdateDiagonalisation();
+        }
+    }
+    for (Tree::NodeIndex node : tree->leaves_root_to_iter()) {
+        if (!tree->is_root(node)) {
+            for (int site = 0; site < GetNsite(); site++) {
+                if (sitearray[site] != 0) { GetSubMatrix(node, site).UpdateDiagonalisation(); }
+            }
+        }
+    }
+}
+
+void PhyloProcess::UpdateTransitionMatrices(const int *mask) const {
+    usetransmatrix = false;
+    TransitionMatrixCache &cache = TransitionMatrixCache::GetGlobalCache();
+    if (cache.GetMaxSize() == 0) { return; }
+    cache.NewPass();
+
+    struct Group {
+        const SubMatrix *matrix;
+        double efflength;
+        int nsite;
+    };
+    vector<Group> groups;
+    map<pair<const SubMatrix *, double>, int> groupmap;
+    vector<int> sitegroup(GetNsite());
+    vector<const double *> groupmatrix;
+    // the new entries of the cache, to be computed
+    struct Fill {
+        const SubMatrix *matrix;
+        double efflength;
+        double *P;
+    };
+    vector<Fill> tofill;
+
+    for (Tree::NodeIndex node : tree->leaves_root_to_iter()) {
+        if (tree->is_root(node)) { continue; }
+        groups.clear();
+        groupmap.clear();
+        double length = GetBranchLength(node);
+        const SubMatrix *prevmatrix = nullptr;
+        double prevlength = -1;
+        int group = -1;
+        for (int site = 0; site < GetNsite(); site++) {
+            if (mask[site] != 0) {
+                const SubMatrix *matrix = &GetSubMatrix(node, site);
+                double efflength = length * GetSiteRate(site);
+                if ((matrix != prevmatrix) || (efflength != prevlength)) {
+                    auto key = make_pair(matrix, efflength);
+                    auto it = groupmap.find(key);
+                    if (it == groupmap.end()) {
+                        group = groups.size();
+                        groupmap[key] = group;
+                        groups.push_back({matrix, efflength, 0});
+                    } else {
+                        group = it->second;
+                    }
+                    prevmatrix = matrix;
+                    prevlength = efflength;
+                }
+                sitegroup[site] = group;
+                groups[group].nsite++;
+            }
+        }
+
+        groupmatrix.assign(groups.size(), nullptr);
+        for (size_t g = 0; g < groups.size(); g++) {
+            nbranchsite += groups[g].nsite;
+            if (groups[g].nsite >= mintransmatrixsite) {
+                bool fill = false;
+                double *P = cache.Find(*groups[g].matrix, groups[g].efflength, fill);
+                if (P != nullptr) {
+                    if (fill) {
+                        // diagonalise serially, the transition matrices being
+                        // computed concurrently below
+                        groups[g].matrix->UpdateDiagonalisation();
+                        tofill.push_back({groups[g].matrix, groups[g].efflength, P});
+                        ntransmatrixmiss++;
+                    } else {
+                        ntransmatrixhit++;
+                    }
+                    ntransmatrixsite += groups[g].nsite;
+                }
+                groupmatrix[g] = P;
+            }
+        }
+
+        const double **nodematrix = transmatrix + static_cast<size_t>(node) * GetNsite();
+        for (int site = 0; site < GetNsite(); site++) {
+            nodematrix[site] = (mask[site] != 0) ? groupmatrix[sitegroup[site]] : nullptr;
+        }
+    }
+
+    ThreadPool::ParallelFor(tofill.size(), nthread, [&tofill](int i, int) {
+        tofill[i].matrix->GetFiniteTimeTransitionMatrix(tofill[i].efflength, tofill[i].P);
+    });
+    usetransmatrix = true;
+}
+
+void PhyloProcess::GroupSites(const int *mask) const {
+    // with incremental pruning, conditional likelihoods are stored by site,
+    // and matrix-matrix products need consecutive sites
+    if (fullarena != nullptr) { return; }
+    // the matrix along a reference branch identifies the component of a site
+    // in mixture models
+    Tree::NodeIndex refnode = GetRoot();
+    for (auto c : tree->children(GetRoot())) {
+        refnode = c;
+        break;
     }
-    return log(ret) + t[GetNstate()];
+    map<pair<const SubMatrix *, double>, int> groupmap;
+    vector<int> sitegroup(GetNsite(), -1);
+    vector<int> groupsize;
+    for (int site = 0; site < GetNsite(); site++) {
+        if (mask[site] != 0) {
+            const SubMatrix *matrix = (refnode == GetRoot()) ? &rootsubmatrixarray->GetVal(site)
+                                                             : &GetSubMatrix(refnode, site);
+            auto key = make_pair(matrix, GetSiteRate(site));
+            auto it = groupmap.find(key);
+            if (it == groupmap.end()) {
+                sitegroup[site] = groupsize.size();
+                groupmap[key] = groupsize.size();
+                groupsize.push_back(1);
+            } else {
+                sitegroup[site] = it->second;
+                groupsize[it->second]++;
+            }
+        }
+    }
+    nsitegroup = groupsize.size();
+
+    // counting sort (non-selected sites last)
+    vector<int> groupbegin(nsitegroup + 1, 0);
+    for (int g = 0; g < nsitegroup; g++) { groupbegin[g + 1] = groupbegin[g] + groupsize[g]; }
+    int unselected = groupbegin[nsitegroup];
+    for (int site = 0; site < GetNsite(); site++) {
+        int pos = (sitegroup[site] == -1) ? unselected++ : groupbegin[sitegroup[site]]++;
+        siteorder[pos] = site;
+        siteposition[site] = pos;
+    }
+}
+
+double PhyloProcess::SiteLogLikelihood(int site) const {
+    SitePruning(site);
+    return FastSiteLogLikelihood(site);
 }
 
 double PhyloProcess::FastSiteLogLikelihood(int site) const {
     double ret = 0;
-    double *t = uppercondlmap[GetRoot()];
+    double *t = GetCondL(GetRoot(), site);
     const EVector &stat = GetRootFreq(site);
     for (int k = 0; k < GetNstate(); k++) { ret += t[k] * stat[k]; }
     if (ret == 0) {
@@ -236,7 +609,7 @@ double PhyloProcess::FastSiteLogLikelihood(int site) const {
         for (int k = 0; k < GetNstate(); k++) { cerr << t[k] << '\t' << stat[k] << '\n'; }
         exit(1);
     }
-    sitelnL[site] = log(ret) + t[GetNstate()];
+    sitelnL[site] = log(ret) + (lazyscaling ? M_LN2 * t[GetNstate()] : t[GetNstate()]);
     return sitelnL[site];
 }
 
@@ -249,51 +622,239 @@ double PhyloProcess::GetFastLogProb() const {
 }
 
 double PhyloProcess::GetLogLikelihood() const {
+    UpdateSubMatrices();
+    if (Npattern < GetNsite()) {
+        SelectPatternSites();
+        GroupSites(prunemask);
+        UpdateTransitionMatrices(prunemask);
+        ThreadPool::ParallelFor(GetNblock(), nthread, [this](int block, int) {
+            Pruning(GetBlockBegin(block), GetBlockEnd(block), prunemask);
+            for (int pos = GetBlockBegin(block); pos < GetBlockEnd(block); pos++) {
+                if (prunemask[siteorder[pos]] != 0) { FastSiteLogLikelihood(siteorder[pos]); }
+            }
+        });
+        for (int i = 0; i < GetNsite(); i++) {
+            if (prunesite[i] != i) { sitelnL[i] = sitelnL[prunesite[i]]; }
+        }
+    } else {
+        nprunedsite = GetNsite();
+        GroupSites(sitearray);
+        UpdateTransitionMatrices(sitearray);
+        ThreadPool::ParallelFor(GetNblock(), nthread, [this](int block, int) {
+            Pruning(GetBlockBegin(block), GetBlockEnd(block));
+            for (int pos = GetBlockBegin(block); pos < GetBlockEnd(block); pos++) {
+                FastSiteLogLikelihood(siteorder[pos]);
+            }
+        });
+    }
+    ReleaseTransitionMatrices();
+    if (fullarena != nullptr) {
+        const int *mask = (Npattern < GetNsite()) ? prunemask : sitearray;
+        long nupdate = 0;
+        long ntot = 0;
+        for (Tree::NodeIndex node : tree->leaves_root_to_iter()) {
+            if (!tree->is_leaf(node)) {
+                for (int i = 0; i < GetNsite(); i++) {
+                    if (mask[i] != 0) {
+                        ntot++;
+                        nupdate += updatemask[static_cast<size_t>(node) * GetNsite() + i];
+                    }
+                }
+            }
+        }
+        updatedfraction = ntot ? static_cast<double>(nupdate) / ntot : 0;
+    }
     double total = 0;
-    for (int i = 0; i < GetNsite(); i++) { total += SiteLogLikelihood(i); }
+    for (int i = 0; i < GetNsite(); i++) { total += sitelnL[i]; }
     return total;
 }
 
-void PhyloProcess::Pruning(Tree::NodeIndex from, int site) const {
-    double *t = uppercondlmap[from];
-    if (tree->is_leaf(from)) {
-        int totcomp = 0;
-        for (int k = 0; k < GetNstate(); k++) {
-            if (polyprocess != nullptr) {
-                double prob = polyprocess->GetProb(taxon_map.NodeToTaxon(from), site, k);
-                if (prob > 0.0) {
-                    totcomp++;
-                    t[k] = prob;
-                } else {
-                    t[k] = 0.0;
+void PhyloProcess::Pruning(int begin, int end, const int *mask) const {
+    if (fullarena != nullptr) {
+        IncrementalPruning(begin, end, mask);
+        return;
+    }
+    for (Tree::NodeIndex from : tree->leaves_root_to_iter()) {
+        if (tree->is_leaf(from)) {
+            for (int pos = begin; pos < end; pos++) {
+                if (mask[siteorder[pos]] != 0) { LeafPruning(from, siteorder[pos]); }
+            }
+        } else {
+            InternalPruning(from, begin, end, mask);
+        }
+    }
+}
+
+void PhyloProcess::IncrementalPruning(int begin, int end, const int *mask) const {
+    for (Tree::NodeIndex from : tree->leaves_root_to_iter()) {
+        size_t offset = static_cast<size_t>(from) * GetNsite();
+        int *nodemask = updatemask + offset;
+        char *valid = partialvalid + offset;
+        if (tree->is_leaf(from)) {
+            // leaf vectors only depend on the data
+            for (int pos = begin; pos < end; pos++) {
+                int site = siteorder[pos];
+                nodemask[site] = (mask[site] != 0) && (valid[site] == 0);
+                if (nodemask[site] != 0) {
+                    LeafPruning(from, site);
+                    valid[site] = 1;
                 }
-            } else {
-                if (isDataCompatible(from, site, k)) {
-                    t[k] = 1.0;
-                    totcomp++;
-                } else {
-                    t[k] = 0.0;
+            }
+        } else {
+            for (int pos = begin; pos < end; pos++) {
+                int site = siteorder[pos];
+                nodemask[site] = 0;
+                if (mask[site] != 0) {
+                    bool dirty = (valid[site] == 0);
+                    for (auto c : tree->children(from)) {
+                        size_t i = static_cast<size_t>(c) * GetNsite() + site;
+                        dirty |= (updatemask[i] != 0) ||
+                                 (partialversion[i] != GetSubMatrix(c, site).GetVersion()) ||
+                                 (partiallength[i] != GetBranchLength(c) * GetSiteRate(site));
+                    }
+                    nodemask[site] = dirty;
+                }
+            }
+            InternalPruning(from, begin, end, nodemask);
+            for (int pos = begin; pos < end; pos++) {
+                int site = siteorder[pos];
+                if (nodemask[site] != 0) {
+                    valid[site] = 1;
+                    for (auto c : tree->children(from)) {
+                        size_t i = static_cast<size_t>(c) * GetNsite() + site;
+                        partialversion[i] = GetSubMatrix(c, site).GetVersion();
+                        partiallength[i] = GetBranchLength(c) * GetSiteRate(site);
+                    }
                 }
             }
         }
-        if (totcomp == 0) {
-            cerr << "error : no compatibility\n";
-            cerr << GetNodeData(from, site) << '\n';
-            exit(1);
-        }
+    }
+}
 
+void PhyloProcess::LeafPruning(Tree::NodeIndex from, int site) const {
+    double *t = GetCondL(from, site);
+    int tip = GetTipState(from, site);
+    if (tip != TipDense) {
+        for (int k = 0; k < GetNstate(); k++) { t[k] = ((tip == TipMissing) || (tip == k)); }
         t[GetNstate()] = 0;
-    } else {
-        for (int k = 0; k < GetNstate(); k++) { t[k] = 1.0; }
-        t[GetNstate()] = 0;
-        for (auto c : tree->children(from)) {
-            Pruning(c, site);
-            GetSubMatrix(c, site).BackwardPropagate(
-                uppercondlmap[c], lowercondlmap[c], GetBranchLength(c) * GetSiteRate(site));
-            double *tbl = lowercondlmap[c];
-            for (int k = 0; k < GetNstate(); k++) { t[k] *= tbl[k]; }
-            t[GetNstate()] += tbl[GetNstate()];
+        return;
+    }
+    int totcomp = 0;
+    for (int k = 0; k < GetNstate(); k++) {
+        if (polyprocess != nullptr) {
+            std::lock_guard<std::mutex> lock(polymutex);
+            double prob = polyprocess->GetProb(taxon_map.NodeToTaxon(from), site, k);
+            if (prob > 0.0) {
+                totcomp++;
+                t[k] = prob;
+            } else {
+                t[k] = 0.0;
+            }
+        } else {
+            if (isDataCompatible(from, site, k)) {
+                t[k] = 1.0;
+                totcomp++;
+            } else {
+                t[k] = 0.0;
+            }
+        }
+    }
+    if (totcomp == 0) {
+        cerr << "error : no compatibility\n";
+        cerr << GetNodeData(from, site) << '\n';
+        exit(1);
+    }
+
+    t[GetNstate()] = 0;
+}
+
+void PhyloProcess::InternalPruning(
+    Tree::NodeIndex from, int begin, int end, const int *mask) const {
+    for (int pos = begin; pos < end; pos++) {
+        if (mask[siteorder[pos]] != 0) {
+            double *t = GetCondL(from, siteorder[pos]);
+            for (int k = 0; k < GetNstate(); k++) { t[k] = 1.0; }
+            t[GetNstate()] = 0;
+        }
+    }
+    int thread = ThreadPool::GetThreadIndex();
+    double *tbl = lowercondl[thread];
+    int stride = (fullarena != nullptr) ? fullarena->GetStride() : condlarena[thread]->GetStride();
+    for (auto c : tree->children(from)) {
+        bool leaf = tree->is_leaf(c);
+        int pos = begin;
+        while (pos < end) {
+            int site = siteorder[pos];
+            if (mask[site] == 0) {
+                pos++;
+                continue;
+            }
+            const double *P = GetTransitionMatrix(c, site);
+            int tip = leaf ? GetTipState(c, site) : TipDense;
+            if (tip == TipMissing) {
+                // rows of transition matrices sum to 1: nothing to multiply
+                pos++;
+            } else if ((tip != TipDense) && (P != nullptr)) {
+                // single observed state: column of the transition matrix
+                double *t = GetCondL(from, site);
+                for (int k = 0; k < GetNstate(); k++) {
+                    double p = P[k * GetNstate() + tip];
+                    t[k] *= (p < 0) ? 0 : p;
+                }
+                pos++;
+            } else if (P == nullptr) {
+                double *t = GetCondL(from, site);
+                GetSubMatrix(c, site).BackwardPropagate(
+                    GetCondL(c, site), tbl, GetBranchLength(c) * GetSiteRate(site));
+                for (int k = 0; k < GetNstate(); k++) { t[k] *= tbl[k]; }
+                t[GetNstate()] += tbl[GetNstate()];
+                pos++;
+            } else {
+                // all sites at consecutive positions sharing this transition
+                // matrix: one matrix-matrix product (the conditional likelihoods
+                // of consecutive positions of a block being contiguous in the
+                // arena)
+                int last = pos + 1;
+                while ((last < end) && (mask[siteorder[last]] != 0) &&
+                       (GetTransitionMatrix(c, siteorder[last]) == P) &&
+                       (!leaf || (GetTipState(c, siteorder[last]) == TipDense))) {
+                    last++;
+                }
+                int n = last - pos;
+                Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+                    Eigen::RowMajor>>
+                    p(P, GetNstate(), GetNstate());
+                Eigen::Map<const EMatrix, 0, Eigen::OuterStride<>> up(
+                    GetCondL(c, site), GetNstate(), n, Eigen::OuterStride<>(stride));
+                Eigen::Map<EMatrix> down(lowerblock[thread], GetNstate(), n);
+                down.noalias() = p * up;
+                for (int j = 0; j < n; j++) {
+                    double *t = GetCondL(from, siteorder[pos + j]);
+                    const double *d = lowerblock[thread] + j * GetNstate();
+                    double max = 0;
+                    for (int k = 0; k < GetNstate(); k++) {
+                        if (std::isnan(d[k])) {
+                            cerr << "error in pruning: nan in transition matrix product\n";
+                            exit(1);
+                        }
+                        double dk = (d[k] < 0) ? 0 : d[k];
+                        if (max < dk) { max = dk; }
+                        t[k] *= dk;
+                    }
+                    if (max == 0) {
+                        cerr << "error in pruning: null array\n";
+                        exit(1);
+                    }
+                    t[GetNstate()] += GetCondL(c, siteorder[pos + j])[GetNstate()];
+                }
+                pos = last;
+            }
         }
+    }
+    for (int pos = begin; pos < end; pos++) {
+        int site = siteorder[pos];
+        if (mask[site] == 0) { continue; }
+        double *t = GetCondL(from, site);
         double max = 0;
         for (int k = 0; k < GetNstate(); k++) {
             if (t[k] < 0) {
@@ -313,8 +874,17 @@ void PhyloProcess::Pruning(Tree::NodeIndex from, int site) const {
             exit(1);
             max = 1e-20;
         }
-        for (int k = 0; k < GetNstate(); k++) { t[k] /= max; }
-        t[GetNstate()] += log(max);
+        if (!lazyscaling) {
+            for (int k = 0; k < GetNstate(); k++) { t[k] /= max; }
+            t[GetNstate()] += log(max);
+        } else if (max < LazyScalingThreshold) {
+            // max = m * 2^e, with 0.5 <= m < 1: multiplying by 2^-e is exact
+            int e = 0;
+            frexp(max, &e);
+            double factor = ldexp(1.0, -e);
+            for (int k = 0; k < GetNstate(); k++) { t[k] *= factor; }
+            t[GetNstate()] += e;
+        }
     }
 }
 
@@ -323,7 +893,7 @@ void PhyloProcess::PruningAncestral(Tree::NodeIndex from, int site) {
         double aux[GetNstate()];
         double cumulaux[GetNstate()];
         try {
-            double *tbl = uppercondlmap[from];
+            double *tbl = GetCondL(from, site);
             const EVector &stat = GetRootFreq(site);
             double tot = 0;
             for (int k = 0; k < GetNstate(); k++) {
@@ -347,13 +917,24 @@ void PhyloProcess::PruningAncestral(Tree::NodeIndex from, int site) {
         }
     }
     for (auto c : tree->children(from)) {
+        if (tree->is_leaf(c) && (GetTipState(c, site) >= 0)) {
+            // observed state
+            statemap[c][site] = GetTipState(c, site);
+            continue;
+        }
         double aux[GetNstate()];
         double cumulaux[GetNstate()];
         try {
-            for (int k = 0; k < GetNstate(); k++) { aux[k] = 1; }
-            GetSubMatrix(c, site).GetFiniteTimeTransitionProb(
-                statemap[from][site], aux, GetBranchLength(c) * GetSiteRate(site));
-            double *tbl = uppercondlmap[c];
+            const double *P = GetTransitionMatrix(c, site);
+            if (P != nullptr) {
+                const double *row = P + statemap[from][site] * GetNstate();
+                for (int k = 0; k < GetNstate(); k++) { aux[k] = row[k]; }
+            } else {
+                for (int k = 0; k < GetNstate(); k++) { aux[k] = 1; }
+                GetSubMatrix(c, site).GetFiniteTimeTransitionProb(
+                    statemap[from][site], aux, GetBranchLength(c) * GetSiteRate(site));
+            }
+            double *tbl = GetCondL(c, site);
             for (int k = 0; k < GetNstate(); k++) { aux[k] *= tbl[k]; }
 
             // dealing with numerical problems:
@@ -393,7 +974,7 @@ void PhyloProcess::PruningAncestral(Tree::NodeIndex from, int site) {
 
 void PhyloProcess::RootPosteriorDraw(int site) {
     double aux[GetNstate()];
-    double *tbl = uppercondlmap[GetRoot()];
+    double *tbl = GetCondL(GetRoot(), site);
     const EVector &stat = GetRootFreq(site);
     for (int k = 0; k < GetNstate(); k++) { aux[k] = stat[k] * tbl[k]; }
     statemap[GetRoot()][site] = Random::DrawFromDiscreteDistribution(aux, GetNstate());
@@ -416,16 +997,31 @@ void PhyloProcess::PriorSample(Tree::NodeIndex from, int site, bool rootprior) {
 }
 
 void PhyloProcess::ResampleState() {
-    for (int i = 0; i < GetNsite(); i++) { ResampleState(i); }
+    ThreadPool::ParallelFor(GetNblock(), nthread, [this](int block, int) {
+        Pruning(GetBlockBegin(block), GetBlockEnd(block));
+        for (int pos = GetBlockBegin(block); pos < GetBlockEnd(block); pos++) {
+            int i = siteorder[pos];
+            if (sitearray[i] != 0) {
+                RandomStream stream(streamkey, GetSiteStream(i, 0), iteration);
+                RandomStreamScope scope(stream);
+                PruningAncestral(GetRoot(), i);
+            }
+        }
+    });
 }
 
 void PhyloProcess::ResampleState(int site) {
-    Pruning(GetRoot(), site);
+    SitePruning(site);
     PruningAncestral(GetRoot(), site);
     // give information about fixed states at the tips to polyprocess
 }
 
 double PhyloProcess::Move(double fraction) {
+    if (isStreaming() && (fraction < 1.0)) {
+        cerr << "error in PhyloProcess::Move: partial resampling of substitution histories is "
+                "not possible when streaming sufficient statistics\n";
+        exit(1);
+    }
     DrawSites(fraction);
     ResampleSub();
     // restoring full resampling mode
@@ -438,34 +1034,124 @@ void PhyloProcess::DrawSites(double fraction) {
 }
 
 void PhyloProcess::ResampleSub() {
-    pruningchrono.Start();
+    UpdatePathSampling();
+    UpdateSubMatrices();
+    GroupSites(sitearray);
+    UpdateTransitionMatrices(sitearray);
+    iteration++;
+    streamkey = Random::GetStreamKey();
 
-    for (int i = 0; i < GetNsite(); i++) {
-        if (sitearray[i] != 0) { ResampleState(i); }
-    }
+    pruningchrono.Start();
+    ResampleState();
     pruningchrono.Stop();
+    ReleaseTransitionMatrices();
 
     resamplechrono.Start();
-    for (int i = 0; i < GetNsite(); i++) {
-        if (sitearray[i] != 0) { ResampleSub(GetRoot(), i); }
+    if (isStreaming()) {
+        ClearSuffStatSinks();
+        ThreadPool::ParallelFor(
+            GetNblock(), nthread, [this](int block, int) { StreamSuffStat(block); });
+    } else {
+        ThreadPool::ParallelFor(GetNblock(), nthread, [this](int block, int) {
+            for (int pos = GetBlockBegin(block); pos < GetBlockEnd(block); pos++) {
+                int i = siteorder[pos];
+                if (sitearray[i] != 0) {
+                    RandomStream stream(streamkey, GetSiteStream(i, 1), iteration);
+                    RandomStreamScope scope(stream);
+                    ResampleSub(GetRoot(), i);
+                }
+            }
+        });
     }
     resamplechrono.Stop();
 }
 
+void PhyloProcess::ClearSuffStatSinks() {
+    if (sinks.path) { sinks.path->Clear(); }
+    if (sinks.sitepath) {
+        for (int i = 0; i < sinks.sitepath->GetSize(); i++) { (*sinks.sitepath)[i].Clear(); }
+    }
+    if (sinks.length) {
+        for (int j = 0; j < sinks.length->GetNbranch(); j++) { (*sinks.length)[j].Clear(); }
+    }
+    if (sinks.rate) {
+        for (int i = 0; i < sinks.rate->GetSize(); i++) { (*sinks.rate)[i].Clear(); }
+    }
+    if (sinks.poly) { sinks.poly->Clear(); }
+}
+
+void PhyloProcess::StreamSuffStat(int block) {
+    // statistics shared by all sites are first accumulated locally, and merged
+    // into the sinks at the end of the block; site-specific statistics can be
+    // added directly, since each site belongs to only one block
+    thread_local BranchSitePath path;
+    PathSuffStat pathsuffstat;
+    vector<PoissonSuffStat> lengthsuffstat(sinks.length ? tree->nb_branches() : 0);
+
+    for (int pos = GetBlockBegin(block); pos < GetBlockEnd(block); pos++) {
+        int i = siteorder[pos];
+        RandomStream stream(streamkey, GetSiteStream(i, 1), iteration);
+        RandomStreamScope scope(stream);
+        StreamSuffStat(GetRoot(), i, path, pathsuffstat, lengthsuffstat);
+    }
+
+    // polyprocess is not thread-safe, and the same mutex protects the sinks
+    std::lock_guard<std::mutex> lock(polymutex);
+    if (sinks.path) { sinks.path->Add(pathsuffstat); }
+    for (size_t j = 0; j < lengthsuffstat.size(); j++) { (*sinks.length)[j].Add(lengthsuffstat[j]); }
+    if (sinks.poly) {
+        assert(polyprocess != nullptr);
+        for (int pos = GetBlockBegin(block); pos < GetBlockEnd(block); pos++) {
+            int site = siteorder[pos];
+            for (int taxon = 0; taxon < GetNtaxa(); taxon++) {
+                sinks.poly->IncrementPolyCount(
+                    polyprocess->GetDerivedTuple(taxon, site, GetPathState(taxon, site)));
+            }
+        }
+    }
+}
+
+void PhyloProcess::StreamSuffStat(Tree::NodeIndex from, int site, BranchSitePath &path,
+    PathSuffStat &pathsuffstat, vector<PoissonSuffStat> &lengthsuffstat) {
+    if (missingmap[from][site] == 2) {
+        if (sinks.path) { pathsuffstat.IncrementRootCount(statemap[from][site]); }
+        if (sinks.sitepath) { (*sinks.sitepath)[site].IncrementRootCount(statemap[from][site]); }
+    }
+    for (auto c : tree->children(from)) {
+        const SubMatrix &matrix = GetSubMatrix(c, site);
+        // paths are sampled even along branches with missing data, so as to
+        // draw exactly the same random numbers as ResampleSub
+        SamplePath(path, c, statemap[from][site], statemap[c][site], GetBranchLength(c),
+            GetSiteRate(site), matrix);
+        if (missingmap[c][site] == 1) {
+            double efflength = GetBranchLength(c) * GetSiteRate(site);
+            if (sinks.path) { path.AddPathSuffStat(pathsuffstat, efflength); }
+            if (sinks.sitepath) { path.AddPathSuffStat((*sinks.sitepath)[site], efflength); }
+            if (sinks.length) {
+                path.AddLengthSuffStat(
+                    lengthsuffstat[tree->branch_index(c)], GetSiteRate(site), matrix);
+            }
+            if (sinks.rate) {
+                path.AddLengthSuffStat((*sinks.rate)[site], GetBranchLength(c), matrix);
+            }
+        }
+        StreamSuffStat(c, site, path, pathsuffstat, lengthsuffstat);
+    }
+}
+
 void PhyloProcess::ResampleSub(int site) {
+    CheckPathMap("ResampleSub");
     ResampleState(site);
     ResampleSub(GetRoot(), site);
 }
 
 void PhyloProcess::ResampleSub(Tree::NodeIndex from, int site) {
     if (tree->is_root(from)) {
-        delete pathmap[from][site];
-        pathmap[from][site] = SampleRootPath(statemap[from][site]);
+        SampleRootPath(pathmap[from][site], statemap[from][site]);
     }
     for (auto c : tree->children(from)) {
-        delete pathmap[c][site];
-        pathmap[c][site] = SamplePath(statemap[from][site], statemap[c][site], GetBranchLength(c),
-            GetSiteRate(site), GetSubMatrix(c, site));
+        SamplePath(pathmap[c][site], c, statemap[from][site], statemap[c][site],
+            GetBranchLength(c), GetSiteRate(site), GetSubMatrix(c, site));
         ResampleSub(c, site);
     }
 }
@@ -480,7 +1166,7 @@ void PhyloProcess::PostPredSample(string name, bool rootprior) {
 }
 
 void PhyloProcess::PostPredSample(int site, bool rootprior) {
-    if (!rootprior) { Pruning(GetRoot(), site); }
+    if (!rootprior) { SitePruning(site); }
     PriorSample(GetRoot(), site, rootprior);
 }
 
@@ -499,22 +1185,85 @@ void PhyloProcess::GetLeafData(SequenceAlignment *data_ali) {
     }
 }
 
-BranchSitePath *PhyloProcess::SampleRootPath(int rootstate) {
-    BranchSitePath *path = new BranchSitePath(rootstate);
-    return path;
+void PhyloProcess::SampleRootPath(BranchSitePath &path, int rootstate) { path.Reset(rootstate); }
+
+void PhyloProcess::PathSamplingStat::Add(const PathSamplingStat &from) {
+    npath += from.npath;
+    naccept += from.naccept;
+    ntrial += from.ntrial;
+    njump += from.njump;
+    nuni += from.nuni;
+    nunievent += from.nunievent;
+    artime += from.artime;
+    unitime += from.unitime;
+}
+
+void PhyloProcess::SetAdaptivePathSampling(bool in) {
+    adaptivepathsampling = in;
+    for (auto &k : pathmaxtrial) { k = maxtrial; }
+}
+
+void PhyloProcess::SetMaxTrial(int i) {
+    maxtrial = i;
+    for (auto &k : pathmaxtrial) { k = maxtrial; }
+}
+
+PhyloProcess::PathSamplingStat PhyloProcess::GetPathSamplingStat() const {
+    PathSamplingStat ret = totalpathstat;
+    for (const auto &threadstat : threadpathstat) {
+        for (const auto &stat : threadstat) { ret.Add(stat); }
+    }
+    return ret;
+}
+
+void PhyloProcess::UpdatePathSampling() {
+    for (size_t k = 0; k < lastpathstat.size(); k++) {
+        PathSamplingStat &stat = lastpathstat[k];
+        stat = PathSamplingStat();
+        for (auto &threadstat : threadpathstat) {
+            stat.Add(threadstat[k]);
+            threadstat[k] = PathSamplingStat();
+        }
+        totalpathstat.Add(stat);
+
+        // classes with too few trials keep their current maximum
+        if (adaptivepathsampling && (stat.ntrial >= MinAdaptiveTrials)) {
+            double meanjump = static_cast<double>(stat.njump) / stat.ntrial;
+            double trialcost = AcceptRejectStepCost * (1 + meanjump);
+            // without uniformized paths, the number of events is approximated by
+            // the number of substitutions per trial
+            double meanevent =
+                stat.nuni ? static_cast<double>(stat.nunievent) / stat.nuni : meanjump;
+            double unicost = UniformizedPathCost + UniformizedEventCost * meanevent;
+            int trials = static_cast<int>(ceil(unicost / trialcost));
+            pathmaxtrial[k] = std::max(1, std::min(maxtrial, trials));
+        }
+    }
 }
 
-BranchSitePath *PhyloProcess::SamplePath(
-    int stateup, int statedown, double time, double rate, const SubMatrix &matrix) {
-    BranchSitePath *path = ResampleAcceptReject(1000, stateup, statedown, rate, time, matrix);
-    if (!path) { path = ResampleUniformized(stateup, statedown, rate, time, matrix); }
-    return path;
+void PhyloProcess::SamplePath(BranchSitePath &path, Tree::NodeIndex node, int stateup,
+    int statedown, double time, double rate, const SubMatrix &matrix) {
+    int k = 2 * node + (stateup != statedown);
+    PathSamplingStat &stat = threadpathstat[ThreadPool::GetThreadIndex()][k];
+    stat.npath++;
+    auto start = chrono::steady_clock::now();
+    bool accepted = ResampleAcceptReject(path, pathmaxtrial[k], stateup, statedown, rate, time,
+        matrix, stat.ntrial, stat.njump);
+    auto stop = chrono::steady_clock::now();
+    stat.artime += chrono::duration<double, milli>(stop - start).count();
+    if (accepted) {
+        stat.naccept++;
+    } else {
+        stat.nuni++;
+        stat.nunievent += ResampleUniformized(path, stateup, statedown, rate, time, matrix);
+        stat.unitime += chrono::duration<double, milli>(chrono::steady_clock::now() - stop).count();
+    }
 }
 
-BranchSitePath *PhyloProcess::ResampleAcceptReject(int maxtrial, int stateup, int statedown,
-    double rate, double totaltime, const SubMatrix &matrix) {
+bool PhyloProcess::ResampleAcceptReject(BranchSitePath &path, int maxtrial, int stateup,
+    int statedown, double rate, double totaltime, const SubMatrix &matrix, long &trialcount,
+    long &jumpcount) {
     int ntrial = 0;
-    BranchSitePath *path = 0;
 
     if (rate * totaltime < 1e-10) {
         // if (rate * totaltime == 0)	{
@@ -523,16 +1272,12 @@ BranchSitePath *PhyloProcess::ResampleAcceptReject(int maxtrial, int stateup, in
                     "stateup != statedown, efflength == 0\n";
             exit(1);
         }
-        delete path;
-        path = new BranchSitePath();
         ntrial++;
-        path->Reset(stateup);
+        path.Reset(stateup);
     } else {
         do {
-            delete path;
-            path = new BranchSitePath();
             ntrial++;
-            path->Reset(stateup);
+            path.Reset(stateup);
             double t = 0;
             int state = stateup;
 
@@ -543,8 +1288,9 @@ BranchSitePath *PhyloProcess::ResampleAcceptReject(int maxtrial, int stateup, in
 
                 t += u;
                 int newstate = matrix.DrawOneStep(state);
-                path->Append(newstate, u / totaltime);
+                path.Append(newstate, u / totaltime);
                 state = newstate;
+                jumpcount++;
             }
             while (t < totaltime) {
                 // draw waiting time
@@ -569,17 +1315,19 @@ BranchSitePath *PhyloProcess::ResampleAcceptReject(int maxtrial, int stateup, in
                 t += u;
                 if (t < totaltime) {
                     int newstate = matrix.DrawOneStep(state);
-                    path->Append(newstate, u / totaltime);
+                    path.Append(newstate, u / totaltime);
                     state = newstate;
+                    jumpcount++;
                 } else {
                     t -= u;
                     u = totaltime - t;
-                    path->Last()->SetRelativeTime(u / totaltime);
+                    path.SetLastRelativeTime(u / totaltime);
                     t = totaltime;
                 }
             }
-        } while ((ntrial < maxtrial) && (path->Last()->GetState() != statedown));
+        } while ((ntrial < maxtrial) && (path.GetFinalState() != statedown));
     }
+    trialcount += ntrial;
 
     // if endstate does not match state at the corresponding end of the branch
     // just force it to match
@@ -587,18 +1335,10 @@ BranchSitePath *PhyloProcess::ResampleAcceptReject(int maxtrial, int stateup, in
     // normally, in that case, one should give up with accept-reject
     // and use a uniformized method instead (but not yet adapted to the present
     // code, see below)
-    if (path->Last()->GetState() != statedown) {
-        // fossil
-        // path->Last()->SetState(statedown);
-        delete path;
-        path = 0;
-    }
-
-    return path;
+    return path.GetFinalState() == statedown;
 }
 
-BranchSitePath *PhyloProcess::ResampleUniformized(
-    int stateup, int statedown, double rate, double totaltime, const SubMatrix &matrix) {
+int PhyloProcess::ResampleUniformized(BranchSitePath &path, int stateup, int statedown, double rate, double totaltime, const SubMatrix &matrix) {
     double length = rate * totaltime;
     int m = matrix.DrawUniformizedSubstitutionNumber(stateup, statedown, length);
 
@@ -609,22 +1349,21 @@ BranchSitePath *PhyloProcess::ResampleUniformized(
 
     int state = stateup;
 
-    BranchSitePath *path = new BranchSitePath();
-    path->Reset(stateup);
+    path.Reset(stateup);
 
     double t = y[0];
     for (int r = 0; r < m; r++) {
         int k = (r == m - 1) ? statedown
                              : matrix.DrawUniformizedTransition(state, statedown, m - r - 1);
         if (k != state) {
-            path->Append(k, t);
+            path.Append(k, t);
             t = 0;
         }
         state = k;
         t += y[r + 1] - y[r];
     }
-    path->Last()->SetRelativeTime(t);
-    return path;
+    path.SetLastRelativeTime(t);
+    return m;
 }
 
 void PhyloProcess::AddPolySuffStat(PolySuffStat &polysuffstat) const {
@@ -656,6 +1395,7 @@ void PhyloProcess::AddPolySuffStat(BidimArray<PolySuffStat> &suffstatbidimarray)
 }
 
 void PhyloProcess::AddPathSuffStat(PathSuffStat &suffstat) const {
+    CheckPathMap("AddPathSuffStat");
     RecursiveAddPathSuffStat(GetRoot(), suffstat);
 }
 
@@ -673,13 +1413,14 @@ void PhyloProcess::LocalAddPathSuffStat(Tree::NodeIndex from, PathSuffStat &suff
                 cerr << "error in missing map\n";
                 exit(1);
             }
-            pathmap[from][i]->AddPathSuffStat(suffstat, GetBranchLength(from) * GetSiteRate(i));
+            pathmap[from][i].AddPathSuffStat(suffstat, GetBranchLength(from) * GetSiteRate(i));
         }
     }
 }
 
 void PhyloProcess::AddPathSuffStat(
     BidimArray<PathSuffStat> &suffstatbidimarray, const BranchSelector<int> &branchalloc) const {
+    CheckPathMap("AddPathSuffStat");
     RecursiveAddPathSuffStat(GetRoot(), suffstatbidimarray, branchalloc);
 }
 
@@ -694,6 +1435,7 @@ void PhyloProcess::RecursiveAddPathSuffStat(Tree::NodeIndex from,
 }
 
 void PhyloProcess::AddPathSuffStat(BidimArray<PathSuffStat> &suffstatbidimarray, Array<PathSuffStat> &rootsuffstatarray) const {
+    CheckPathMap("AddPathSuffStat");
     RecursiveAddPathSuffStat(GetRoot(), suffstatbidimarray, rootsuffstatarray);
 }
 
@@ -718,13 +1460,14 @@ void PhyloProcess::LocalAddPathSuffStat(
                 cerr << "error in missing map\n";
                 exit(1);
             }
-            pathmap[from][i]->AddPathSuffStat(
+            pathmap[from][i].AddPathSuffStat(
                 suffstatbidimarray(row, i), GetBranchLength(from) * GetSiteRate(i));
         }
     }
 }
 
 void PhyloProcess::AddPathSuffStat(Array<PathSuffStat> &suffstatarray) const {
+    CheckPathMap("AddPathSuffStat");
     RecursiveAddPathSuffStat(GetRoot(), suffstatarray);
 }
 
@@ -744,13 +1487,14 @@ void PhyloProcess::LocalAddPathSuffStat(
                 cerr << "error in missing map\n";
                 exit(1);
             }
-            pathmap[from][i]->AddPathSuffStat(
+            pathmap[from][i].AddPathSuffStat(
                 suffstatarray[i], GetBranchLength(from) * GetSiteRate(i));
         }
     }
 }
 
 void PhyloProcess::AddPathSuffStat(NodeArray<PathSuffStat> &suffstatarray) const {
+    CheckPathMap("AddPathSuffStat");
     RecursiveAddPathSuffStat(GetRoot(), suffstatarray);
 }
 
@@ -762,6 +1506,7 @@ void PhyloProcess::RecursiveAddPathSuffStat(
 
 void PhyloProcess::AddLengthSuffStat(
     BranchArray<PoissonSuffStat> &branchlengthpathsuffstatarray) const {
+    CheckPathMap("AddLengthSuffStat");
     RecursiveAddLengthSuffStat(GetRoot(), branchlengthpathsuffstatarray);
 }
 
@@ -778,12 +1523,13 @@ void PhyloProcess::RecursiveAddLengthSuffStat(
 void PhyloProcess::LocalAddLengthSuffStat(Tree::NodeIndex from, PoissonSuffStat &suffstat) const {
     for (int i = 0; i < GetNsite(); i++) {
         if (missingmap[from][i] == 1) {
-            pathmap[from][i]->AddLengthSuffStat(suffstat, GetSiteRate(i), GetSubMatrix(from, i));
+            pathmap[from][i].AddLengthSuffStat(suffstat, GetSiteRate(i), GetSubMatrix(from, i));
         }
     }
 }
 
 void PhyloProcess::AddRateSuffStat(Array<PoissonSuffStat> &siteratepathsuffstatarray) const {
+    CheckPathMap("AddRateSuffStat");
     RecursiveAddRateSuffStat(GetRoot(), siteratepathsuffstatarray);
 }
 
@@ -798,7 +1544,7 @@ void PhyloProcess::LocalAddRateSuffStat(
     double length = GetBranchLength(from);
     for (int i = 0; i < GetNsite(); i++) {
         if (missingmap[from][i] == 1) {
-            pathmap[from][i]->AddLengthSuffStat(
+            pathmap[from][i].AddLengthSuffStat(
                 siteratepathsuffstatarray[i], length, GetSubMatrix(from, i));
         }
     }
@@ -1,16 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <fstream>
 #include <map>
+#include <mutex>
+#include <vector>
 #include "BidimArray.hpp"
 #include "BranchSitePath.hpp"
 #include "BranchSiteSelector.hpp"
 #include "Chrono.hpp"
+#include "CondLArena.hpp"
 #include "NodeArray.hpp"
 #include "PolyProcess.hpp"
 #include "SequenceAlignment.hpp"
 #include "SubMatrix.hpp"
 #include "TaxonMapping.hpp"
+#include "ThreadPool.hpp"
+#include "TransitionMatrixCache.hpp"
 #include "tree/implem.hpp"
 
 // PhyloProcess is a dispatcher:
@@ -28,6 +34,25 @@
  * histories. If polymorphism data is available (polyprocess is not a null pointer),
  * the likelihood of the data (number of occurrences in the population of the reference
  * and derived alleles at each site) is calculated using diffusion equations.
+ *
+ * Sites are processed by blocks (see SetBlockSize), and blocks are distributed
+ * over the threads of the ThreadPool, each thread having its own conditional
+ * likelihood arena (see CondLArena). During stochastic mapping, the random
+ * numbers of each site are drawn from a RandomStream specific to this site and
+ * to the current iteration, so that the sampled histories do not depend on the
+ * number of threads.
+ *
+ * At the beginning of each likelihood computation or stochastic mapping, the
+ * sites are reordered so that sites sharing the same substitution matrix (e.g.
+ * allocated to the same component of a mixture) and the same rate are
+ * consecutive (see GroupSites), and blocks are then made of consecutive sites
+ * in this order. Along each branch, for groups of at least Nstate/8 sites
+ * with the same matrix and effective branch length (branch length times site
+ * rate), the transition matrix P = exp(tQ) is taken from (or computed into)
+ * the global TransitionMatrixCache, and conditional likelihoods are propagated
+ * along the branch by a single matrix-matrix product for all the sites of the
+ * group within a block, instead of one propagation through the eigen
+ * decomposition of Q per site.
  */
 
 class PhyloProcess {
@@ -140,6 +165,201 @@ class PhyloProcess {
     //! sites
     double Move(double fraction);
 
+    //! \brief statistics of the sampling of substitution paths along branches
+    //! (see SetAdaptivePathSampling)
+    struct PathSamplingStat {
+        //! number of paths
+        long npath = 0;
+        //! paths obtained by accept-reject
+        long naccept = 0;
+        //! accept-reject trials
+        long ntrial = 0;
+        //! substitutions drawn during accept-reject trials
+        long njump = 0;
+        //! paths obtained by uniformization (after accept-reject has failed)
+        long nuni = 0;
+        //! events of the uniformized process (including virtual substitutions)
+        long nunievent = 0;
+        //! time spent in accept-reject and in uniformization (in ms)
+        double artime = 0;
+        double unitime = 0;
+
+        void Add(const PathSamplingStat &from);
+    };
+
+    //! \brief choose how the number of accept-reject trials is set (default:
+    //! adaptive)
+    //!
+    //! The path along a branch, conditional on the states at both ends, is
+    //! first drawn by accept-reject (forward simulation until a path ends in
+    //! the right state), and, if this fails after a maximum number of trials, by
+    //! uniformization. Accept-reject is cheap when the branch is short, but the
+    //! probability of ending in the right state can be small on long branches,
+    //! or when the end states differ, in which case uniformization is cheaper.
+    //! Since each of the two methods is exact, the sampler is exact whatever
+    //! the maximum number of trials. Without adaptation, it is GetMaxTrial() for
+    //! all paths. With adaptation, it is set for each class of paths (branch,
+    //! and whether the end states differ) at the start of each ResampleSub,
+    //! from the statistics of the paths of that class during the previous call:
+    //! accept-reject is tried for as long as its expected cost stays below that
+    //! of uniformization (which bounds the cost of any path by twice that of
+    //! the cheapest method for it), as given by the mean number of
+    //! substitutions per trial and of events per uniformized path, and by the
+    //! relative costs of the two (AcceptRejectStepCost, UniformizedPathCost and
+    //! UniformizedEventCost). Decisions thus only depend on the paths already
+    //! sampled, and not on the number of threads.
+    void SetAdaptivePathSampling(bool in);
+
+    //! maximum number of accept-reject trials for sampling a path (see
+    //! SetAdaptivePathSampling)
+    int GetMaxTrial() const { return maxtrial; }
+    void SetMaxTrial(int i);
+
+    //! whether the maximum number of accept-reject trials is adaptive
+    bool isAdaptivePathSampling() const { return adaptivepathsampling; }
+
+    //! maximum number of accept-reject trials currently used for paths along
+    //! the branch leading to node, with identical (change == false) or
+    //! different (change == true) states at both ends
+    int GetAcceptRejectTrials(Tree::NodeIndex node, bool change) const {
+        return pathmaxtrial[2 * node + change];
+    }
+
+    //! statistics of all paths sampled since construction
+    PathSamplingStat GetPathSamplingStat() const;
+
+    //! \brief sinks into which sufficient statistics can be streamed during
+    //! stochastic mapping (see SetSuffStatSinks); null pointers are ignored
+    struct SuffStatSinks {
+        //! as given by AddPathSuffStat(PathSuffStat&)
+        PathSuffStat *path = nullptr;
+        //! as given by AddPathSuffStat(Array<PathSuffStat>&)
+        Array<PathSuffStat> *sitepath = nullptr;
+        //! as given by AddLengthSuffStat
+        BranchArray<PoissonSuffStat> *length = nullptr;
+        //! as given by AddRateSuffStat
+        Array<PoissonSuffStat> *rate = nullptr;
+        //! as given by AddPolySuffStat(PolySuffStat&)
+        PolySuffStat *poly = nullptr;
+    };
+
+    //! \brief stream sufficient statistics into the given sinks during
+    //! stochastic mapping
+    //!
+    //! Instead of storing the substitution history of each branch and each site
+    //! and then collecting sufficient statistics by a second traversal of all
+    //! histories, ResampleSub then clears the sinks and adds to them the
+    //! statistics of each history as soon as it is sampled, without keeping it.
+    //! This saves the memory of the Nnode * Nsite histories and the second
+    //! traversal. The sinks receive what the corresponding Add*SuffStat
+    //! functions would give right after ResampleSub: they are computed with the
+    //! branch lengths, site rates and matrices used for sampling, and are
+    //! therefore only valid until those parameters change. In this mode, only
+    //! complete resamplings are possible (Move(1.0)), and AddPathSuffStat,
+    //! AddLengthSuffStat and AddRateSuffStat cannot be called. Giving empty
+    //! sinks switches back to the default mode (histories are then available
+    //! after the next call to ResampleSub).
+    void SetSuffStatSinks(const SuffStatSinks &insinks);
+
+    //! whether sufficient statistics are streamed (see SetSuffStatSinks)
+    bool isStreaming() const;
+
+    //! \brief set the number of sites whose conditional likelihoods are stored
+    //! and pruned together (should be called before Unfold)
+    //!
+    //! Pruning proceeds by blocks of consecutive sites: for each block, a single
+    //! postorder traversal of the tree computes the conditional likelihoods of
+    //! all sites of the block at each node (see CondLArena). A block size of 1
+    //! gives back the classical site-by-site pruning. Blocks are also the units
+    //! of work distributed across threads.
+    void SetBlockSize(int inblocksize) { blocksize = inblocksize; }
+
+    //! return the number of sites pruned together
+    int GetBlockSize() const { return blocksize; }
+
+    //! \brief activate site pattern compression (should be called before
+    //! Unfold)
+    //!
+    //! Identical columns of the alignment are indexed at Unfold. Then, at each
+    //! call to GetLogLikelihood, only one site is pruned per group of sites
+    //! having the same column and the same substitution process (same matrices
+    //! along all branches, same rate), and its likelihood is copied to the other
+    //! sites of the group. The result is exactly the same as without
+    //! compression. Compression is ignored if a PolyProcess is given (since the
+    //! polymorphism data then differ between sites).
+    void SetPatternCompression(bool in) { patterncompression = in; }
+
+    //! return number of distinct columns of the alignment (or number of sites,
+    //! if pattern compression is not active)
+    int GetNpattern() const { return Npattern; }
+
+    //! return the number of sites actually pruned by the last call to
+    //! GetLogLikelihood
+    int GetNprunedSite() const { return nprunedsite; }
+
+    //! \brief activate incremental pruning (should be called before Unfold)
+    //!
+    //! The conditional likelihoods of all nodes and all sites are then kept in
+    //! memory across calls (instead of only those of the blocks being
+    //! processed), together with the version of the matrix and the effective
+    //! length of each branch for each site at the time of their computation. A
+    //! node is then dirty, for a given site, if the matrix or the effective
+    //! length of one of its child branches has changed since, or if one of its
+    //! children has been recomputed. Only dirty nodes are recomputed, i.e. only
+    //! the paths from modified branches to the root: after a change in the
+    //! length of one branch, or in the matrix of a subset of sites, the
+    //! likelihood is obtained for a fraction of the cost of full pruning. This
+    //! requires (Nnode * Nsite * Nstate) doubles of memory. Incremental pruning
+    //! is ignored if a PolyProcess is given (since the conditional likelihoods
+    //! at the tips then depend on the parameters of the model).
+    void SetIncremental(bool in) { incremental = in; }
+
+    //! whether incremental pruning is active
+    bool isIncremental() const { return fullarena != nullptr; }
+
+    //! \brief choose the scaling of conditional likelihoods (default: lazy)
+    //!
+    //! Conditional likelihoods are scaled to avoid underflow, the scaling
+    //! factors being accumulated (per node and per site) in the last entry of
+    //! the vectors. With lazy scaling, the vectors of internal nodes are
+    //! rescaled by a power of 2 (which is exact), only when their maximum falls
+    //! below LazyScalingThreshold, and the scaling entry accumulates integer
+    //! binary exponents, converted to a log only at the root. Otherwise, each
+    //! vector is divided by its maximum, whose log is accumulated.
+    void SetLazyScaling(bool in) {
+        lazyscaling = in;
+        InvalidatePartials();
+    }
+
+    //! whether lazy scaling is used
+    bool isLazyScaling() const { return lazyscaling; }
+
+    //! mark all conditional likelihoods as dirty (incremental pruning only;
+    //! changes in matrices and branch lengths are detected automatically)
+    void InvalidatePartials();
+
+    //! return the fraction of the conditional likelihoods of internal nodes
+    //! that were recomputed by the last call to GetLogLikelihood (1 without
+    //! incremental pruning)
+    double GetUpdatedFraction() const { return updatedfraction; }
+
+    //! return the number of groups of sites (with same matrix and rate) formed
+    //! for the last likelihood computation or stochastic mapping
+    int GetNsiteGroup() const { return nsitegroup; }
+
+    //! return the fraction of the transition matrices requested so far that
+    //! were found already computed in the TransitionMatrixCache
+    double GetTransitionMatrixHitRate() const {
+        long n = ntransmatrixhit + ntransmatrixmiss;
+        return n ? static_cast<double>(ntransmatrixhit) / n : 0;
+    }
+
+    //! return the fraction of all branch-site propagations done so far that
+    //! used a cached transition matrix
+    double GetTransitionMatrixUsage() const {
+        return nbranchsite ? static_cast<double>(ntransmatrixsite) / nbranchsite : 0;
+    }
+
     //! create all data structures necessary for computation
     void Unfold();
 
@@ -152,9 +372,9 @@ class PhyloProcess {
     //! get data from tips (after simulation) and put in into sequence alignment
     void GetLeafData(SequenceAlignment *data);
 
+    //! state at the tip of the given taxon (i.e. final state of its path)
     int GetPathState(int taxon, int site) const {
-        auto site_leaf_path_map = pathmap[taxon_map.TaxonToNode(taxon)][site];
-        return site_leaf_path_map->GetFinalState();
+        return statemap[taxon_map.TaxonToNode(taxon)][site];
     }
 
     //! compute path sufficient statistics across all sites and branches and add
@@ -214,9 +434,6 @@ class PhyloProcess {
     const Tree *GetTree() const { return tree; }
     Tree::NodeIndex GetRoot() const { return GetTree()->root(); }
 
-    int GetMaxTrial() const { return maxtrial; }
-    void SetMaxTrial(int i) { maxtrial = i; }
-
     void SetData(const SequenceAlignment *indata);
     void ClampData() { clampdata = true; }
     void UnclampData() { clampdata = false; }
@@ -297,6 +514,20 @@ class PhyloProcess {
 
     void CreateMissingMap();
     void DeleteMissingMap();
+    //! compute the tip state of all leaves and all sites (see GetTipState)
+    void CreateTipStates();
+    void DeleteTipStates();
+    //! \brief state observed at a leaf for a given site
+    //!
+    //! Returns the only state compatible with the data, or TipMissing if all
+    //! states are compatible with the data, or TipDense if several (but not
+    //! all) states are, or if the leaf carries polymorphism data: in that case,
+    //! the conditional likelihood vector of the leaf should be used.
+    int GetTipState(Tree::NodeIndex node, int site) const {
+        return tipstate[static_cast<size_t>(node) * GetNsite() + site];
+    }
+    static const int TipMissing = -1;
+    static const int TipDense = -2;
     void RecursiveCreateMissingMap(Tree::NodeIndex from);
     void FillMissingMap();
     void BackwardFillMissingMap(Tree::NodeIndex from);
@@ -307,12 +538,96 @@ class PhyloProcess {
 
     void RecursiveCreate(Tree::NodeIndex from);
     void RecursiveDelete(Tree::NodeIndex from);
+    void CreatePathMap();
+    void DeletePathMap();
+    //! exit with an error message if substitution histories are not stored
+    void CheckPathMap(const char *caller) const;
+
+    void CreateTBL();
+    void DeleteTBL();
+
+    //! conditional likelihood vector (of size Nstate+1, the last entry being the
+    //! log of the scaling factor) for given node and given site of the block
+    //! currently processed by the calling thread
+    double *GetCondL(Tree::NodeIndex node, int site) const {
+        if (fullarena != nullptr) { return (*fullarena)(node, site); }
+        return (*condlarena[ThreadPool::GetThreadIndex()])(node, siteposition[site] % blocksize);
+    }
 
-    void RecursiveCreateTBL(Tree::NodeIndex from);
-    void RecursiveDeleteTBL(Tree::NodeIndex from);
+    //! index of the random stream of a given site, for drawing ancestral states
+    //! (phase 0) or substitution paths (phase 1)
+    uint64_t GetSiteStream(int site, int phase) const {
+        return (static_cast<uint64_t>(instance) << 40) | (static_cast<uint64_t>(phase) << 32) |
+               static_cast<uint64_t>(site);
+    }
+
+    //! blocks are made of consecutive positions in the current order of the
+    //! sites (see GroupSites): site siteorder[pos] is at position pos
+    int GetNblock() const { return (GetNsite() + blocksize - 1) / blocksize; }
+    int GetBlockBegin(int block) const { return block * blocksize; }
+    int GetBlockEnd(int block) const { return std::min((block + 1) * blocksize, GetNsite()); }
+
+    //! when running on several threads: update (serially) all substitution
+    //! matrices needed by the selected sites, so that they are only read from
+    //! within parallel loops
+    void UpdateSubMatrices() const;
 
-    void Pruning(Tree::NodeIndex from, int site) const;
+    //! \brief reorder the sites, such that sites for which mask is not 0 come
+    //! first, grouped by substitution matrix and rate
+    //!
+    //! Groups are ordered by first occurrence along the alignment, and sites
+    //! keep their alignment order within a group, so that the order does not
+    //! depend on memory addresses. In mixture models, the sites allocated to the
+    //! same component then occupy consecutive positions of the blocks, and are
+    //! pruned by matrix-matrix products with the same transition matrices.
+    //! With incremental pruning, sites are kept in alignment order.
+    void GroupSites(const int *mask) const;
+
+    //! get from the TransitionMatrixCache (and compute if needed) the
+    //! transition matrices of all branches for all sites for which mask is not
+    //! 0 and that belong to a large enough group of sites with the same matrix
+    //! and effective length -- the transition matrices are then used by
+    //! pruning and ancestral sampling, until ReleaseTransitionMatrices
+    void UpdateTransitionMatrices(const int *mask) const;
+    void ReleaseTransitionMatrices() const { usetransmatrix = false; }
+
+    //! transition matrix to be used for given site along the branch leading
+    //! to given node (or null pointer if propagation should go through the
+    //! eigen decomposition of the substitution matrix)
+    const double *GetTransitionMatrix(Tree::NodeIndex node, int site) const {
+        if (!usetransmatrix) { return nullptr; }
+        return transmatrix[static_cast<size_t>(node) * GetNsite() + site];
+    }
+
+    //! compute conditional likelihoods for all nodes and all sites at positions
+    //! between begin (included) and end (excluded) -- the positions should
+    //! belong to the same block and sites not selected by DrawSites are skipped
+    void Pruning(int begin, int end) const { Pruning(begin, end, sitearray); }
+    //! same as above, but pruning only the sites for which mask is not 0
+    void Pruning(int begin, int end, const int *mask) const;
+    //! same as above, but only recomputing dirty nodes (see SetIncremental)
+    void IncrementalPruning(int begin, int end, const int *mask) const;
+    //! compute conditional likelihoods for a single site
+    void SitePruning(int site) const {
+        Pruning(siteposition[site], siteposition[site] + 1, sitearray);
+    }
+
+    void CreatePatterns();
+    void DeletePatterns();
+    //! whether two sites have the same substitution process (same matrices and
+    //! same rate)
+    bool SameProcess(int site1, int site2) const;
+    //! choose the sites to be pruned by GetLogLikelihood (one per group of sites
+    //! with same pattern and same process)
+    void SelectPatternSites() const;
+    void LeafPruning(Tree::NodeIndex from, int site) const;
+    void InternalPruning(Tree::NodeIndex from, int begin, int end, const int *mask) const;
     void ResampleSub(Tree::NodeIndex from, int site);
+    void ClearSuffStatSinks();
+    //! sample the histories of all sites of a block and stream their statistics
+    void StreamSuffStat(int block);
+    void StreamSuffStat(Tree::NodeIndex from, int site, BranchSitePath &path,
+        PathSuffStat &pathsuffstat, std::vector<PoissonSuffStat> &lengthsuffstat);
     void ResampleState();
     void ResampleState(int site);
     void PruningAncestral(Tree::NodeIndex from, int site);
@@ -322,13 +637,21 @@ class PhyloProcess {
 
     // borrowed from phylobayes
     // where should that be?
-    BranchSitePath *SamplePath(
-        int stateup, int statedown, double time, double rate, const SubMatrix &matrix);
-    BranchSitePath *SampleRootPath(int rootstate);
-    BranchSitePath *ResampleAcceptReject(int maxtrial, int stateup, int statedown, double rate,
+    // (the path given as first argument is reset and refilled in place)
+    void SamplePath(BranchSitePath &path, Tree::NodeIndex node, int stateup, int statedown,
+        double time, double rate, const SubMatrix &matrix);
+    void SampleRootPath(BranchSitePath &path, int rootstate);
+    // returns false if no path ending in statedown was found in maxtrial trials
+    // (the numbers of trials and of substitutions drawn are added to ntrial and
+    // njump)
+    bool ResampleAcceptReject(BranchSitePath &path, int maxtrial, int stateup, int statedown,
+        double rate, double totaltime, const SubMatrix &matrix, long &ntrial, long &njump);
+    // returns the number of events of the uniformized process
+    int ResampleUniformized(BranchSitePath &path, int stateup, int statedown, double rate,
         double totaltime, const SubMatrix &matrix);
-    BranchSitePath *ResampleUniformized(
-        int stateup, int statedown, double rate, double totaltime, const SubMatrix &matrix);
+    // merge the statistics of the threads, and set the maximum number of
+    // accept-reject trials of each class of paths (see SetAdaptivePathSampling)
+    void UpdatePathSampling();
 
     const Tree *tree;
     const SequenceAlignment *data;
@@ -344,20 +667,102 @@ class PhyloProcess {
     int *sitearray;
     mutable double *sitelnL;
 
+    // current order of the sites (see GroupSites) and its inverse
+    mutable int *siteorder;
+    mutable int *siteposition;
+    mutable int nsitegroup;
+
+    // pattern compression: index of the column pattern of each site, and, for
+    // the current likelihood computation, the site actually pruned for each
+    // site and the list of such sites for each pattern
+    bool patterncompression;
+    int Npattern;
+    int *sitepattern;
+    mutable int *prunesite;
+    mutable int *prunemask;
+    mutable std::vector<std::vector<int>> patternsites;
+    mutable int nprunedsite;
+
     int Nstate;
 
     bool clampdata;
 
-    mutable double **uppercondlmap;
-    mutable double **lowercondlmap;
-    mutable BranchSitePath ***pathmap;
+    int blocksize;
+    // one arena and one auxiliary vector per thread
+    int nthread;
+    mutable CondLArena **condlarena;
+    mutable double **lowercondl;
+    // Nstate*blocksize (column-wise) results of matrix-matrix propagations
+    mutable double **lowerblock;
+    // polyprocess is not thread-safe
+    mutable std::mutex polymutex;
+    // substitution histories (null when streaming sufficient statistics)
+    mutable BranchSitePath **pathmap;
+    SuffStatSinks sinks;
     int **statemap;
     int **missingmap;
+    // tip states of all nodes (only those of leaves are used) and all sites
+    int *tipstate;
+
+    // incremental pruning: conditional likelihoods of all nodes and all sites,
+    // whether they are valid, and the version of the matrix and effective
+    // length of the branch leading to each node, for each site, when the
+    // conditional likelihood of its parent was computed; updatemask tells
+    // which nodes were recomputed for each site during the current pass
+    bool lazyscaling;
+    // 2^-256: leaves enough room for several children with small
+    // propagated likelihoods before reaching denormals (2^-1022)
+    static const double LazyScalingThreshold;
+
+    bool incremental;
+    CondLArena *fullarena;
+    mutable char *partialvalid;
+    mutable uint64_t *partialversion;
+    mutable double *partiallength;
+    mutable int *updatemask;
+    mutable double updatedfraction;
+
+    // transition matrices for each node (branch) and each site
+    mutable const double **transmatrix;
+    mutable bool usetransmatrix;
+    int mintransmatrixsite;
+    mutable long ntransmatrixhit;
+    mutable long ntransmatrixmiss;
+    mutable long ntransmatrixsite;
+    mutable long nbranchsite;
 
     int maxtrial;
     static const int unknown = -1;
 
-    static const int DEFAULTMAXTRIAL = 100;
+    // adaptive path sampling (see SetAdaptivePathSampling): statistics of each
+    // class of paths (2*node + whether the end states differ), for each thread
+    // during the current call to ResampleSub, and then over the previous call
+    // and since construction, and maximum number of accept-reject trials
+    bool adaptivepathsampling;
+    std::vector<std::vector<PathSamplingStat>> threadpathstat;
+    std::vector<PathSamplingStat> lastpathstat;
+    PathSamplingStat totalpathstat;
+    std::vector<int> pathmaxtrial;
+
+    // relative costs, in accept-reject steps (one waiting time and one jump),
+    // of a uniformized path (finite-time transition probability, number of
+    // events) and of each event of the uniformized process, as measured with
+    // resamplesubbench on codon matrices; and minimum number of trials in a
+    // class during a call to ResampleSub for adapting its number of trials
+    static constexpr double AcceptRejectStepCost = 1.0;
+    static constexpr double UniformizedPathCost = 400.0;
+    static constexpr double UniformizedEventCost = 15.0;
+    static const int MinAdaptiveTrials = 20;
+
+    // random streams: index of this phyloprocess among all those created by the
+    // program, number of calls to ResampleSub and key of the streams
+    static int ninstance;
+    int instance;
+    int iteration;
+    uint64_t streamkey;
+
+    static const int DEFAULTMAXTRIAL = 1000;
+    static const int DEFAULTBLOCKSIZE = 32;
 
     mutable Chrono pruningchrono;
     mutable Chrono resamplechrono;
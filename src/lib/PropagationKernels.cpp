@@ -0,0 +1,126 @@
+#include "PropagationKernels.hpp"
+#include <cmath>
+#include <cstdlib>
+#include "ScratchMemory.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PROPAGATION_X86
+#endif
+
+namespace generic {
+#define VECSIZE 2
+#define KERNEL_TARGET
+#include "PropagationKernelsImpl.hpp"
+#undef KERNEL_TARGET
+#undef VECSIZE
+}  // namespace generic
+
+#ifdef PROPAGATION_X86
+namespace avx2 {
+#define VECSIZE 4
+#define KERNEL_TARGET __attribute__((target("avx2,fma")))
+#include "PropagationKernelsImpl.hpp"
+#undef KERNEL_TARGET
+#undef VECSIZE
+}  // namespace avx2
+
+namespace avx512 {
+#define VECSIZE 8
+#define KERNEL_TARGET __attribute__((target("avx512f,fma")))
+#include "PropagationKernelsImpl.hpp"
+#undef KERNEL_TARGET
+#undef VECSIZE
+}  // namespace avx512
+#endif
+
+namespace {
+PropagationKernels::InstructionSet BestInstructionSet() {
+    if (PropagationKernels::isSupported(PropagationKernels::AVX512)) {
+        return PropagationKernels::AVX512;
+    }
+    if (PropagationKernels::isSupported(PropagationKernels::AVX2)) {
+        return PropagationKernels::AVX2;
+    }
+    return PropagationKernels::GENERIC;
+}
+}  // namespace
+
+PropagationKernels::InstructionSet PropagationKernels::instructionset = BestInstructionSet();
+
+const char *PropagationKernels::GetName(InstructionSet set) {
+    switch (set) {
+        case AVX512:
+            return "avx512";
+        case AVX2:
+            return "avx2";
+        default:
+            return "generic";
+    }
+}
+
+bool PropagationKernels::isSupported(InstructionSet set) {
+#ifdef PROPAGATION_X86
+    __builtin_cpu_init();
+    switch (set) {
+        case AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+        case AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        default:
+            return true;
+    }
+#else
+    return set == GENERIC;
+#endif
+}
+
+bool PropagationKernels::SetInstructionSet(InstructionSet set) {
+    if (!isSupported(set)) { return false; }
+    instructionset = set;
+    return true;
+}
+
+void PropagationKernels::Backward(int Nstate, const double *ucol, const double *invucol,
+    const double *v, double length, const double *up, double *down) {
+    int npad = GetPaddedSize(Nstate);
+    double *aux = ScratchMemory::Get(ScratchMemory::KERNELAUX, npad);
+    double *res = ScratchMemory::Get(ScratchMemory::KERNELRES, npad);
+#ifdef PROPAGATION_X86
+    // with 4 states, columns are too short for 8-wide vectors, and 4-wide
+    // vectors turn out to be slower than 2-wide ones (horizontal reductions
+    // and transitions when calling exp dominate)
+    if ((instructionset == AVX512) && (npad % 8 == 0)) {
+        avx512::BackwardDispatch(
+            Nstate, npad, ucol, invucol, v, length, up, down, aux, res);
+        return;
+    }
+    if ((instructionset != GENERIC) && (npad > 4)) {
+        avx2::BackwardDispatch(
+            Nstate, npad, ucol, invucol, v, length, up, down, aux, res);
+        return;
+    }
+#endif
+    generic::BackwardDispatch(
+        Nstate, npad, ucol, invucol, v, length, up, down, aux, res);
+}
+
+void PropagationKernels::Forward(int Nstate, const double *ucol, const double *invucol,
+    const double *v, double length, const double *down, double *up) {
+    int npad = GetPaddedSize(Nstate);
+    double *aux = ScratchMemory::Get(ScratchMemory::KERNELAUX, npad);
+    double *res = ScratchMemory::Get(ScratchMemory::KERNELRES, npad);
+#ifdef PROPAGATION_X86
+    if ((instructionset == AVX512) && (npad % 8 == 0)) {
+        avx512::ForwardDispatch(
+            Nstate, npad, ucol, invucol, v, length, down, up, aux, res);
+        return;
+    }
+    if ((instructionset != GENERIC) && (npad > 4)) {
+        avx2::ForwardDispatch(
+            Nstate, npad, ucol, invucol, v, length, down, up, aux, res);
+        return;
+    }
+#endif
+    generic::ForwardDispatch(
+        Nstate, npad, ucol, invucol, v, length, down, up, aux, res);
+}
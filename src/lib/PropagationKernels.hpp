@@ -0,0 +1,59 @@
+#pragma once
+
+/**
+ * \brief SIMD kernels for propagating conditional likelihood vectors through
+ * the eigen decomposition of a substitution matrix
+ *
+ * With Q = U diag(v) U^{-1}, the backward (tip-to-root) propagation along a
+ * branch of length t computes down = U diag(exp(tv)) U^{-1} up, and the
+ * forward (root-to-tip) propagation computes up = down U diag(exp(tv)) U^{-1}.
+ * The kernels work on copies of U and U^{-1} stored column-wise, with columns
+ * padded with zeros to GetPaddedSize(Nstate) entries and aligned on 64 bytes
+ * (see SubMatrix, which maintains these copies), so that all products are
+ * sequences of aligned vector operations (axpy for the backward propagation,
+ * dot products for the forward propagation) without remainder loops.
+ *
+ * Kernels are specialized at compile time for 4 states (nucleotides) and 61
+ * states (codons, padded to 64), with a generic version for other sizes, and
+ * are compiled for several instruction sets (AVX-512, AVX2+FMA and plain
+ * 128-bit vectors, see PropagationKernelsImpl.hpp); with 4 states, the 128-bit
+ * version is always used, being the fastest on such short columns. The best
+ * instruction set supported by the CPU is selected at runtime.
+ * Temporary vectors come from ScratchMemory, so that no heap allocation is done
+ * per call.
+ */
+
+class PropagationKernels {
+  public:
+    enum InstructionSet { GENERIC = 0, AVX2 = 1, AVX512 = 2 };
+
+    //! size of the padded columns of U and U^{-1} for a given number of states
+    static int GetPaddedSize(int Nstate) {
+        return (Nstate <= 4) ? 4 : ((Nstate + 7) / 8) * 8;
+    }
+
+    //! down = U diag(exp(length v)) U^{-1} up (up and down of size Nstate)
+    static void Backward(int Nstate, const double *ucol, const double *invucol, const double *v,
+        double length, const double *up, double *down);
+
+    //! up = down U diag(exp(length v)) U^{-1} (up and down of size Nstate)
+    static void Forward(int Nstate, const double *ucol, const double *invucol, const double *v,
+        double length, const double *down, double *up);
+
+    //! instruction set currently used by the kernels
+    static InstructionSet GetInstructionSet() { return instructionset; }
+
+    //! name of an instruction set
+    static const char *GetName(InstructionSet set);
+
+    //! whether the CPU supports a given instruction set
+    static bool isSupported(InstructionSet set);
+
+    //! force the kernels to use a given instruction set (e.g. for
+    //! benchmarking), returns false (and changes nothing) if it is not supported
+    //! by the CPU
+    static bool SetInstructionSet(InstructionSet set);
+
+  private:
+    static InstructionSet instructionset;
+};
@@ -0,0 +1,77 @@
+// Propagation kernels, written with explicit vectors of VECSIZE doubles (GCC
+// vector extensions). This file is included by PropagationKernels.cpp once per
+// instruction set, each time within its own namespace, with VECSIZE and
+// KERNEL_TARGET (the target attribute of all functions) defined accordingly.
+// Columns (and scratch vectors) are padded to a multiple of VECSIZE and aligned
+// on 64 bytes. NP is the padded size if known at compile time (0 otherwise).
+
+typedef double vec __attribute__((vector_size(VECSIZE * sizeof(double))));
+
+// y += a * x
+template <int NP>
+KERNEL_TARGET inline void Axpy(int npad, const double *x, double a, double *y) {
+    const int np = NP ? NP : npad;
+    vec va;
+    for (int l = 0; l < VECSIZE; l++) { va[l] = a; }
+    for (int k = 0; k < np; k += VECSIZE) {
+        *reinterpret_cast<vec *>(y + k) += va * *reinterpret_cast<const vec *>(x + k);
+    }
+}
+
+// x . y
+template <int NP>
+KERNEL_TARGET inline double Dot(int npad, const double *x, const double *y) {
+    const int np = NP ? NP : npad;
+    vec acc = *reinterpret_cast<const vec *>(x) * *reinterpret_cast<const vec *>(y);
+    for (int k = VECSIZE; k < np; k += VECSIZE) {
+        acc += *reinterpret_cast<const vec *>(x + k) * *reinterpret_cast<const vec *>(y + k);
+    }
+    double tot = 0;
+    for (int l = 0; l < VECSIZE; l++) { tot += acc[l]; }
+    return tot;
+}
+
+template <int NP>
+KERNEL_TARGET void Backward(int n, int npad, const double *ucol, const double *invucol,
+    const double *v, double length, const double *up, double *down, double *aux, double *res) {
+    const int np = NP ? NP : npad;
+    for (int k = 0; k < np; k++) { aux[k] = 0; }
+    for (int j = 0; j < n; j++) { Axpy<NP>(np, invucol + j * np, up[j], aux); }
+    for (int k = 0; k < n; k++) { aux[k] *= exp(length * v[k]); }
+    for (int k = 0; k < np; k++) { res[k] = 0; }
+    for (int j = 0; j < n; j++) { Axpy<NP>(np, ucol + j * np, aux[j], res); }
+    for (int k = 0; k < n; k++) { down[k] = res[k]; }
+}
+
+template <int NP>
+KERNEL_TARGET void Forward(int n, int npad, const double *ucol, const double *invucol,
+    const double *v, double length, const double *down, double *up, double *aux, double *res) {
+    const int np = NP ? NP : npad;
+    for (int k = 0; k < n; k++) { res[k] = down[k]; }
+    for (int k = n; k < np; k++) { res[k] = 0; }
+    for (int i = 0; i < n; i++) { aux[i] = Dot<NP>(np, ucol + i * np, res) * exp(length * v[i]); }
+    for (int i = n; i < np; i++) { aux[i] = 0; }
+    for (int i = 0; i < n; i++) { up[i] = Dot<NP>(np, invucol + i * np, aux); }
+}
+
+KERNEL_TARGET void BackwardDispatch(int n, int npad, const double *ucol, const double *invucol,
+    const double *v, double length, const double *up, double *down, double *aux, double *res) {
+    if (npad == 4) {
+        Backward<4>(n, npad, ucol, invucol, v, length, up, down, aux, res);
+    } else if (npad == 64) {
+        Backward<64>(n, npad, ucol, invucol, v, length, up, down, aux, res);
+    } else {
+        Backward<0>(n, npad, ucol, invucol, v, length, up, down, aux, res);
+    }
+}
+
+KERNEL_TARGET void ForwardDispatch(int n, int npad, const double *ucol, const double *invucol,
+    const double *v, double length, const double *down, double *up, double *aux, double *res) {
+    if (npad == 4) {
+        Forward<4>(n, npad, ucol, invucol, v, length, down, up, aux, res);
+    } else if (npad == 64) {
+        Forward<64>(n, npad, ucol, invucol, v, length, down, up, aux, res);
+    } else {
+        Forward<0>(n, npad, ucol, invucol, v, length, down, up, aux, res);
+    }
+}
@@ -32,15 +32,16 @@ class random_init {
   public:
     random_init() {
         Random::InitRandom();
-        INFO("Random seed is {}", Random::GetSeed());
     }
 };
 
 static random_init init;
 
 int Random::Seed = 0;
-int Random::mt_index = 0;
-unsigned long long Random::mt_buffer[MT_LEN];
+int Random::chain = 0;
+thread_local RandomStream *Random::stream = nullptr;
+thread_local int Random::mt_index = 0;
+thread_local unsigned long long Random::mt_buffer[MT_LEN];
 
 const double Random::INFPROB = -250;
 
@@ -54,6 +55,7 @@ void Random::InitRandom(int seed) {
         seed = tod.tv_usec;
     }
     Seed = seed;
+    INFO("Random seed is {}", Seed);
     srand(seed);
     int i;
 
@@ -65,14 +67,38 @@ void Random::InitRandom(int seed) {
     mt_index = 0;
 }
 
+void Random::InitThreadRandom(int seed, int thread) {
+    // splitmix64 sequence started from a combination of the seed and the thread
+    // index (srand/rand cannot be used here, as they share a global state)
+    unsigned long long x =
+        (static_cast<unsigned long long>(seed) << 32) ^ static_cast<unsigned long long>(thread);
+    for (int i = 0; i < MT_LEN; i++) {
+        x += 0x9E3779B97F4A7C15ULL;
+        unsigned long long z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= (z >> 31);
+        mt_buffer[i] = z & 0xFFFFFFFF;
+    }
+    mt_index = 0;
+}
+
 Random::Random(int seed) { InitRandom(seed); }
 
+RandomStream *Random::SetStream(RandomStream *instream) {
+    RandomStream *prev = stream;
+    stream = instream;
+    return prev;
+}
+
 int Random::GetSeed() { return Seed; }
 
 // ---------------------------------------------------------------------------------
 //		Uniform()
 // ---------------------------------------------------------------------------------
 double Random::Uniform() {
+    if (stream) { return stream->Uniform(); }
+
     // Mersenne twister
     // Matsumora and Nishimora 1996
     // 32-bit generator
@@ -343,18 +369,14 @@ double fsign(double num, double sign)
 // ---------------------------------------------------------------------------------
 double Random::sGamma(double a) {
     if (a > 1) {
-        static double a1 = 0;
-        static double a2 = 0;
-
-        static double s2, s, d, t, x, u, q0, b, sigma, c, v, q, e;
+        // no static variables caching the constants of the last value of a, so
+        // that sGamma can be called concurrently
 
         // step 1
-        if (a != a1) {
-            a1 = a;
-            s2 = a - 0.5;
-            s = sqrt(s2);
-            d = 4 * sqrt(2.0) - 12 * s;
-        }
+        double s2 = a - 0.5;
+        double s = sqrt(s2);
+        double d = 4 * sqrt(2.0) - 12 * s;
+        double t, x, u, q0, b, sigma, c, v, q, e;
 
         // step 2
         t = sNormal();
@@ -372,22 +394,19 @@ double Random::sGamma(double a) {
         }
 
         // step 4
-        if (a != a2) {
-            a2 = a;
-            q0 = log(sqrt(2 * Pi)) - logGamma(a) - s2 + s2 * log(s2);
-            if (a < 3.686) {
-                b = 0.463 + s + 0.178 * s2;
-                sigma = 1.235;
-                c = 0.195 / s - 0.079 + 0.16 * s;
-            } else if (a < 13.022) {
-                b = 1.654 + 0.0076 * s2;
-                sigma = 1.68 / s + 0.275;
-                c = 0.062 / s + 0.024;
-            } else {
-                b = 1.77;
-                sigma = 0.75;
-                c = 0.1515 / s;
-            }
+        q0 = log(sqrt(2 * Pi)) - logGamma(a) - s2 + s2 * log(s2);
+        if (a < 3.686) {
+            b = 0.463 + s + 0.178 * s2;
+            sigma = 1.235;
+            c = 0.195 / s - 0.079 + 0.16 * s;
+        } else if (a < 13.022) {
+            b = 1.654 + 0.0076 * s2;
+            sigma = 1.68 / s + 0.275;
+            c = 0.062 / s + 0.024;
+        } else {
+            b = 1.77;
+            sigma = 0.75;
+            c = 0.1515 / s;
         }
 
         // step 5-7
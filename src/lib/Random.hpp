@@ -12,6 +12,7 @@ typedef Eigen::VectorXd EVector;
 
 #define MT_LEN 624  // (VL) required for magic
 #include <vector>
+#include "RandomStream.hpp"
 
 const double Pi = 3.1415926535897932384626;
 
@@ -23,6 +24,14 @@ const double Pi = 3.1415926535897932384626;
  * Michael Brundage, copyright 1995-2005, creative commons), plus many basic
  * routines related to probabilities: in particular, sampling from standard
  * distributions and returning their densities).
+ *
+ * The state of the generator is thread-local: the main thread is seeded by
+ * InitRandom, and each worker thread (see ThreadPool) gets its own stream,
+ * seeded by InitThreadRandom. In addition, a counter-based RandomStream can be
+ * installed as the current stream of a thread (see RandomStreamScope), in
+ * which case all draws come from this stream instead of the Mersenne twister:
+ * this is how computations distributed over threads (such as the stochastic
+ * mapping done by PhyloProcess) are made independent of the number of threads.
  */
 
 class Random {
@@ -33,8 +42,26 @@ class Random {
 
     static void InitRandom(int seed = -1);
 
+    //! initialize the random stream of the calling (worker) thread, based on
+    //! the seed of the main thread and on the index of the thread
+    static void InitThreadRandom(int seed, int thread);
+
     static int GetSeed();
 
+    //! set the index of the chain (0 by default), which, together with the
+    //! seed, determines the key of all random streams (see GetStreamKey)
+    static void SetChain(int inchain) { chain = inchain; }
+
+    //! return the index of the chain
+    static int GetChain() { return chain; }
+
+    //! return the key of the random streams, based on the seed and the chain
+    static uint64_t GetStreamKey() { return RandomStream::MakeKey(Seed, chain); }
+
+    //! install a stream as the current stream of the calling thread (nullptr to
+    //! go back to the Mersenne twister), and return the previous one
+    static RandomStream *SetStream(RandomStream *instream);
+
     static double Uniform();
     static int ApproxBinomial(int N, double p);
     static int Poisson(double mu);
@@ -77,6 +104,34 @@ class Random {
 
   private:
     static int Seed;
-    static int mt_index;
-    static unsigned long long mt_buffer[MT_LEN];
-};
\ No newline at end of file
+    static int chain;
+    static thread_local RandomStream *stream;
+    // each thread draws from its own stream
+    static thread_local int mt_index;
+    static thread_local unsigned long long mt_buffer[MT_LEN];
+};
+
+/**
+ * \brief Installs a RandomStream as the current stream of the calling thread,
+ * for the lifetime of the scope
+ *
+ * Typical use, for drawing the random numbers of a site from a stream
+ * specific to this site and to the current iteration:
+ * \code
+ * RandomStream stream(Random::GetStreamKey(), site, iteration);
+ * RandomStreamScope scope(stream);
+ * // ... all calls to Random::Uniform(), Random::sGamma(), etc
+ * \endcode
+ */
+
+class RandomStreamScope {
+  public:
+    explicit RandomStreamScope(RandomStream &stream) : prev(Random::SetStream(&stream)) {}
+    ~RandomStreamScope() { Random::SetStream(prev); }
+
+    RandomStreamScope(const RandomStreamScope &) = delete;
+    RandomStreamScope &operator=(const RandomStreamScope &) = delete;
+
+  private:
+    RandomStream *prev;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * \brief A counter-based random stream (Philox4x32-10, Salmon et al. 2011)
+ *
+ * The random numbers of a stream are a pure function of a key (derived from
+ * the seed and the chain index, see MakeKey), of a stream index (e.g. a site or
+ * a component of a mixture) and of an iteration number, plus the rank of the
+ * draw within the stream. Thus, unlike the (sequential) Mersenne twister of
+ * Random, streams can be created on demand, in any order and from any thread,
+ * and always give the same numbers: a computation that draws the random numbers
+ * of each site from the stream of this site gives the same result whatever the
+ * number of threads and whatever the order in which sites are processed.
+ *
+ * A stream is typically installed as the current stream of the calling thread
+ * with a RandomStreamScope: all draws of Random (Uniform, sNormal, sGamma,
+ * etc.) then come from this stream, until the scope is closed.
+ */
+
+class RandomStream {
+  public:
+    //! constructor parameterized by the key (see MakeKey), the index of the
+    //! stream and the iteration
+    RandomStream(uint64_t key, uint64_t instream, uint64_t initeration)
+        : stream(instream), iteration(initeration), block(0), next(4) {
+        k0 = static_cast<uint32_t>(key);
+        k1 = static_cast<uint32_t>(key >> 32);
+    }
+
+    //! make a key out of a seed and the index of a chain
+    static uint64_t MakeKey(int seed, int chain) {
+        return Mix((static_cast<uint64_t>(static_cast<uint32_t>(seed)) << 32) ^
+                   static_cast<uint64_t>(static_cast<uint32_t>(chain)));
+    }
+
+    //! return a uniform random number in (0,1) (boundaries excluded)
+    double Uniform() {
+        uint32_t a = NextWord();
+        uint32_t b = NextWord();
+        // 53 random bits, shifted by half a unit so as to never return 0 or 1
+        return ((a >> 5) * 67108864.0 + (b >> 6) + 0.5) / 9007199254740992.0;
+    }
+
+    //! return the index of the stream
+    uint64_t GetStream() const { return stream; }
+
+    //! return the iteration of the stream
+    uint64_t GetIteration() const { return iteration; }
+
+  private:
+    uint32_t NextWord() {
+        if (next == 4) {
+            Generate();
+            next = 0;
+        }
+        return out[next++];
+    }
+
+    // one Philox4x32-10 block: counter is (block, iteration, stream)
+    void Generate() {
+        uint32_t c0 = block;
+        uint32_t c1 = static_cast<uint32_t>(iteration);
+        uint32_t c2 = static_cast<uint32_t>(stream);
+        uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+        uint32_t key0 = k0;
+        uint32_t key1 = k1;
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = static_cast<uint64_t>(0xD2511F53) * c0;
+            uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57) * c2;
+            uint32_t hi0 = static_cast<uint32_t>(p0 >> 32);
+            uint32_t lo0 = static_cast<uint32_t>(p0);
+            uint32_t hi1 = static_cast<uint32_t>(p1 >> 32);
+            uint32_t lo1 = static_cast<uint32_t>(p1);
+            c0 = hi1 ^ c1 ^ key0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ key1;
+            c3 = lo0;
+            key0 += 0x9E3779B9;
+            key1 += 0xBB67AE85;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+        block++;
+    }
+
+    // splitmix64 finalizer
+    static uint64_t Mix(uint64_t z) {
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    uint32_t k0;
+    uint32_t k1;
+    uint64_t stream;
+    uint64_t iteration;
+    uint32_t block;
+    int next;
+    uint32_t out[4];
+};
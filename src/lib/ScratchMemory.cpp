@@ -0,0 +1,37 @@
+#include "ScratchMemory.hpp"
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+struct Buffers {
+    double *data[ScratchMemory::NSLOT] = {};
+    size_t size[ScratchMemory::NSLOT] = {};
+    long nalloc{0};
+
+    ~Buffers() {
+        for (auto p : data) { free(p); }
+    }
+};
+
+thread_local Buffers buffers;
+}  // namespace
+
+double *ScratchMemory::Get(Slot slot, size_t n) {
+    if (buffers.size[slot] < n) {
+        free(buffers.data[slot]);
+        void *p = nullptr;
+        // round up to a multiple of 8 doubles (a cache line), so that vector
+        // code can work on full lines
+        size_t size = ((n + 7) / 8) * 8;
+        if (posix_memalign(&p, 64, size * sizeof(double))) {
+            std::cerr << "error in ScratchMemory: could not allocate " << size << " doubles\n";
+            exit(1);
+        }
+        buffers.data[slot] = static_cast<double *>(p);
+        buffers.size[slot] = size;
+        buffers.nalloc++;
+    }
+    return buffers.data[slot];
+}
+
+long ScratchMemory::GetNalloc() { return buffers.nalloc; }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * \brief Per-thread scratch memory for hot numerical routines
+ *
+ * Routines called millions of times per MCMC cycle (propagation of
+ * conditional likelihoods, finite time transition probabilities, sampling of
+ * substitution histories) need small temporary arrays of Nstate doubles.
+ * Instead of allocating them on the heap at each call, they request them from
+ * ScratchMemory, which keeps, for each thread and each slot, a buffer aligned
+ * on 64 bytes that is only reallocated when a larger size is requested. In the
+ * steady state, the routines thus do no heap allocation at all.
+ *
+ * Each routine uses its own slot, so that a routine can call another one
+ * while holding its buffer; the content of a buffer is not preserved across
+ * calls.
+ */
+
+class ScratchMemory {
+  public:
+    enum Slot {
+        KERNELAUX = 0,     // PropagationKernels
+        KERNELRES,         // PropagationKernels
+        TRANSITIONPROB,    // SubMatrix::GetFiniteTimeTransitionProb
+        UNIFORMIZED,       // SubMatrix::DrawUniformizedTransition
+        TRANSITIONMATRIX,  // SubMatrix::GetFiniteTimeTransitionMatrix
+        FIXATION,          // AAMutSelOmegaCodonSubMatrix::UpdateFixation
+        NSLOT
+    };
+
+    //! buffer of at least n doubles for the given slot (for the calling thread)
+    static double *Get(Slot slot, size_t n);
+
+    //! number of buffer (re)allocations done so far by the calling thread
+    static long GetNalloc();
+};
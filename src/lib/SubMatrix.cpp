@@ -1,15 +1,38 @@
 #include "SubMatrix.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <utility>
+#include "ThreadPool.hpp"
 using namespace std;
 
+// row-major views of the powers of the uniformized matrix (see ComputePowers)
+using RowMajorMatrix = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+using RowMajorMatrixMap = Eigen::Map<RowMajorMatrix>;
+using ConstRowMajorMatrixMap = Eigen::Map<const RowMajorMatrix>;
+
 int SubMatrix::nuni = 0;
 int SubMatrix::nunimax = 0;
-int SubMatrix::nunisubcount = 0;
-int SubMatrix::diagcount = 0;
+std::atomic<int> SubMatrix::nunisubcount{0};
+std::atomic<uint64_t> SubMatrix::nversion{0};
+std::mutex SubMatrix::powmutex;
+std::atomic<size_t> SubMatrix::powcachesize{0};
+std::atomic<size_t> SubMatrix::powpoolsize{0};
+std::map<int, std::vector<double *>> SubMatrix::powpool;
+std::mutex SubMatrix::jumpmutex;
+std::atomic<int> SubMatrix::diagcount{0};
+std::atomic<int> SubMatrix::ngeneraldiag{0};
 double SubMatrix::diagerr = 0;
+#ifdef NDEBUG
+int SubMatrix::diagcheckperiod = 0;
+#else
+int SubMatrix::diagcheckperiod = 1;
+#endif
+std::mutex SubMatrix::diagmutex;
+bool SubMatrix::sparsesampling = true;
 
 double SubMatrix::nz = 0;
 double SubMatrix::meanz = 0;
@@ -17,6 +40,18 @@ double SubMatrix::maxz = 0;
 
 const int witheigen = 1;
 
+// zero-initialized array of n doubles, aligned on 64 bytes (to be freed with free)
+static double *AlignedZeros(int n) {
+    void *p = nullptr;
+    if (posix_memalign(&p, 64, n * sizeof(double))) {
+        cerr << "error in SubMatrix: could not allocate aligned memory\n";
+        exit(1);
+    }
+    double *ret = static_cast<double *>(p);
+    for (int i = 0; i < n; i++) { ret[i] = 0; }
+    return ret;
+}
+
 // ---------------------------------------------------------------------------
 //     SubMatrix()
 // ---------------------------------------------------------------------------
@@ -26,9 +61,7 @@ SubMatrix::SubMatrix(int inNstate, bool innormalise) : Nstate(inNstate), normali
 }
 
 void SubMatrix::Create() {
-    Q = EMatrix::Zero(Nstate, Nstate);
-    u = EMatrix(Nstate, Nstate);
-    invu = EMatrix(Nstate, Nstate);
+    version = nversion++;
     v = EVector(Nstate);
     vi = EVector(Nstate);
     mStationary = EVector(Nstate);
@@ -39,6 +72,16 @@ void SubMatrix::Create() {
     ptrv = nullptr;
     ptrStationary = nullptr;
 
+    sparsestart = nullptr;
+    sparsecol = nullptr;
+    sparseQ = nullptr;
+
+    jumpflag = false;
+    jumpsparse = false;
+    jumpprob = nullptr;
+    jumpalias = nullptr;
+    jumpwork = nullptr;
+
     if (!witheigen) {
         ptrQ = new double *[Nstate];
         for (int i = 0; i < Nstate; i++) { ptrQ[i] = new double[Nstate]; }
@@ -54,14 +97,34 @@ void SubMatrix::Create() {
     }
 
     UniMu = 1;
-    mPow = new double **[UniSubNmax];
-    for (int n = 0; n < UniSubNmax; n++) { mPow[n] = nullptr; }
+    Npad = PropagationKernels::GetPaddedSize(Nstate);
+    vpad = AlignedZeros(Npad);
+    densestorage = false;
+    AllocateDenseStorage();
+
+    logQ = nullptr;
+    logflagarray = nullptr;
+    logStationary = nullptr;
+    logstatflag = false;
 
     flagarray = new bool[Nstate];
     diagflag = false;
     statflag = false;
     for (int i = 0; i < Nstate; i++) { flagarray[i] = false; }
     powflag = false;
+    npow = 0;
+    powtable = nullptr;
+
+    backuppending = false;
+    backupvalid = false;
+    bkflagarray = nullptr;
+    bksparseQ = nullptr;
+    bklogQ = nullptr;
+    bklogflagarray = nullptr;
+    bklogStationary = nullptr;
+    bkucol = nullptr;
+    bkinvucol = nullptr;
+    bkvpad = nullptr;
 }
 
 // ---------------------------------------------------------------------------
@@ -69,16 +132,191 @@ void SubMatrix::Create() {
 // ---------------------------------------------------------------------------
 
 SubMatrix::~SubMatrix() {
-    if (mPow != nullptr) {
-        for (int n = 0; n < UniSubNmax; n++) {
-            if (mPow[n] != nullptr) {
-                for (int i = 0; i < Nstate; i++) { delete[] mPow[n][i]; }
-                delete[] mPow[n];
-            }
+    ReleaseDenseStorage();
+    FreeBackup();
+    delete[] flagarray;
+    delete[] logStationary;
+    free(vpad);
+}
+
+// ---------------------------------------------------------------------------
+//     Dense storage
+// ---------------------------------------------------------------------------
+
+void SubMatrix::AllocateDenseStorage() const {
+    Q = EMatrix::Zero(Nstate, Nstate);
+    u = EMatrix(Nstate, Nstate);
+    invu = EMatrix(Nstate, Nstate);
+    ucol = AlignedZeros(Npad * Npad);
+    invucol = AlignedZeros(Npad * Npad);
+    if (sparsestart != nullptr) { sparseQ = new double[sparsestart[Nstate]]; }
+    densestorage = true;
+}
+
+void SubMatrix::SetSparseStructure(const int *rowstart, const int *col) {
+    sparsestart = rowstart;
+    sparsecol = col;
+    if (densestorage && (sparseQ == nullptr)) { sparseQ = new double[sparsestart[Nstate]]; }
+}
+
+void SubMatrix::ReleaseDenseStorage() {
+    if (!densestorage) { return; }
+    FreeBackup();
+    InactivatePowers();
+    free(ucol);
+    free(invucol);
+    ucol = nullptr;
+    invucol = nullptr;
+    delete[] sparseQ;
+    sparseQ = nullptr;
+    delete[] jumpprob;
+    delete[] jumpalias;
+    delete[] jumpwork;
+    jumpprob = nullptr;
+    jumpalias = nullptr;
+    jumpwork = nullptr;
+    jumpflag = false;
+    delete[] logQ;
+    delete[] logflagarray;
+    logQ = nullptr;
+    logflagarray = nullptr;
+    Q.resize(0, 0);
+    u.resize(0, 0);
+    invu.resize(0, 0);
+    solver = Eigen::EigenSolver<EMatrix>();
+    diagflag = false;
+    for (int k = 0; k < Nstate; k++) { flagarray[k] = false; }
+    densestorage = false;
+}
+
+// ---------------------------------------------------------------------------
+//     Backup and restore
+// ---------------------------------------------------------------------------
+
+void SubMatrix::Backup() {
+    // nothing worth saving if the dense arrays are not allocated
+    backuppending = densestorage;
+    backupvalid = false;
+    if (bkflagarray != nullptr) { bkdiagflag = false; }
+}
+
+void SubMatrix::Restore() {
+    if (backupvalid) {
+        SwapBackup();
+        InactivatePowers();
+        InactivateJumpTables();
+        backupvalid = false;
+    } else if (!backuppending) {
+        CorruptMatrix();
+    }
+    // else: not corrupted since the call to Backup, nothing to restore
+    backuppending = false;
+}
+
+void SubMatrix::SwapBackup() {
+    if (bkflagarray == nullptr) {
+        bkflagarray = new bool[Nstate];
+        for (int k = 0; k < Nstate; k++) { bkflagarray[k] = false; }
+        bkstatflag = false;
+        bkdiagflag = false;
+        bkversion = 0;
+        bkQ = EMatrix::Zero(Nstate, Nstate);
+        if (sparsestart != nullptr) { bksparseQ = new double[sparsestart[Nstate]]; }
+        bkStationary = EVector::Zero(Nstate);
+        bklogstatflag = false;
+    }
+    std::swap(flagarray, bkflagarray);
+    std::swap(statflag, bkstatflag);
+    std::swap(version, bkversion);
+    Q.swap(bkQ);
+    std::swap(sparseQ, bksparseQ);
+    mStationary.swap(bkStationary);
+    std::swap(logQ, bklogQ);
+    std::swap(logflagarray, bklogflagarray);
+    std::swap(logStationary, bklogStationary);
+    std::swap(logstatflag, bklogstatflag);
+
+    // the eigen arrays are exchanged only if one of the two states is diagonalised
+    if (diagflag || bkdiagflag) {
+        if (bkucol == nullptr) {
+            bku = EMatrix(Nstate, Nstate);
+            bkinvu = EMatrix(Nstate, Nstate);
+            bkv = EVector(Nstate);
+            bkvi = EVector(Nstate);
+            bkucol = AlignedZeros(Npad * Npad);
+            bkinvucol = AlignedZeros(Npad * Npad);
+            bkvpad = AlignedZeros(Npad);
         }
-        delete[] mPow;
+        std::swap(diagflag, bkdiagflag);
+        u.swap(bku);
+        invu.swap(bkinvu);
+        v.swap(bkv);
+        vi.swap(bkvi);
+        std::swap(ucol, bkucol);
+        std::swap(invucol, bkinvucol);
+        std::swap(vpad, bkvpad);
     }
-    delete[] flagarray;
+}
+
+void SubMatrix::FreeBackup() {
+    if (bkflagarray == nullptr) { return; }
+    delete[] bkflagarray;
+    delete[] bksparseQ;
+    delete[] bklogQ;
+    delete[] bklogflagarray;
+    delete[] bklogStationary;
+    free(bkucol);
+    free(bkinvucol);
+    free(bkvpad);
+    bkflagarray = nullptr;
+    bksparseQ = nullptr;
+    bklogQ = nullptr;
+    bklogflagarray = nullptr;
+    bklogStationary = nullptr;
+    bkucol = nullptr;
+    bkinvucol = nullptr;
+    bkvpad = nullptr;
+    bkQ.resize(0, 0);
+    bkStationary.resize(0);
+    bku.resize(0, 0);
+    bkinvu.resize(0, 0);
+    backuppending = false;
+    backupvalid = false;
+}
+
+// ---------------------------------------------------------------------------
+//     Log rates
+// ---------------------------------------------------------------------------
+
+void SubMatrix::UpdateLogRow(int state) const {
+    if (logQ == nullptr) {
+        logQ = new double[Nstate * Nstate];
+        logflagarray = new bool[Nstate];
+        for (int k = 0; k < Nstate; k++) { logflagarray[k] = false; }
+    }
+    if (!flagarray[state]) { UpdateRow(state); }
+    double *logrow = logQ + state * Nstate;
+    if (sparsestart != nullptr) {
+        for (int j = 0; j < Nstate; j++) { logrow[j] = -std::numeric_limits<double>::infinity(); }
+        const double *row = sparseQ + sparsestart[state];
+        const int *col = sparsecol + sparsestart[state];
+        for (int k = 0; k < GetNnonzero(state); k++) {
+            if (row[k] > 0) { logrow[col[k]] = log(row[k]); }
+        }
+    } else {
+        for (int j = 0; j < Nstate; j++) {
+            double q = Q(state, j);
+            logrow[j] = (q > 0) ? log(q) : -std::numeric_limits<double>::infinity();
+        }
+    }
+    logflagarray[state] = true;
+}
+
+void SubMatrix::UpdateLogStationary() const {
+    if (logStationary == nullptr) { logStationary = new double[Nstate]; }
+    const EVector &stat = GetStationary();
+    for (int i = 0; i < Nstate; i++) { logStationary[i] = log(stat[i]); }
+    logstatflag = true;
 }
 
 // ---------------------------------------------------------------------------
@@ -89,8 +327,10 @@ void SubMatrix::ScalarMul(double e) {
     for (int i = 0; i < Nstate; i++) {
         v[i] *= e;
         vi[i] *= e;
+        vpad[i] = v[i];
     }
     UniMu *= e;
+    version = nversion++;
 }
 
 // ---------------------------------------------------------------------------
@@ -109,33 +349,84 @@ int SubMatrix::Diagonalise() const {
 int SubMatrix::EigenDiagonalise() const {
     if (!ArrayUpdated()) { UpdateMatrix(); }
 
-    diagcount++;
+    int count = diagcount++;
     auto &stat = GetStationary();
 
-    EMatrix a(Nstate, Nstate);
-
+    // symmetrized matrix: a = D^{1/2} Q D^{-1/2}, with D = diag(stat),
+    // symmetric if and only if Q is reversible
+    thread_local EMatrix a;
+    a.resize(Nstate, Nstate);
+    double maxa = 0;
+    for (int i = 0; i < Nstate; i++) {
+        for (int j = 0; j < Nstate; j++) {
+            a(i, j) = Q(i, j) * sqrt(stat[i] / stat[j]);
+            if (maxa < fabs(a(i, j))) { maxa = fabs(a(i, j)); }
+        }
+    }
+    double maxasym = 0;
     for (int i = 0; i < Nstate; i++) {
-        for (int j = 0; j < Nstate; j++) { a(i, j) = Q(i, j) * sqrt(stat[i] / stat[j]); }
+        for (int j = 0; j < i; j++) {
+            double tmp = fabs(a(i, j) - a(j, i));
+            if (maxasym < tmp) { maxasym = tmp; }
+        }
     }
 
-    solver.compute(a);
-    v = solver.eigenvalues().real();
-    vi = solver.eigenvalues().imag();
-    u = solver.eigenvectors().real();
+    if (maxasym <= ReversibilityTolerance * maxa) {
+        // reversible: tridiagonalization followed by implicit symmetric QR
+        // (eigenvalues are real, eigenvectors are orthonormal)
+        thread_local Eigen::SelfAdjointEigenSolver<EMatrix> symsolver;
+        symsolver.compute(a);
+        v = symsolver.eigenvalues();
+        vi.setZero();
+        u = symsolver.eigenvectors();
 
-    for (int i = 0; i < Nstate; i++) {
-        for (int j = 0; j < Nstate; j++) { invu(i, j) = u(j, i) * sqrt(stat[j]); }
-    }
-    for (int i = 0; i < Nstate; i++) {
-        for (int j = 0; j < Nstate; j++) { u(i, j) /= sqrt(stat[i]); }
+        for (int i = 0; i < Nstate; i++) {
+            for (int j = 0; j < Nstate; j++) { invu(i, j) = u(j, i) * sqrt(stat[j]); }
+        }
+        for (int i = 0; i < Nstate; i++) {
+            for (int j = 0; j < Nstate; j++) { u(i, j) /= sqrt(stat[i]); }
+        }
+    } else {
+        // not reversible: general solver, on Q itself
+        ngeneraldiag++;
+        solver.compute(Q);
+        v = solver.eigenvalues().real();
+        vi = solver.eigenvalues().imag();
+        u = solver.eigenvectors().real();
+        invu = u.inverse();
     }
 
+    UpdatePaddedEigen();
+
     diagflag = true;
-    double err = CheckDiag();
-    if (diagerr < err) { diagerr = err; }
+    if (diagcheckperiod && !(count % diagcheckperiod)) {
+        double err = CheckDiag();
+        std::lock_guard<std::mutex> lock(diagmutex);
+        if (diagerr < err) { diagerr = err; }
+    }
     return 0;
 }
 
+void SubMatrix::UpdateDiagonalisations(const std::vector<const SubMatrix *> &matrices) {
+    std::vector<const SubMatrix *> dirty;
+    for (auto matrix : matrices) {
+        if (!matrix->diagflag) { dirty.push_back(matrix); }
+    }
+    ThreadPool::ParallelFor(dirty.size(), ThreadPool::GetNthreads(),
+        [&dirty](int i, int) { dirty[i]->Diagonalise(); });
+}
+
+void SubMatrix::UpdatePaddedEigen() const {
+    // padding entries are zero from construction and never written
+    for (int j = 0; j < Nstate; j++) {
+        for (int i = 0; i < Nstate; i++) {
+            ucol[j * Npad + i] = u(i, j);
+            invucol[j * Npad + i] = invu(i, j);
+        }
+    }
+    for (int i = 0; i < Nstate; i++) { vpad[i] = v[i]; }
+}
+
 double SubMatrix::CheckDiag() const {
     EMatrix tmp(Nstate, Nstate);
     EMatrix D(Nstate, Nstate);
@@ -159,11 +450,25 @@ double SubMatrix::CheckDiag() const {
     return max;
 }
 
+void SubMatrix::GetFiniteTimeTransitionMatrix(double efflength, double *P) const {
+    if (!diagflag) { Diagonalise(); }
+    double *scratch = ScratchMemory::Get(ScratchMemory::TRANSITIONMATRIX, Nstate * (Nstate + 1));
+    Eigen::Map<EVector> expv(scratch, Nstate);
+    for (int k = 0; k < Nstate; k++) { expv[k] = exp(efflength * v[k]); }
+    // explicit temporary for u * diag(expv), so that Eigen does not allocate one
+    Eigen::Map<EMatrix> tmp(scratch + Nstate, Nstate, Nstate);
+    tmp.noalias() = u * expv.asDiagonal();
+    Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> p(
+        P, Nstate, Nstate);
+    p.noalias() = tmp * invu;
+}
+
 // ---------------------------------------------------------------------------
 //     ComputeRate()
 // ---------------------------------------------------------------------------
 
 double SubMatrix::GetRate() const {
+    if (!densestorage) { AllocateDenseStorage(); }
     if (!ArrayUpdated()) {
         UpdateStationary();
         for (int k = 0; k < Nstate; k++) { ComputeArray(k); }
@@ -181,6 +486,7 @@ double SubMatrix::GetRate() const {
 // ---------------------------------------------------------------------------
 
 void SubMatrix::UpdateMatrix() const {
+    if (!densestorage) { AllocateDenseStorage(); }
     UpdateStationary();
     for (int k = 0; k < Nstate; k++) { ComputeArray(k); }
     for (int k = 0; k < Nstate; k++) { flagarray[k] = true; }
@@ -196,6 +502,9 @@ void SubMatrix::Normalise() const {
     for (int i = 0; i < Nstate; i++) {
         for (int j = 0; j < Nstate; j++) { Q(i, j) /= norm; }
     }
+    if (sparsestart != nullptr) {
+        for (int k = 0; k < sparsestart[Nstate]; k++) { sparseQ[k] /= norm; }
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -205,6 +514,7 @@ void SubMatrix::Normalise() const {
 // ---------------------------------------------------------------------------
 
 void SubMatrix::ActivatePowers() const {
+    std::lock_guard<std::mutex> lock(powmutex);
     if (!powflag) {
         if (!ArrayUpdated()) { UpdateMatrix(); }
 
@@ -213,17 +523,15 @@ void SubMatrix::ActivatePowers() const {
             if (UniMu < fabs(Q(i, i))) { UniMu = fabs(Q(i, i)); }
         }
 
-        CreatePowers(0);
-        for (int i = 0; i < Nstate; i++) {
-            for (int j = 0; j < Nstate; j++) { mPow[0][i][j] = 0; }
-        }
-        for (int i = 0; i < Nstate; i++) { mPow[0][i][i] = 1; }
+        // the uniformized matrix R = I + Q / UniMu
+        AllocatePower(0);
+        double *R = powtable[0];
         for (int i = 0; i < Nstate; i++) {
             for (int j = 0; j < Nstate; j++) {
-                mPow[0][i][j] += Q(i, j) / UniMu;
-                if (mPow[0][i][j] < 0) {
+                R[i * Nstate + j] = (i == j) + Q(i, j) / UniMu;
+                if (R[i * Nstate + j] < 0) {
                     cerr << "error in SubMatrix::ComputePowers: negative prob : ";
-                    cerr << i << '\t' << j << '\t' << mPow[0][i][j] << '\n';
+                    cerr << i << '\t' << j << '\t' << R[i * Nstate + j] << '\n';
                     cerr << "Nstate : " << Nstate << '\n';
                     exit(1);
                 }
@@ -236,26 +544,132 @@ void SubMatrix::ActivatePowers() const {
 
 void SubMatrix::InactivatePowers() const {
     if (powflag) {
-        for (int n = 0; n < UniSubNmax; n++) {
-            if (mPow[n] != nullptr) {
-                for (int i = 0; i < Nstate; i++) { delete[] mPow[n][i]; }
-                delete[] mPow[n];
-                mPow[n] = nullptr;
-            }
-        }
         nunimax += npow;
         nuni++;
 
+        // the blocks go to the pool, for the next powers of this or other
+        // matrices
+        std::lock_guard<std::mutex> lock(powmutex);
+        std::vector<double *> &pool = powpool[Nstate * Nstate];
+        for (int n = 0; n < npow; n++) { pool.push_back(powtable[n]); }
+        size_t size = npow * Nstate * Nstate * sizeof(double);
+        powcachesize -= size + UniSubNmax * sizeof(double *);
+        powpoolsize += size;
+        delete[] powtable;
+        powtable = nullptr;
+
         npow = 0;
         powflag = false;
     }
 }
 
-void SubMatrix::CreatePowers(int n) const {
-    if (mPow[n] == nullptr) {
-        mPow[n] = new double *[Nstate];
-        for (int i = 0; i < Nstate; i++) { mPow[n][i] = new double[Nstate]; }
+void SubMatrix::AllocatePower(int n) const {
+    if (powtable == nullptr) {
+        powtable = new double *[UniSubNmax];
+        powcachesize += UniSubNmax * sizeof(double *);
+    }
+    size_t size = Nstate * Nstate * sizeof(double);
+    std::vector<double *> &pool = powpool[Nstate * Nstate];
+    if (pool.empty()) {
+        powtable[n] = new double[Nstate * Nstate];
+    } else {
+        powtable[n] = pool.back();
+        pool.pop_back();
+        powpoolsize -= size;
+    }
+    powcachesize += size;
+}
+
+void SubMatrix::FreePowerPool(size_t maxpoolsize) {
+    std::lock_guard<std::mutex> lock(powmutex);
+    for (auto &pool : powpool) {
+        size_t size = pool.first * sizeof(double);
+        while ((powpoolsize > maxpoolsize) && !pool.second.empty()) {
+            delete[] pool.second.back();
+            pool.second.pop_back();
+            powpoolsize -= size;
+        }
+    }
+}
+
+void SubMatrix::TrimPowerCaches(const std::vector<const SubMatrix *> &matrices, size_t maxsize) {
+    // the memory kept for future powers goes first, then the powers themselves
+    auto room = [maxsize]() { return maxsize - std::min<size_t>(maxsize, powcachesize); };
+    FreePowerPool(room());
+    for (const SubMatrix *matrix : matrices) {
+        if (powcachesize + powpoolsize <= maxsize) { break; }
+        matrix->ReleasePowers();
+        FreePowerPool(room());
+    }
+}
+
+// ---------------------------------------------------------------------------
+//     Jump tables
+// ---------------------------------------------------------------------------
+
+void SubMatrix::ActivateJumpTables() const {
+    std::lock_guard<std::mutex> lock(jumpmutex);
+    if (jumpflag) { return; }
+    if (!ArrayUpdated()) { UpdateMatrix(); }
+
+    bool sparse = UseSparse();
+    if ((jumpprob != nullptr) && (sparse != jumpsparse)) {
+        delete[] jumpprob;
+        delete[] jumpalias;
+        jumpprob = nullptr;
+        jumpalias = nullptr;
+    }
+    jumpsparse = sparse;
+    if (jumpprob == nullptr) {
+        int size = jumpsparse ? sparsestart[Nstate] : Nstate * Nstate;
+        jumpprob = new double[size];
+        jumpalias = new int[size];
+    }
+    if (jumpwork == nullptr) { jumpwork = new int[2 * Nstate]; }
+
+    for (int i = 0; i < Nstate; i++) {
+        int offset = jumpsparse ? sparsestart[i] : i * Nstate;
+        int n = jumpsparse ? GetNnonzero(i) : Nstate;
+        double *prob = jumpprob + offset;
+        int *alias = jumpalias + offset;
+
+        // probabilities scaled by n (mean 1), the diagonal being left out
+        double total = -Q(i, i);
+        for (int k = 0; k < n; k++) {
+            int j = jumpsparse ? sparsecol[offset + k] : k;
+            double rate = jumpsparse ? sparseQ[offset + k] : ((j == i) ? 0 : Q(i, j));
+            prob[k] = rate * n / total;
+            alias[k] = k;
+        }
+
+        // Vose's method: entries below 1 are topped up by entries above 1
+        int *small = jumpwork;
+        int *large = jumpwork + Nstate;
+        int nsmall = 0;
+        int nlarge = 0;
+        for (int k = 0; k < n; k++) {
+            if (prob[k] < 1) {
+                small[nsmall++] = k;
+            } else {
+                large[nlarge++] = k;
+            }
+        }
+        while (nsmall && nlarge) {
+            int s = small[--nsmall];
+            int l = large[--nlarge];
+            alias[s] = l;
+            prob[l] -= 1 - prob[s];
+            if (prob[l] < 1) {
+                small[nsmall++] = l;
+            } else {
+                large[nlarge++] = l;
+            }
+        }
+        // what remains is 1 up to rounding errors
+        while (nlarge) { prob[large[--nlarge]] = 1; }
+        while (nsmall) { prob[small[--nsmall]] = 1; }
     }
+    jumpflag = true;
 }
 
 double SubMatrix::GetUniformizationMu() const {
@@ -268,22 +682,42 @@ double SubMatrix::Power(int n, int i, int j) const {
     if (n == 0) { return static_cast<double>(i == j); }
     if (n > UniSubNmax) { return Stationary(j); }
     if (n > npow) { ComputePowers(n); }
-    return mPow[n - 1][i][j];
+    return powtable[n - 1][i * Nstate + j];
 }
 
 void SubMatrix::ComputePowers(int N) const {
     if (!powflag) { ActivatePowers(); }
+    std::lock_guard<std::mutex> lock(powmutex);
     if (N > npow) {
+        // R, the uniformized matrix, is the first power
+        const double *R = powtable[0];
         for (int n = npow; n < N; n++) {
-            CreatePowers(n);
-            for (int i = 0; i < Nstate; i++) {
-                for (int j = 0; j < Nstate; j++) {
-                    double &t = mPow[n][i][j];
-                    t = 0;
-                    for (int k = 0; k < Nstate; k++) { t += mPow[n - 1][i][k] * mPow[0][k][j]; }
+            AllocatePower(n);
+            const double *prev = powtable[n - 1];
+            double *next = powtable[n];
+            if (UseSparse()) {
+                // R^(n+1) = R * R^n: row i is a combination of row i and of
+                // the rows of the neighbors of i of the previous power
+                for (int i = 0; i < Nstate; i++) {
+                    double *row = next + i * Nstate;
+                    double r = R[i * Nstate + i];
+                    const double *prevrow = prev + i * Nstate;
+                    for (int j = 0; j < Nstate; j++) { row[j] = r * prevrow[j]; }
+                    const int *col = GetSparseColumns(i);
+                    for (int k = 0; k < GetNnonzero(i); k++) {
+                        prevrow = prev + col[k] * Nstate;
+                        r = R[i * Nstate + col[k]];
+                        for (int j = 0; j < Nstate; j++) { row[j] += r * prevrow[j]; }
+                    }
                 }
+            } else {
+                // R^(n+1) = R^n * R, as a (blocked, vectorized) matrix product
+                RowMajorMatrixMap(next, Nstate, Nstate).noalias() =
+                    ConstRowMajorMatrixMap(prev, Nstate, Nstate) *
+                    ConstRowMajorMatrixMap(R, Nstate, Nstate);
             }
         }
+        // only now visible to readers not holding the lock (see Power)
         npow = N;
     }
 }
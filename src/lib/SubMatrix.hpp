@@ -1,10 +1,17 @@
 #pragma once
 
 // #include "Eigen/Dense"
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "PropagationKernels.hpp"
 #include "Random.hpp"
+#include "ScratchMemory.hpp"
 
 // using EMatrix = Eigen::MatrixXd;
 // using EVector = Eigen::VectorXd;
@@ -23,6 +30,11 @@
  * ComputeArray(int s), which is in charge of computing row s of the rate
  * matrix, and ComputeStationary(), which should calculate the equilbrium
  * frequencies of the process.
+ *
+ * Once UpdateDiagonalisation has been called, all const methods can be
+ * called concurrently from several threads (the powers of the uniformized
+ * matrix and the jump tables, which are computed lazily, being protected by a
+ * mutex).
  */
 
 class SubMatrix {
@@ -35,8 +47,9 @@ class SubMatrix {
     //! const access to entry at ith row and jth column (checked for current
     //! update status, see UpdateMatrix)
     double operator()(int /*i*/, int /*j*/) const;
-    //! const access to a row of the matrix (checked for current update status)
-    EVector GetRow(int i) const;
+    //! const access to a row of the matrix (checked for current update status),
+    //! as a view into the matrix (valid until the rates change)
+    EMatrix::ConstRowXpr GetRow(int i) const;
 
     //! const access to equilbrium frequency of state i (checked for current
     //! update status)
@@ -46,9 +59,57 @@ class SubMatrix {
     //! status)
     const EVector &GetStationary() const;
 
+    //! \brief log of the rates away from state i (row i of log Q, with -inf
+    //! for null rates), as an array of Nstate doubles
+    //!
+    //! Log rows are cached: each is computed on first access after the rates
+    //! have changed (see CorruptMatrix), with one log per non-null rate, and
+    //! then reused by all subsequent calls (typically, the many evaluations of
+    //! PathSuffStat::GetLogProb done by MCMC moves on the parameters of the
+    //! matrix). The diagonal entry of the array is meaningless. As for the
+    //! rows of Q, the cache is filled lazily, and should thus not be accessed
+    //! concurrently from several threads.
+    const double *GetLogRow(int i) const;
+
+    //! log of the rate from state i to state j (i != j), see GetLogRow
+    double LogRate(int i, int j) const { return GetLogRow(i)[j]; }
+
+    //! log of equilibrium frequencies (cached, see GetLogRow)
+    const double *GetLogStationary() const;
+
     //! dimension of the statespace
     int GetNstate() const { return Nstate; }
 
+    //! \brief whether the generator has a sparse structure (see SetSparseStructure)
+    //!
+    //! Sparse matrices (typically, codon matrices, with at most 9 non-null
+    //! off-diagonal rates per row, see CodonSubMatrix) also store the non-null
+    //! rates of each row contiguously, in compressed sparse row (CSR) format,
+    //! which is what the samplers of substitution histories use (DrawOneStep,
+    //! DrawUniformizedTransition, powers of the uniformized matrix).
+    bool IsSparse() const { return sparsestart != nullptr; }
+
+    //! number of non-null off-diagonal rates of row i (sparse matrices only)
+    int GetNnonzero(int i) const { return sparsestart[i + 1] - sparsestart[i]; }
+
+    //! columns of the non-null off-diagonal rates of row i, in increasing order
+    //! (sparse matrices only)
+    const int *GetSparseColumns(int i) const { return sparsecol + sparsestart[i]; }
+
+    //! non-null off-diagonal rates of row i, toward the states given by
+    //! GetSparseColumns(i) (sparse matrices only; checked for current update
+    //! status)
+    const double *GetSparseRow(int i) const;
+
+    //! \brief whether the samplers use the sparse structure of the matrices (true
+    //! by default)
+    //!
+    //! Both give the same distributions; dense sampling is only kept for
+    //! comparison (see resamplesubbench). Should not be changed while
+    //! substitution histories are being sampled.
+    static void SetSparseSampling(bool in) { sparsesampling = in; }
+    static bool GetSparseSampling() { return sparsesampling; }
+
     //! compute the row of the generator corresponding to rates away from given
     //! state (should be defined in derived classes)
     virtual void ComputeArray(int state) const = 0;
@@ -74,6 +135,91 @@ class SubMatrix {
     //! all dependent variables
     virtual void CorruptMatrix();
 
+    //! \brief return the version of the matrix
+    //!
+    //! Versions are unique across all matrices of the program: a new version
+    //! is given at construction and each time the rates are changed
+    //! (CorruptMatrix, ScalarMul). Quantities derived from the matrix (e.g.
+    //! transition matrices stored in a TransitionMatrixCache) can thus be
+    //! identified by the version of the matrix.
+    uint64_t GetVersion() const { return version; }
+
+    //! \brief free the dense arrays of the matrix (rates, eigen decomposition,
+    //! powers of the uniformized matrix and log rates)
+    //!
+    //! The arrays are reallocated, and their content recomputed, on next
+    //! access, so that this changes nothing from the point of view of the
+    //! caller, except for memory and computation time (and the version of the
+    //! matrix is kept). Meant for large arrays of matrices only a fraction of
+    //! which is needed at a time (see MutSelNeCodonMatrixBidimArray); should not
+    //! be called concurrently with other accesses to the matrix, nor after
+    //! ScalarMul.
+    void ReleaseDenseStorage();
+
+    //! whether the dense arrays of the matrix are currently allocated
+    bool HasDenseStorage() const { return densestorage; }
+
+    //! \brief free the powers of the uniformized matrix cached for sampling
+    //! substitution histories (see DrawUniformizedTransition)
+    //!
+    //! They are recomputed on next use. As when the rates change, their memory
+    //! is kept for the powers of other matrices of the same size (see
+    //! FreePowerPool). Should not be called concurrently with other accesses to
+    //! the matrix.
+    void ReleasePowers() const { InactivatePowers(); }
+
+    //! number of powers of the uniformized matrix currently cached
+    int GetNpower() const { return npow; }
+
+    //! total size (in bytes) of the powers cached by all matrices
+    static size_t GetPowerCacheSize() { return powcachesize; }
+
+    //! total size (in bytes) of the memory kept for future powers (see
+    //! FreePowerPool)
+    static size_t GetPowerPoolSize() { return powpoolsize; }
+
+    //! \brief return the memory kept for future powers to the system, until
+    //! at most maxpoolsize bytes are left
+    //!
+    //! The memory of the powers of a matrix is recycled for the next powers
+    //! (of any matrix of the same size) when its rates change, rather than
+    //! freed, so that it is not given back to the system and faulted in again
+    //! at each cycle of an MCMC.
+    static void FreePowerPool(size_t maxpoolsize = 0);
+
+    //! \brief bring the memory taken by the powers of all matrices
+    //! (GetPowerCacheSize() + GetPowerPoolSize()) down to maxsize, if possible
+    //!
+    //! The memory kept for future powers is freed first, and then the cached
+    //! powers of the given matrices, in that order (e.g. least recently used
+    //! first). Should not be called concurrently with other accesses to the
+    //! matrices.
+    static void TrimPowerCaches(const std::vector<const SubMatrix *> &matrices, size_t maxsize);
+
+    //! whether the dense arrays hold values computed for the current rates (some
+    //! rows, or the eigen decomposition), as opposed to values that would have
+    //! to be recomputed anyway on next access
+    bool HasDenseContent() const;
+
+    //! \brief save the current state of the matrix, to be brought back by
+    //! Restore if the change of parameters that follows is rejected (typically,
+    //! in an MH move)
+    //!
+    //! Nothing is copied: the next call to CorruptMatrix sets the current rates,
+    //! equilibrium frequencies, log caches and eigen decomposition aside, in
+    //! exchange for a second set of arrays (allocated on first use), which is
+    //! then filled lazily as usual; Restore exchanges them again. The saved
+    //! state is discarded by the next call to Backup, or by ReleaseDenseStorage.
+    void Backup();
+
+    //! \brief return to the state saved by Backup, once the parameters of the
+    //! matrix have been set back to their values at that time by the caller
+    //!
+    //! Whatever had been computed at the time of Backup (rows, equilibrium
+    //! frequencies, eigen decomposition) is available again without
+    //! recomputation, and the matrix gets its former version back.
+    virtual void Restore();
+
     //! \brief recalculate all rates and dependent variables
     //!
     //! access to rates, equilibrium frequencies or exponentiation/diagonalisation
@@ -86,6 +232,39 @@ class SubMatrix {
     //! update flags.
     void UpdateMatrix() const;
 
+    //! recalculate rates, equilibrium frequencies and diagonalisation if
+    //! needed, such that all subsequent const accesses are read-only (and can
+    //! thus be done concurrently, see PhyloProcess)
+    void UpdateDiagonalisation() const {
+        if (!diagflag) { Diagonalise(); }
+    }
+
+    //! \brief UpdateDiagonalisation for a batch of matrices, in parallel (see
+    //! ThreadPool)
+    //!
+    //! Matrices already diagonalised are skipped. Each matrix is diagonalised on
+    //! its own, so that the results do not depend on the number of threads.
+    //! Dependencies shared by several matrices (e.g. the nucleotide matrix of
+    //! codon matrices) are not updated lazily here, and should thus be up to
+    //! date beforehand (see UpdateMatrix).
+    static void UpdateDiagonalisations(const std::vector<const SubMatrix *> &matrices);
+
+    //! \brief check the accuracy of one diagonalisation out of period
+    //!
+    //! The check (see GetMaxDiagError) costs about as much as the
+    //! diagonalisation itself; by default, it is done on every diagonalisation
+    //! in debug builds, and never otherwise. A period of 0 disables checks.
+    static void SetDiagCheckPeriod(int period) { diagcheckperiod = period; }
+
+    //! maximum error |U diag(v) U^{-1} - Q| over all checked diagonalisations
+    static double GetMaxDiagError() { return diagerr; }
+
+    //! total number of diagonalisations
+    static int GetNdiag() { return diagcount; }
+
+    //! number of diagonalisations of non-reversible matrices (general solver)
+    static int GetNgeneralDiag() { return ngeneraldiag; }
+
     //! a simple output stream function (mostly useful for tracing and debugging)
     virtual void ToStream(std::ostream &os) const;
 
@@ -103,6 +282,11 @@ class SubMatrix {
     //! return the transition probability between stateup and statedown along
     //! branch of efflength = length*rate
     double GetFiniteTimeTransitionProb(int stateup, int statedown, double efflength) const;
+
+    //! compute the whole matrix of finite time transition probabilities along a
+    //! branch of efflength=length*rate (stored row-wise in P, of size
+    //! Nstate*Nstate: P[i*Nstate+j] is the probability of going from i to j)
+    void GetFiniteTimeTransitionMatrix(double efflength, double *P) const;
     //! draw the uniformized number of transitions along the branch, conditional
     //! on begin and end states
     int DrawUniformizedSubstitutionNumber(int stateup, int statedown, double efflength) const;
@@ -110,7 +294,11 @@ class SubMatrix {
     //! number of events until reaching statedown is n
     int DrawUniformizedTransition(int state, int statedown, int n) const;
 
-    //! draw state of next event given current state
+    //! \brief draw state of next event given current state
+    //!
+    //! Done in constant time, with the alias tables of the jump chain (see
+    //! ActivateJumpTables), which all samplers of substitution histories go
+    //! through (DrawFiniteTime, PhyloProcess::ResampleAcceptReject, etc).
     int DrawOneStep(int state) const;
     //! draw state after total time, given current state
     int DrawFiniteTime(int state, double time) const;
@@ -121,20 +309,43 @@ class SubMatrix {
 
   protected:
     static const int UniSubNmax = 500;
-    static int nunisubcount;
+    static std::atomic<int> nunisubcount;
+    static std::atomic<uint64_t> nversion;
     static int GetUniSubCount() { return nunisubcount; }
 
     static int nuni;
     static int nunimax;
-    static int diagcount;
+    static std::atomic<int> diagcount;
+    static std::atomic<int> ngeneraldiag;
     static double diagerr;
+    static int diagcheckperiod;
+    static std::mutex diagmutex;
+
+    // maximum asymmetry of the symmetrized matrix (relative to its largest
+    // entry) for Q to be considered reversible
+    static constexpr double ReversibilityTolerance = 1e-10;
 
     static double GetMeanUni() { return ((double)nunimax) / nuni; }
 
+    static bool sparsesampling;
+
     void Create();
+    void AllocateDenseStorage() const;
 
     void ActivatePowers() const;
     void InactivatePowers() const;
+
+    //! \brief build the alias tables (Walker, 1977) of the jump chain: for
+    //! each state, the probabilities of the next state (proportional to the
+    //! rates away from it)
+    //!
+    //! The tables of a row have one entry per possible next state (non-null
+    //! rates of sparse matrices, all states otherwise): entry k is kept with
+    //! probability jumpprob[k], and replaced by jumpalias[k] otherwise, so that
+    //! drawing the next state takes one uniform random number. Built for all
+    //! rows at once, on first call to DrawOneStep after the rates have changed.
+    void ActivateJumpTables() const;
+    void InactivateJumpTables() const { jumpflag = false; }
     double Power(int n, int i, int j) const;
     double GetUniformizationMu() const;
 
@@ -148,29 +359,75 @@ class SubMatrix {
 
     void UpdateRow(int state) const;
     void UpdateStationary() const;
+    void UpdateLogRow(int state) const;
+    void UpdateLogStationary() const;
 
     void ComputePowers(int N) const;
-    void CreatePowers(int n) const;
+    // a block for power n+1, taken from the pool if possible (powmutex held)
+    void AllocatePower(int n) const;
 
     bool ArrayUpdated() const;
 
+    //! \brief declare the structure of the non-null off-diagonal rates, in CSR
+    //! format
+    //!
+    //! Row i has rowstart[i+1]-rowstart[i] non-null off-diagonal rates, toward
+    //! states col[rowstart[i]] ... (in increasing order). The arrays are not
+    //! copied (and are typically shared by all matrices over the same state
+    //! space, see CodonStateSpace::GetNeighborOffsets). ComputeArray(i) should
+    //! then fill sparseQ + rowstart[i], along with row i of Q.
+    void SetSparseStructure(const int *rowstart, const int *col);
+
+    bool UseSparse() const { return sparsesampling && (sparsestart != nullptr); }
+
+    // exchange the current state with the one set aside (see Backup)
+    void SwapBackup();
+    void FreeBackup();
+
     int Diagonalise() const;
     int EigenDiagonalise() const;
+    // copy u, invu and v into the padded, aligned arrays used by the
+    // propagation kernels (see PropagationKernels)
+    void UpdatePaddedEigen() const;
     int OldDiagonalise() const;
     double CheckDiag() const;
 
     // data members
 
-    mutable bool powflag;
+    mutable std::atomic<bool> powflag;
+    mutable bool densestorage;
     mutable bool diagflag;
     mutable bool statflag;
     mutable bool *flagarray;
 
     int Nstate;
-    mutable int npow;
+    uint64_t version;
+    mutable std::atomic<int> npow;
     mutable double UniMu;
 
-    double ***mPow;
+    // powers 1 ... npow of the uniformized matrix, each in one row-major
+    // block (powtable[n-1] for power n), computed on demand (see
+    // ComputePowers). The table (UniSubNmax entries) is allocated along with
+    // the first power, and blocks are never moved once computed, so that
+    // concurrent readers need no lock.
+    mutable double **powtable;
+    // protects the lazy computation of the powers, and the pool
+    static std::mutex powmutex;
+    // bytes taken by the powers of all matrices (blocks and tables)
+    static std::atomic<size_t> powcachesize;
+    // blocks of former powers, by number of entries, and their total size
+    static std::map<int, std::vector<double *>> powpool;
+    static std::atomic<size_t> powpoolsize;
+
+    // alias tables of the jump chain (see ActivateJumpTables), laid out as the
+    // sparse rates (jumpsparse) or as full rows, allocated on first use, and
+    // a workspace of 2*Nstate indices for building them
+    mutable std::atomic<bool> jumpflag;
+    mutable bool jumpsparse;
+    mutable double *jumpprob;
+    mutable int *jumpalias;
+    mutable int *jumpwork;
+    static std::mutex jumpmutex;
 
     // Q : the infinitesimal generator matrix
     mutable double **ptrQ;
@@ -180,6 +437,21 @@ class SubMatrix {
     mutable double *ptrStationary;
     mutable EVector mStationary;  // the stationary probabilities of the matrix
 
+    // CSR structure of the off-diagonal rates (null for dense matrices), and
+    // the rates themselves (sparseQ, allocated along with Q, see
+    // SetSparseStructure)
+    const int *sparsestart;
+    const int *sparsecol;
+    mutable double *sparseQ;
+
+    // cached logs of the rates (row-wise, Nstate*Nstate) and of the stationary
+    // probabilities, allocated on first use (see GetLogRow)
+    mutable double *logQ;
+    mutable bool *logflagarray;
+    mutable double *logStationary;
+    mutable bool logstatflag;
+
+    // general solver, for non-reversible matrices
     mutable Eigen::EigenSolver<EMatrix> solver;
 
     bool normalise;
@@ -197,7 +469,38 @@ class SubMatrix {
     mutable EVector v;     // v : eigenvalues
     mutable EVector vi;    // vi : imaginary part
 
+    // column-wise copies of u and invu, and copy of v, padded with zeros to
+    // Npad entries per column and aligned on 64 bytes (see PropagationKernels)
+    int Npad;
+    mutable double *ucol;
+    mutable double *invucol;
+    double *vpad;
+
     mutable int ndiagfailed;
+
+    // state set aside by CorruptMatrix after a call to Backup: arrays allocated
+    // on first use (bkflagarray != nullptr), and eigen arrays only once a
+    // diagonalised state has been set aside
+    bool backuppending;
+    bool backupvalid;
+    bool *bkflagarray;
+    bool bkstatflag;
+    bool bkdiagflag;
+    uint64_t bkversion;
+    EMatrix bkQ;
+    EVector bkStationary;
+    double *bksparseQ;
+    double *bklogQ;
+    bool *bklogflagarray;
+    double *bklogStationary;
+    bool bklogstatflag;
+    EMatrix bku;
+    EMatrix bkinvu;
+    EVector bkv;
+    EVector bkvi;
+    double *bkucol;
+    double *bkinvucol;
+    double *bkvpad;
 };
 
 //-------------------------------------------------------------------------
@@ -210,9 +513,9 @@ inline double SubMatrix::operator()(int i, int j) const {
     // return Q[i][j];
 }
 
-inline EVector SubMatrix::GetRow(int i) const {
+inline EMatrix::ConstRowXpr SubMatrix::GetRow(int i) const {
     if (!flagarray[i]) { UpdateRow(i); }
-    return Q.row(i);
+    return static_cast<const EMatrix &>(Q).row(i);
 }
 
 /*
@@ -224,6 +527,11 @@ inline const double *SubMatrix::GetRow(int i) const {
 }
 */
 
+inline const double *SubMatrix::GetSparseRow(int i) const {
+    if (!flagarray[i]) { UpdateRow(i); }
+    return sparseQ + sparsestart[i];
+}
+
 inline const EVector &SubMatrix::GetStationary() const {
     // inline const double *SubMatrix::GetStationary() const {
     if (!statflag) { UpdateStationary(); }
@@ -235,11 +543,39 @@ inline double SubMatrix::Stationary(int i) const {
     return mStationary[i];
 }
 
+inline const double *SubMatrix::GetLogRow(int i) const {
+    if ((logflagarray == nullptr) || (!logflagarray[i])) { UpdateLogRow(i); }
+    return logQ + i * Nstate;
+}
+
+inline const double *SubMatrix::GetLogStationary() const {
+    if (!logstatflag) { UpdateLogStationary(); }
+    return logStationary;
+}
+
 inline void SubMatrix::CorruptMatrix() {
+    if (backuppending) {
+        SwapBackup();
+        backuppending = false;
+        backupvalid = true;
+    }
+    version = nversion++;
     diagflag = false;
     statflag = false;
     for (int k = 0; k < Nstate; k++) { flagarray[k] = false; }
+    if (logflagarray != nullptr) {
+        for (int k = 0; k < Nstate; k++) { logflagarray[k] = false; }
+    }
+    logstatflag = false;
     InactivatePowers();
+    InactivateJumpTables();
+}
+
+inline bool SubMatrix::HasDenseContent() const {
+    if (!densestorage) { return false; }
+    bool ret = diagflag;
+    for (int k = 0; k < Nstate; k++) { ret |= flagarray[k]; }
+    return ret;
 }
 
 inline bool SubMatrix::ArrayUpdated() const {
@@ -254,6 +590,7 @@ inline void SubMatrix::UpdateStationary() const {
 }
 
 inline void SubMatrix::UpdateRow(int state) const {
+    if (!densestorage) { AllocateDenseStorage(); }
     if (isNormalised()) {
         UpdateMatrix();
     } else {
@@ -268,27 +605,9 @@ inline void SubMatrix::BackwardPropagate(const double *up, double *down, double
 
     int matSize = GetNstate();
 
-    auto aux = new double[GetNstate()];
-
-    for (int i = 0; i < GetNstate(); i++) { aux[i] = 0; }
-    for (int i = 0; i < GetNstate(); i++) {
-        for (int j = 0; j < GetNstate(); j++) {
-            aux[i] += invu(i, j) * up[j];
-            // aux[i] += invu[i][j] * up[j];
-        }
-    }
-
-    for (int i = 0; i < GetNstate(); i++) { aux[i] *= exp(length * v[i]); }
-
-    for (int i = 0; i < GetNstate(); i++) { down[i] = 0; }
-
-    for (int i = 0; i < GetNstate(); i++) {
-        for (int j = 0; j < GetNstate(); j++) {
-            down[i] += u(i, j) * aux[j];
-            // down[i] += u[i][j] * aux[j];
-        }
-    }
+    PropagationKernels::Backward(matSize, ucol, invucol, vpad, length, up, down);
 
+#ifndef NDEBUG
     for (int i = 0; i < GetNstate(); i++) {
         if (std::isnan(down[i])) {
             std::cerr << "error in back prop\n";
@@ -298,12 +617,14 @@ inline void SubMatrix::BackwardPropagate(const double *up, double *down, double
             exit(1);
         }
     }
-    double maxup = 0;
     for (int k = 0; k < matSize; k++) {
         if (up[k] < 0) {
             std::cerr << "error in backward propagate: negative prob : " << up[k] << "\n";
-            // down[k] = 0;
         }
+    }
+#endif
+    double maxup = 0;
+    for (int k = 0; k < matSize; k++) {
         if (maxup < up[k]) { maxup = up[k]; }
     }
     double max = 0;
@@ -322,36 +643,11 @@ inline void SubMatrix::BackwardPropagate(const double *up, double *down, double
         exit(1);
     }
     down[matSize] = up[matSize];
-
-    delete[] aux;
 }
 
 inline void SubMatrix::ForwardPropagate(const double *down, double *up, double length) const {
     if (!diagflag) { Diagonalise(); }
-
-    auto aux = new double[GetNstate()];
-
-    for (int i = 0; i < GetNstate(); i++) { aux[i] = 0; }
-
-    for (int i = 0; i < GetNstate(); i++) {
-        for (int j = 0; j < GetNstate(); j++) {
-            aux[i] += down[j] * u(j, i);
-            // aux[i] += down[j] * u[j][i];
-        }
-    }
-
-    for (int i = 0; i < GetNstate(); i++) { aux[i] *= exp(length * v[i]); }
-
-    for (int i = 0; i < GetNstate(); i++) { up[i] = 0; }
-
-    for (int i = 0; i < GetNstate(); i++) {
-        for (int j = 0; j < GetNstate(); j++) {
-            up[i] += aux[j] * invu(j, i);
-            // up[i] += aux[j] * invu[j][i];
-        }
-    }
-
-    delete[] aux;
+    PropagationKernels::Forward(GetNstate(), ucol, invucol, vpad, length, down, up);
 }
 
 inline double SubMatrix::GetFiniteTimeTransitionProb(
@@ -367,13 +663,12 @@ inline double SubMatrix::GetFiniteTimeTransitionProb(
 }
 
 inline void SubMatrix::GetFiniteTimeTransitionProb(int state, double *p, double efflength) const {
-    double *p1 = new double[GetNstate()];
+    double *p1 = ScratchMemory::Get(ScratchMemory::TRANSITIONPROB, GetNstate());
     for (int k = 0; k < GetNstate(); k++) { p1[k] = 0; }
     p1[state] = 1;
     ForwardPropagate(p1, p, efflength);
     double tot = 0;
     for (int k = 0; k < GetNstate(); k++) { tot += p[k]; }
-    delete[] p1;
     if (fabs(1 - tot) > 1e-4) {
         std::cerr << "error in forward propagate: normalization : " << tot << '\t' << fabs(1 - tot)
                   << '\n';
@@ -385,7 +680,30 @@ inline void SubMatrix::GetFiniteTimeTransitionProb(int state, double *p, double
 }
 
 inline int SubMatrix::DrawUniformizedTransition(int state, int statedown, int n) const {
-    double *p = new double[GetNstate()];
+    double *p = ScratchMemory::Get(ScratchMemory::UNIFORMIZED, GetNstate());
+    if (UseSparse()) {
+        // the only possible transitions are toward state itself and its
+        // neighbors, taken in increasing order (as in the dense case): the
+        // neighbors before state, state (at rank before), then the others
+        int nnz = GetNnonzero(state);
+        const int *col = GetSparseColumns(state);
+        int before = 0;
+        while ((before < nnz) && (col[before] < state)) { before++; }
+        double tot = 0;
+        for (int m = 0; m <= nnz; m++) {
+            int l = (m < before) ? col[m] : ((m == before) ? state : col[m - 1]);
+            tot += Power(1, state, l) * Power(n, l, statedown);
+            p[m] = tot;
+        }
+        double s = tot * Random::Uniform();
+        int m = 0;
+        while ((m <= nnz) && (s > p[m])) { m++; }
+        if (m > nnz) {
+            std::cerr << "error in DrawUniformizedTransition: overflow\n";
+            throw;
+        }
+        return (m < before) ? col[m] : ((m == before) ? state : col[m - 1]);
+    }
     double tot = 0;
     for (int l = 0; l < GetNstate(); l++) {
         tot += Power(1, state, l) * Power(n, l, statedown);
@@ -395,7 +713,6 @@ inline int SubMatrix::DrawUniformizedTransition(int state, int statedown, int n)
     double s = tot * Random::Uniform();
     int k = 0;
     while ((k < GetNstate()) && (s > p[k])) { k++; }
-    delete[] p;
     if (k == GetNstate()) {
         std::cerr << "error in DrawUniformizedTransition: overflow\n";
         throw;
@@ -446,28 +763,19 @@ inline int SubMatrix::DrawFiniteTime(int initstate, double time) const {
 }
 
 inline double SubMatrix::DrawWaitingTime(int state) const {
-    EVector row = GetRow(state);
-    // const double* row = GetRow(state);
-    double t = Random::sExpo() / (-row[state]);
+    double t = Random::sExpo() / (-(*this)(state, state));
     return t;
 }
 
 inline int SubMatrix::DrawOneStep(int state) const {
-    EVector row = GetRow(state);
-    double p = -row[state] * Random::Uniform();
-    int k = -1;
-    double tot = 0;
-    do {
-        k++;
-        if (k != state) { tot += row[k]; }
-    } while ((k < GetNstate()) && (tot < p));
-    if (k == GetNstate()) {
-        std::cerr << "error in DrawOneStep\n";
-        std::cerr << GetNstate() << '\n';
-        for (int k = 0; k < GetNstate(); k++) { std::cerr << row[k] << '\n'; }
-        exit(1);
-    }
-    return k;
+    if (!jumpflag) { ActivateJumpTables(); }
+    int offset = jumpsparse ? sparsestart[state] : state * Nstate;
+    int n = jumpsparse ? GetNnonzero(state) : Nstate;
+    double u = n * Random::Uniform();
+    int k = static_cast<int>(u);
+    if (k == n) { k--; }
+    if (u - k >= jumpprob[offset + k]) { k = jumpalias[offset + k]; }
+    return jumpsparse ? sparsecol[offset + k] : k;
 }
 
 inline int SubMatrix::DrawFromStationary() const {
@@ -0,0 +1,114 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include "Random.hpp"
+#include "global/logging.hpp"
+
+using namespace std;
+
+int ThreadPool::nthread = 1;
+thread_local int ThreadPool::threadindex = 0;
+thread_local bool ThreadPool::busy = false;
+
+vector<thread> ThreadPool::workers;
+mutex ThreadPool::mtx;
+condition_variable ThreadPool::startcond;
+condition_variable ThreadPool::donecond;
+
+const function<void(int, int)> *ThreadPool::job = nullptr;
+int ThreadPool::jobntask = 0;
+int ThreadPool::jobnthread = 0;
+int ThreadPool::generation = 0;
+int ThreadPool::ndone = 0;
+bool ThreadPool::stop = false;
+
+// -------------------------------------------------
+// workers should be joined before the static members above are destroyed
+// (or detached, if exit was called from within a worker)
+class threadpool_cleanup {
+  public:
+    ~threadpool_cleanup() {
+        if (ThreadPool::GetThreadIndex() == 0) {
+            ThreadPool::Stop();
+        } else {
+            for (auto &w : ThreadPool::workers) { w.detach(); }
+        }
+    }
+};
+
+static threadpool_cleanup cleanup;
+
+void ThreadPool::SetNthreads(int n) {
+    if (n < 1) { n = 1; }
+    if (n == nthread) { return; }
+    Stop();
+    Start(n);
+    INFO("Running on {} thread(s)", nthread);
+}
+
+void ThreadPool::Start(int n) {
+    nthread = n;
+    stop = false;
+    for (int thread = 1; thread < nthread; thread++) {
+        workers.emplace_back(Work, thread, generation, Random::GetSeed());
+    }
+}
+
+void ThreadPool::Stop() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stop = true;
+    }
+    startcond.notify_all();
+    for (auto &w : workers) { w.join(); }
+    workers.clear();
+    nthread = 1;
+}
+
+void ThreadPool::Work(int thread, int seen, int seed) {
+    threadindex = thread;
+    Random::InitThreadRandom(seed, thread);
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        startcond.wait(lock, [&seen] { return stop || (generation != seen); });
+        if (stop) { return; }
+        seen = generation;
+        if (thread < jobnthread) {
+            lock.unlock();
+            RunTasks(thread);
+            lock.lock();
+            ndone++;
+            if (ndone == jobnthread - 1) { donecond.notify_one(); }
+        }
+    }
+}
+
+void ThreadPool::RunTasks(int thread) {
+    busy = true;
+    for (int task = thread; task < jobntask; task += jobnthread) { (*job)(task, thread); }
+    busy = false;
+}
+
+void ThreadPool::ParallelFor(
+    int ntask, int maxthread, const function<void(int task, int thread)> &f) {
+    int n = min(min(nthread, maxthread), ntask);
+    if ((n <= 1) || busy) {
+        for (int task = 0; task < ntask; task++) { f(task, threadindex); }
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mtx);
+        job = &f;
+        jobntask = ntask;
+        jobnthread = n;
+        ndone = 0;
+        generation++;
+    }
+    startcond.notify_all();
+
+    RunTasks(0);
+
+    unique_lock<mutex> lock(mtx);
+    donecond.wait(lock, [] { return ndone == jobnthread - 1; });
+    job = nullptr;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief A process-wide pool of worker threads, for running independent tasks
+ * (typically, blocks of sites) in parallel
+ *
+ * The pool is sized once (SetNthreads), typically from the command line
+ * (--threads option), before models are created. ParallelFor then
+ * distributes tasks 0..ntask-1 over the calling thread (which acts as thread
+ * 0) and the workers (threads 1..nthread-1): thread t runs tasks t, t +
+ * nthread, t + 2*nthread, etc. This static schedule means that, for a given
+ * number of threads, the tasks run by each thread (and thus the random numbers
+ * drawn from the thread-specific random streams, see
+ * Random::InitThreadRandom) are reproducible across runs.
+ *
+ * With a single thread (the default), or when called from within a task,
+ * ParallelFor simply runs all tasks in order in the calling thread.
+ */
+
+class ThreadPool {
+  public:
+    friend class threadpool_cleanup;
+
+    //! set the total number of threads (including the main thread) -- should be
+    //! called from the main thread, outside of any parallel loop
+    static void SetNthreads(int n);
+
+    //! return the total number of threads (including the main thread)
+    static int GetNthreads() { return nthread; }
+
+    //! return the index of the calling thread (0 for the main thread, and
+    //! between 1 and GetNthreads()-1 for the workers)
+    static int GetThreadIndex() { return threadindex; }
+
+    //! run f(task, thread) for all tasks between 0 and ntask-1, using at most
+    //! maxthread threads, and return once all tasks are done
+    static void ParallelFor(
+        int ntask, int maxthread, const std::function<void(int task, int thread)> &f);
+
+  private:
+    static void Start(int n);
+    static void Stop();
+    static void Work(int thread, int seen, int seed);
+    static void RunTasks(int thread);
+
+    static int nthread;
+    static thread_local int threadindex;
+    static thread_local bool busy;
+
+    static std::vector<std::thread> workers;
+    static std::mutex mtx;
+    static std::condition_variable startcond;
+    static std::condition_variable donecond;
+
+    // current parallel loop
+    static const std::function<void(int, int)> *job;
+    static int jobntask;
+    static int jobnthread;
+    static int generation;
+    static int ndone;
+    static bool stop;
+};
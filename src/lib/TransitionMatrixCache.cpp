@@ -0,0 +1,81 @@
+#include "TransitionMatrixCache.hpp"
+#include <cstring>
+#include "global/logging.hpp"
+
+namespace {
+// reports the hit rate of the global cache at exit
+struct GlobalCache {
+    TransitionMatrixCache cache;
+    ~GlobalCache() {
+        if (cache.GetNhit() + cache.GetNmiss() > 0) { cache.Report(); }
+    }
+};
+}  // namespace
+
+TransitionMatrixCache &TransitionMatrixCache::GetGlobalCache() {
+    static GlobalCache global;
+    return global.cache;
+}
+
+void TransitionMatrixCache::Report() const {
+    long n = nhit + nmiss;
+    INFO("Transition matrix cache: {} hits, {} misses ({:.1f}% hit rate), {} matrices in cache",
+        nhit, nmiss, n ? 100.0 * nhit / n : 0.0, entries.size());
+}
+
+void TransitionMatrixCache::SetMaxSize(size_t insize) {
+    maxsize = insize;
+    MakeRoom(0);
+}
+
+void TransitionMatrixCache::Clear() {
+    for (auto &entry : entries) { delete[] entry.P; }
+    entries.clear();
+    index.clear();
+    size = 0;
+}
+
+bool TransitionMatrixCache::MakeRoom(size_t nbytes) {
+    while ((size + nbytes > maxsize) && !entries.empty() && (entries.back().lastpass != pass)) {
+        Entry &entry = entries.back();
+        size -= entry.nbytes;
+        delete[] entry.P;
+        index.erase(entry.key);
+        entries.pop_back();
+    }
+    return size + nbytes <= maxsize;
+}
+
+double *TransitionMatrixCache::Find(const SubMatrix &matrix, double efflength, bool &fill) {
+    Key key;
+    key.version = matrix.GetVersion();
+    std::memcpy(&key.length, &efflength, sizeof(double));
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        // move to front
+        entries.splice(entries.begin(), entries, it->second);
+        Entry &entry = entries.front();
+        entry.lastpass = pass;
+        nhit++;
+        fill = false;
+        return entry.P;
+    }
+
+    size_t nbytes = static_cast<size_t>(matrix.GetNstate()) * matrix.GetNstate() * sizeof(double);
+    if (!MakeRoom(nbytes)) {
+        fill = false;
+        return nullptr;
+    }
+    Entry entry;
+    entry.key = key;
+    entry.P = new double[matrix.GetNstate() * matrix.GetNstate()];
+    entry.nbytes = nbytes;
+    entry.lastpass = pass;
+    entries.push_front(entry);
+    index[key] = entries.begin();
+    size += nbytes;
+    nmiss++;
+    fill = true;
+    return entry.P;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include "SubMatrix.hpp"
+
+/**
+ * \brief A cache of finite time transition matrices, keyed by the version of
+ * a substitution matrix and by an effective branch length
+ *
+ * For a given matrix Q and effective length t (branch length times site rate),
+ * the transition matrix P = exp(tQ) is computed once (see
+ * SubMatrix::GetFiniteTimeTransitionMatrix) and can then be used for pruning
+ * all sites sharing this matrix and this length along a given branch. Since
+ * the version of a matrix changes each time its rates are modified (see
+ * SubMatrix::GetVersion), and since any change in branch length changes the
+ * key, entries never become stale: they are just no longer requested, and are
+ * eventually evicted, least recently used first, once the total size of the
+ * cache exceeds its maximum size.
+ *
+ * The cache works by passes (typically, one call to
+ * PhyloProcess::GetLogLikelihood or PhyloProcess::ResampleSub): the entries
+ * returned by Find during the current pass are guaranteed to stay in memory
+ * until the next call to NewPass. Find is not thread-safe and should be called
+ * from the main thread, whereas the matrices returned by Find can then be
+ * filled and read concurrently.
+ *
+ * A single cache (GetGlobalCache) is shared by all PhyloProcess objects of the
+ * program, so that its maximum size is a bound over the whole program; its hit
+ * rate is reported at exit.
+ */
+
+class TransitionMatrixCache {
+  public:
+    //! constructor, parameterized by the maximum size (in bytes)
+    explicit TransitionMatrixCache(size_t inmaxsize = DEFAULTMAXSIZE) : maxsize(inmaxsize) {}
+    ~TransitionMatrixCache() { Clear(); }
+
+    TransitionMatrixCache(const TransitionMatrixCache &) = delete;
+    TransitionMatrixCache &operator=(const TransitionMatrixCache &) = delete;
+
+    //! the cache shared by all PhyloProcess objects
+    static TransitionMatrixCache &GetGlobalCache();
+
+    //! set the maximum size (in bytes) of the cache (0 means no caching)
+    void SetMaxSize(size_t insize);
+
+    //! return the maximum size (in bytes) of the cache
+    size_t GetMaxSize() const { return maxsize; }
+
+    //! return the current size (in bytes) of the cache
+    size_t GetSize() const { return size; }
+
+    //! return the number of transition matrices currently stored
+    int GetNentry() const { return entries.size(); }
+
+    //! start a new pass: the entries returned from now on are protected from
+    //! eviction until the next call to NewPass
+    void NewPass() { pass++; }
+
+    //! \brief return the transition matrix (Nstate*Nstate, row-wise) for given
+    //! matrix and effective length
+    //!
+    //! If the transition matrix was already computed, fill is set to false;
+    //! otherwise, a new entry is created, which the caller should fill (e.g.
+    //! using SubMatrix::GetFiniteTimeTransitionMatrix), and fill is set to
+    //! true. Returns a null pointer if there is no room left in the cache.
+    double *Find(const SubMatrix &matrix, double efflength, bool &fill);
+
+    //! remove all entries
+    void Clear();
+
+    //! number of calls to Find that returned an already computed matrix
+    long GetNhit() const { return nhit; }
+    //! number of calls to Find that returned a new entry
+    long GetNmiss() const { return nmiss; }
+
+    //! log the number of hits and misses
+    void Report() const;
+
+    static const size_t DEFAULTMAXSIZE = 64 * 1024 * 1024;
+
+  private:
+    struct Key {
+        uint64_t version;
+        uint64_t length;
+        bool operator==(const Key &other) const {
+            return (version == other.version) && (length == other.length);
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<uint64_t>()(key.version * 0x9E3779B97F4A7C15ULL ^ key.length);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        double *P;
+        size_t nbytes;
+        long lastpass;
+    };
+
+    // evict least recently used entries (not used in current pass) until
+    // nbytes more can be stored without exceeding maxsize
+    bool MakeRoom(size_t nbytes);
+
+    size_t maxsize;
+    size_t size{0};
+    long pass{0};
+    long nhit{0};
+    long nmiss{0};
+
+    // most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+};
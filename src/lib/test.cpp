@@ -0,0 +1,1043 @@
+#include "doctest.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "AAMutSelNeCodonMatrixBidimArray.hpp"
+#include "BranchArray.hpp"
+#include "CodonSuffStat.hpp"
+#include "FixationKernels.hpp"
+#include "GTRSubMatrix.hpp"
+#include "PathSuffStat.hpp"
+#include "PhyloProcess.hpp"
+#include "PoissonSuffStat.hpp"
+#include "PropagationKernels.hpp"
+#include "RandomStream.hpp"
+#include "ScratchMemory.hpp"
+#include "ThreadPool.hpp"
+#include "TransitionMatrixCache.hpp"
+
+using namespace std;
+
+TEST_CASE("RandomStream is a function of key, stream and iteration") {
+    uint64_t key = RandomStream::MakeKey(42, 0);
+    RandomStream s1(key, 17, 3);
+    RandomStream s2(key, 17, 3);
+    int ndiff = 0;
+    for (int i = 0; i < 1000; i++) { ndiff += (s1.Uniform() != s2.Uniform()); }
+    CHECK(ndiff == 0);
+
+    // changing the stream, the iteration or the key gives other numbers
+    RandomStream a(key, 17, 3);
+    RandomStream b(key, 18, 3);
+    RandomStream c(key, 17, 4);
+    RandomStream d(RandomStream::MakeKey(42, 1), 17, 3);
+    double ua = a.Uniform();
+    CHECK(ua != b.Uniform());
+    CHECK(ua != c.Uniform());
+    CHECK(ua != d.Uniform());
+}
+
+TEST_CASE("RandomStream draws uniform numbers in (0,1)") {
+    RandomStream s(RandomStream::MakeKey(1, 0), 0, 0);
+    int n = 100000;
+    double mean = 0;
+    double var = 0;
+    int nout = 0;
+    for (int i = 0; i < n; i++) {
+        double u = s.Uniform();
+        nout += ((u <= 0) || (u >= 1));
+        mean += u;
+        var += u * u;
+    }
+    CHECK(nout == 0);
+    mean /= n;
+    var = var / n - mean * mean;
+    CHECK(mean == doctest::Approx(0.5).epsilon(0.01));
+    CHECK(var == doctest::Approx(1.0 / 12).epsilon(0.02));
+}
+
+TEST_CASE("Transition matrices are cached by matrix version and effective length") {
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix matrix(4, rr, stat, true);
+
+    // the cached transition matrix agrees with the per-entry computation
+    TransitionMatrixCache cache;
+    cache.NewPass();
+    bool fill = false;
+    double *P = cache.Find(matrix, 0.3, fill);
+    REQUIRE(P != nullptr);
+    CHECK(fill);
+    matrix.GetFiniteTimeTransitionMatrix(0.3, P);
+    for (int i = 0; i < 4; i++) {
+        double tot = 0;
+        for (int j = 0; j < 4; j++) {
+            CHECK(P[i * 4 + j] == doctest::Approx(matrix.GetFiniteTimeTransitionProb(i, j, 0.3)));
+            tot += P[i * 4 + j];
+        }
+        CHECK(tot == doctest::Approx(1.0));
+    }
+
+    // same key: hit; other length or corrupted matrix: miss
+    CHECK(cache.Find(matrix, 0.3, fill) == P);
+    CHECK(!fill);
+    CHECK(cache.Find(matrix, 0.4, fill) != P);
+    CHECK(fill);
+    uint64_t version = matrix.GetVersion();
+    matrix.CorruptMatrix();
+    CHECK(matrix.GetVersion() != version);
+    CHECK(cache.Find(matrix, 0.3, fill) != P);
+    CHECK(fill);
+    CHECK(cache.GetNhit() == 1);
+    CHECK(cache.GetNmiss() == 3);
+
+    // entries of the current pass are never evicted, older ones are
+    cache.SetMaxSize(3 * 16 * sizeof(double));
+    CHECK(cache.GetNentry() == 3);
+    CHECK(cache.Find(matrix, 0.5, fill) == nullptr);
+    cache.NewPass();
+    CHECK(cache.Find(matrix, 0.5, fill) != nullptr);
+    CHECK(cache.GetNentry() == 3);
+    CHECK(cache.GetSize() <= cache.GetMaxSize());
+}
+
+TEST_CASE("Propagation kernels agree with the transition matrix for all instruction sets") {
+    auto best = PropagationKernels::GetInstructionSet();
+    for (int Nstate : {4, 20, 61}) {
+        vector<double> rr(Nstate * (Nstate - 1) / 2);
+        for (size_t k = 0; k < rr.size(); k++) { rr[k] = 0.5 + (k % 7) * 0.3; }
+        vector<double> stat(Nstate);
+        for (int k = 0; k < Nstate; k++) { stat[k] = (1.0 + k % 5) / Nstate; }
+        GTRSubMatrix matrix(Nstate, rr, stat, true);
+        vector<double> P(Nstate * Nstate);
+        matrix.GetFiniteTimeTransitionMatrix(0.2, P.data());
+
+        for (auto set : {PropagationKernels::GENERIC, PropagationKernels::AVX2,
+                 PropagationKernels::AVX512}) {
+            if (!PropagationKernels::SetInstructionSet(set)) { continue; }
+            // backward: column j of P; forward: row j of P
+            vector<double> in(Nstate + 1), out(Nstate + 1);
+            for (int j = 0; j < Nstate; j++) {
+                for (int k = 0; k <= Nstate; k++) { in[k] = (k == j); }
+                matrix.BackwardPropagate(in.data(), out.data(), 0.2);
+                for (int i = 0; i < Nstate; i++) {
+                    CHECK(out[i] == doctest::Approx(P[i * Nstate + j]));
+                }
+                matrix.ForwardPropagate(in.data(), out.data(), 0.2);
+                for (int i = 0; i < Nstate; i++) {
+                    CHECK(out[i] == doctest::Approx(P[j * Nstate + i]));
+                }
+            }
+        }
+    }
+    PropagationKernels::SetInstructionSet(best);
+}
+
+// a non-reversible 3-state matrix, with stationary distribution (1/4, 1/2, 1/4)
+class NonReversibleSubMatrix : public SubMatrix {
+  public:
+    NonReversibleSubMatrix() : SubMatrix(3, false) {
+        mStationary[0] = 0.25;
+        mStationary[1] = 0.5;
+        mStationary[2] = 0.25;
+    }
+
+  protected:
+    void ComputeArray(int i) const override {
+        const double rates[3][3] = {{-2, 1.5, 0.5}, {0.5, -1, 0.5}, {1, 0.5, -1.5}};
+        for (int j = 0; j < 3; j++) { Q(i, j) = rates[i][j]; }
+    }
+    void ComputeStationary() const override {}
+};
+
+TEST_CASE("Reversible matrices use the symmetric solver, others the general one") {
+    SubMatrix::SetDiagCheckPeriod(1);
+
+    vector<double> rr(61 * 60 / 2);
+    for (size_t k = 0; k < rr.size(); k++) { rr[k] = 0.2 + (k % 11) * 0.1; }
+    vector<double> stat(61);
+    for (int k = 0; k < 61; k++) { stat[k] = (1.0 + k % 3) / 122; }
+    GTRSubMatrix reversible(61, rr, stat, true);
+    int ngeneral = SubMatrix::GetNgeneralDiag();
+    reversible.UpdateDiagonalisation();
+    CHECK(SubMatrix::GetNgeneralDiag() == ngeneral);
+    CHECK(SubMatrix::GetMaxDiagError() < 1e-10);
+
+    NonReversibleSubMatrix nonreversible;
+    nonreversible.UpdateDiagonalisation();
+    CHECK(SubMatrix::GetNgeneralDiag() == ngeneral + 1);
+    CHECK(SubMatrix::GetMaxDiagError() < 1e-10);
+
+    // transition probabilities: rows sum to 1, and the stationary
+    // distribution is preserved
+    vector<double> P(9);
+    nonreversible.GetFiniteTimeTransitionMatrix(0.7, P.data());
+    for (int j = 0; j < 3; j++) {
+        double rowtot = 0;
+        double stattot = 0;
+        for (int i = 0; i < 3; i++) {
+            rowtot += P[j * 3 + i];
+            stattot += nonreversible.Stationary(i) * P[i * 3 + j];
+        }
+        CHECK(rowtot == doctest::Approx(1.0));
+        CHECK(stattot == doctest::Approx(nonreversible.Stationary(j)));
+    }
+
+#ifdef NDEBUG
+    SubMatrix::SetDiagCheckPeriod(0);
+#endif
+}
+
+TEST_CASE("Lazy binary-exponent scaling agrees with per-node log(max) scaling") {
+    // a deep caterpillar tree, whose site likelihoods underflow without scaling
+    const int ntaxa = 2000;
+    const int nsite = 10;
+    string newick = "(t0:0.5,t1:0.5)";
+    for (int i = 2; i < ntaxa; i++) { newick = "(" + newick + ":0.5,t" + to_string(i) + ":0.5)"; }
+    istringstream treestream(newick + ";");
+    NHXParser parser{treestream};
+    auto tree = make_from_parser(parser);
+
+    // (FileSequenceAlignment only reads from files)
+    string alifile = "lazyscaling_test.ali";
+    ofstream ali(alifile);
+    ali << ntaxa << ' ' << nsite << '\n';
+    uint64_t x = 17;
+    for (int i = 0; i < ntaxa; i++) {
+        ali << 't' << i << '\t';
+        for (int j = 0; j < nsite; j++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            ali << "ACGT-"[(x >> 33) % 5];
+        }
+        ali << '\n';
+    }
+    ali.close();
+    FileSequenceAlignment data(alifile);
+    remove(alifile.c_str());
+
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix matrix(4, rr, stat, true);
+    SimpleBranchArray<double> branchlength(*tree, 0.5);
+
+    PhyloProcess process(tree.get(), &data, &branchlength, nullptr, &matrix);
+    process.Unfold();
+    CHECK(process.isLazyScaling());
+    double lazy = process.GetLogLikelihood();
+    process.SetLazyScaling(false);
+    double logmax = process.GetLogLikelihood();
+    // site likelihoods far below the smallest positive double
+    CHECK(lazy < -1000 * nsite);
+    CHECK(lazy == doctest::Approx(logmax).epsilon(1e-12));
+}
+
+// counts the calls to operator new (and thus to new[], and to the allocations
+// of standard containers) made by the whole test program
+static std::atomic<long> nallocation{0};
+
+void *operator new(size_t size) {
+    nallocation++;
+    if (void *p = malloc(size ? size : 1)) { return p; }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+TEST_CASE("SubMatrix hot routines do no heap allocation in the steady state") {
+    vector<double> rr(61 * 60 / 2);
+    for (size_t k = 0; k < rr.size(); k++) { rr[k] = 0.2 + (k % 11) * 0.1; }
+    vector<double> stat(61);
+    for (int k = 0; k < 61; k++) { stat[k] = (1.0 + k % 3) / 122; }
+    GTRSubMatrix matrix(61, rr, stat, true);
+    vector<double> up(62, 1.0), down(62), P(61 * 61);
+
+    // warm up: diagonalisation, powers of the uniformized matrix, scratch memory
+    // (assertions are counted outside of the loop, doctest may allocate)
+    int nerror = 0;
+    auto cycle = [&](int rep) {
+        for (int i = 0; i < rep; i++) {
+            int a = i % 61;
+            int b = (7 * i) % 61;
+            double t = 0.01 * (1 + i % 10);
+            matrix.BackwardPropagate(up.data(), down.data(), t);
+            matrix.ForwardPropagate(up.data(), down.data(), t);
+            matrix.GetFiniteTimeTransitionProb(a, down.data(), t);
+            nerror += (matrix.GetFiniteTimeTransitionProb(a, b, t) <= 0);
+            matrix.GetFiniteTimeTransitionMatrix(t, P.data());
+            nerror += (matrix.DrawWaitingTime(a) <= 0);
+            nerror += (matrix.DrawOneStep(a) == a);
+            matrix.DrawUniformizedTransition(a, b, 1 + i % 20);
+        }
+    };
+    cycle(100);
+
+    long nalloc = nallocation;
+    long nscratch = ScratchMemory::GetNalloc();
+    cycle(1000);
+    long nallocsteady = nallocation - nalloc;
+    CHECK(nallocsteady == 0);
+    CHECK(ScratchMemory::GetNalloc() == nscratch);
+    CHECK(nerror == 0);
+}
+
+TEST_CASE("BranchSitePath suff stats, and reuse of its event array after Reset") {
+    // A---C--T----- over a branch of length 10
+    BranchSitePath path(0);
+    path.Append(1, 0.3);
+    path.Append(3, 0.2);
+    path.SetLastRelativeTime(0.5);
+    CHECK(path.GetNsub() == 2);
+    CHECK(path.GetInitState() == 0);
+    CHECK(path.GetFinalState() == 3);
+
+    PathSuffStat suffstat;
+    path.AddPathSuffStat(suffstat, 10);
+    CHECK(suffstat.GetPairCount(0, 1) == 1);
+    CHECK(suffstat.GetPairCount(1, 3) == 1);
+    CHECK(suffstat.GetPairCount(0, 3) == 0);
+    CHECK(suffstat.GetWaitingTime(0) == doctest::Approx(3));
+    CHECK(suffstat.GetWaitingTime(1) == doctest::Approx(2));
+    CHECK(suffstat.GetWaitingTime(3) == doctest::Approx(5));
+
+    vector<double> rr(6, 1.0), stat(4, 0.25);
+    GTRSubMatrix matrix(4, rr, stat, true);
+    PoissonSuffStat lengthsuffstat;
+    path.AddLengthSuffStat(lengthsuffstat, 2, matrix);
+    CHECK(lengthsuffstat.GetCount() == 2);
+    CHECK(lengthsuffstat.GetBeta() == doctest::Approx(-2 * matrix(0, 0)));
+
+    // refilling a path with no more events than before does not allocate
+    long nalloc = nallocation;
+    for (int rep = 0; rep < 100; rep++) {
+        path.Reset(2);
+        path.Append(0, 0.5);
+        path.SetLastRelativeTime(0.5);
+    }
+    long nallocreuse = nallocation - nalloc;
+    CHECK(nallocreuse == 0);
+    CHECK(path.GetNsub() == 1);
+    CHECK(path.GetState(1) == 0);
+}
+
+TEST_CASE("Streamed sufficient statistics are consistent with the stored histories") {
+    istringstream treestream("((t0:0.3,t1:0.1):0.2,(t2:0.4,(t3:0.2,t4:0.5):0.1):0.3);");
+    NHXParser parser{treestream};
+    auto tree = make_from_parser(parser);
+
+    // (FileSequenceAlignment only reads from files)
+    const int nsite = 200;
+    string alifile = "streaming_test.ali";
+    ofstream ali(alifile);
+    ali << 5 << ' ' << nsite << '\n';
+    uint64_t x = 5;
+    for (int i = 0; i < 5; i++) {
+        ali << 't' << i << '\t';
+        for (int j = 0; j < nsite; j++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            ali << "ACGT"[(x >> 33) % 4];
+        }
+        ali << '\n';
+    }
+    ali.close();
+    FileSequenceAlignment data(alifile);
+    remove(alifile.c_str());
+
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix matrix(4, rr, stat, true);
+    SimpleBranchArray<double> branchlength(*tree, 0.2);
+    double totallength = 0;
+    for (int j = 0; j < branchlength.GetNbranch(); j++) { totallength += branchlength[j]; }
+
+    PhyloProcess process(tree.get(), &data, &branchlength, nullptr, &matrix);
+    process.Unfold();
+
+    // total counts, waiting times and rate, as given by each kind of suff stat
+    PathSuffStat pathsuffstat;
+    PathSuffStatArray sitepathsuffstat(nsite);
+    PoissonSuffStatBranchArray lengthsuffstat(*tree);
+    PoissonSuffStatArray ratesuffstat(nsite);
+    auto check = [&]() {
+        int nroot = 0, npair = 0, nsitepair = 0, nlength = 0, nrate = 0;
+        double waitingtime = 0, sitewaitingtime = 0, lengthbeta = 0, ratebeta = 0;
+        for (int a = 0; a < pathsuffstat.GetNstate(); a++) {
+            nroot += pathsuffstat.GetRootCount(a);
+            waitingtime += pathsuffstat.GetWaitingTime(a);
+        }
+        for (int k = 0; k < pathsuffstat.GetNpair(); k++) { npair += pathsuffstat.GetPairCountAt(k); }
+        for (int i = 0; i < nsite; i++) {
+            for (int k = 0; k < sitepathsuffstat[i].GetNpair(); k++) {
+                nsitepair += sitepathsuffstat[i].GetPairCountAt(k);
+            }
+            for (int a = 0; a < sitepathsuffstat[i].GetNstate(); a++) {
+                sitewaitingtime += sitepathsuffstat[i].GetWaitingTime(a);
+            }
+            nrate += ratesuffstat[i].GetCount();
+            ratebeta += ratesuffstat[i].GetBeta();
+        }
+        for (int j = 0; j < lengthsuffstat.GetNbranch(); j++) {
+            nlength += lengthsuffstat[j].GetCount();
+            lengthbeta += lengthsuffstat[j].GetBeta() * branchlength[j];
+        }
+        CHECK(nroot == nsite);
+        CHECK(npair > 0);
+        CHECK(nsitepair == npair);
+        CHECK(nlength == npair);
+        CHECK(nrate == npair);
+        CHECK(waitingtime == doctest::Approx(nsite * totallength));
+        CHECK(sitewaitingtime == doctest::Approx(nsite * totallength));
+        CHECK(ratebeta == doctest::Approx(lengthbeta));
+    };
+
+    // stored histories
+    process.ResampleSub();
+    pathsuffstat.AddSuffStat(process);
+    sitepathsuffstat.AddSuffStat(process);
+    lengthsuffstat.AddLengthPathSuffStat(process);
+    ratesuffstat.AddRatePathSuffStat(process);
+    check();
+
+    // streamed statistics (the sinks are cleared by ResampleSub)
+    PhyloProcess::SuffStatSinks sinks;
+    sinks.path = &pathsuffstat;
+    sinks.sitepath = &sitepathsuffstat;
+    sinks.length = &lengthsuffstat;
+    sinks.rate = &ratesuffstat;
+    process.SetSuffStatSinks(sinks);
+    CHECK(process.isStreaming());
+    process.Move(1.0);
+    check();
+
+    // and back to stored histories
+    process.SetSuffStatSinks(PhyloProcess::SuffStatSinks());
+    CHECK(!process.isStreaming());
+    process.ResampleSub();
+    pathsuffstat.Clear();
+    pathsuffstat.AddSuffStat(process);
+    int npair = 0;
+    for (int k = 0; k < pathsuffstat.GetNpair(); k++) { npair += pathsuffstat.GetPairCountAt(k); }
+    CHECK(npair > 0);
+}
+
+TEST_CASE("PathSuffStat merges sorted pair lists and computes log p(S | Q)") {
+    PathSuffStat a, b;
+    a.IncrementRootCount(2);
+    a.AddWaitingTime(0, 0.5);
+    a.AddWaitingTime(3, 1.5);
+    a.IncrementPairCount(3, 1);
+    a.IncrementPairCount(0, 2);
+    a.IncrementPairCount(3, 1);
+    CHECK(a.GetNpair() == 2);
+    CHECK(a.GetPairFrom(0) == 0);
+    CHECK(a.GetPairTo(1) == 1);
+    CHECK(a.GetPairCount(3, 1) == 2);
+
+    b.IncrementRootCount(1);
+    b.AddWaitingTime(1, 2.0);
+    b.IncrementPairCount(1, 0);
+    b.IncrementPairCount(3, 1);
+    b.IncrementPairCount(3, 2);
+    a += b;
+    CHECK(a.GetRootCount(1) == 1);
+    CHECK(a.GetRootCount(2) == 1);
+    CHECK(a.GetWaitingTime(1) == 2.0);
+    CHECK(a.GetNpair() == 4);
+    CHECK(a.GetPairCount(0, 2) == 1);
+    CHECK(a.GetPairCount(1, 0) == 1);
+    CHECK(a.GetPairCount(3, 1) == 3);
+    CHECK(a.GetPairCount(3, 2) == 1);
+    for (int k = 1; k < a.GetNpair(); k++) {
+        CHECK(((a.GetPairFrom(k - 1) < a.GetPairFrom(k)) ||
+               ((a.GetPairFrom(k - 1) == a.GetPairFrom(k)) && (a.GetPairTo(k - 1) < a.GetPairTo(k)))));
+    }
+
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix matrix(4, rr, stat, true);
+    double logprob = log(matrix.Stationary(1)) + log(matrix.Stationary(2)) +
+                     0.5 * matrix(0, 0) + 2.0 * matrix(1, 1) + 1.5 * matrix(3, 3) +
+                     log(matrix(0, 2)) + log(matrix(1, 0)) + 3 * log(matrix(3, 1)) +
+                     log(matrix(3, 2));
+    CHECK(a.GetLogProb(matrix) == doctest::Approx(logprob));
+
+    // once all pairs are known, merging is done in place, without allocation
+    PathSuffStat total(4);
+    total += b;
+    total += a;
+    long nalloc = nallocation;
+    for (int rep = 0; rep < 10; rep++) {
+        total.Clear();
+        total += a;
+        total += b;
+    }
+    long nallocmerge = nallocation - nalloc;
+    CHECK(nallocmerge == 0);
+    CHECK(total.GetPairCount(3, 1) == 4);
+}
+
+TEST_CASE("Cached log rates follow the changes of the matrix") {
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix matrix(4, rr, stat, true);
+    PathSuffStat suffstat;
+    suffstat.IncrementRootCount(3);
+    suffstat.AddWaitingTime(1, 0.8);
+    suffstat.IncrementPairCount(1, 3);
+    suffstat.IncrementPairCount(2, 0);
+
+    for (int rep = 0; rep < 2; rep++) {
+        for (int i = 0; i < 4; i++) {
+            CHECK(matrix.GetLogStationary()[i] == log(matrix.Stationary(i)));
+            for (int j = 0; j < 4; j++) {
+                if (i != j) { CHECK(matrix.LogRate(i, j) == log(matrix(i, j))); }
+            }
+        }
+        double logprob = log(matrix.Stationary(3)) + 0.8 * matrix(1, 1) +
+                         log(matrix(1, 3)) + log(matrix(2, 0));
+        CHECK(suffstat.GetLogProb(matrix) == logprob);
+
+        // changing the rates: the cache should be recomputed
+        rr[1] = 4.0;
+        stat = {0.25, 0.25, 0.4, 0.1};
+        matrix.CopyStationary(stat);
+        matrix.CorruptMatrix();
+    }
+}
+
+TEST_CASE("Mutation-selection suff stats agree with the codon matrix") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> nucstat{0.2, 0.3, 0.1, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, nucstat, true);
+    vector<double> aa(Naa, 0);
+    for (int a = 0; a < Naa; a++) { aa[a] = (a + 1) / 210.0; }
+    AAMutSelOmegaCodonSubMatrix codonmatrix(&cod, &nucmatrix, aa, 0.7, 1.0);
+    codonmatrix.CorruptMatrix();
+
+    PathSuffStat pathsuffstat;
+    for (int c = 0; c < cod.GetNstate(); c += 3) {
+        pathsuffstat.IncrementRootCount(c);
+        pathsuffstat.AddWaitingTime(c, 0.1 * (c % 5 + 1));
+        auto neighbors = cod.GetNeighbors(c);
+        for (int k = 0; k < 3; k++) { pathsuffstat.IncrementPairCount(c, neighbors[k * 3]); }
+    }
+
+    AAMutSelPathSuffStat aasuffstat;
+    aasuffstat.AddSuffStat(codonmatrix, pathsuffstat);
+    CHECK(aasuffstat.GetLogProb(codonmatrix) ==
+          doctest::Approx(pathsuffstat.GetLogProb(codonmatrix)).epsilon(1e-10));
+
+    // new fitness profile and new omega: the suff stat is still valid
+    for (int a = 0; a < Naa; a++) { aa[a] = (a % 4 + 1) / 50.0; }
+    codonmatrix.SetOmega(1.3);
+    codonmatrix.CorruptMatrix();
+    CHECK(aasuffstat.GetLogProb(codonmatrix) ==
+          doctest::Approx(pathsuffstat.GetLogProb(codonmatrix)).epsilon(1e-10));
+}
+
+TEST_CASE("Fixation kernels agree with the scalar formula for all instruction sets") {
+    vector<double> deltaS;
+    for (double s : {0.0, 1e-12, 1e-5, 0.0099, 0.01, 0.0101, 0.3, 1.0, 7.5, 20.0, 49.9, 50.0,
+             50.1, 80.0, 700.0, 800.0}) {
+        deltaS.push_back(s);
+        deltaS.push_back(-s);
+    }
+    int n = deltaS.size();
+    const PropagationKernels::InstructionSet best = PropagationKernels::GetInstructionSet();
+    for (auto set :
+        {PropagationKernels::GENERIC, PropagationKernels::AVX2, PropagationKernels::AVX512}) {
+        if (!PropagationKernels::SetInstructionSet(set)) { continue; }
+        // odd sizes, to go through the padded tail
+        for (int m : {n, n - 1, 3}) {
+            vector<double> forward(m), backward(m);
+            FixationKernels::Compute(m, deltaS.data(), forward.data(), backward.data());
+            for (int k = 0; k < m; k++) {
+                double s = deltaS[k];
+                CHECK(forward[k] == doctest::Approx(FixationKernels::Scalar(s)).epsilon(1e-13));
+                CHECK(backward[k] == doctest::Approx(FixationKernels::Scalar(-s)).epsilon(1e-13));
+                // reference formula, away from cancellation
+                if ((std::fabs(s) > 1e-3) && (std::fabs(s) <= 50)) {
+                    CHECK(forward[k] == doctest::Approx(s / (1 - exp(-s))).epsilon(1e-13));
+                }
+            }
+        }
+    }
+    PropagationKernels::SetInstructionSet(best);
+    CHECK(FixationKernels::Scalar(0.0) == 1.0);
+    CHECK(FixationKernels::Scalar(1e-5) == doctest::Approx(1 + 0.5e-5 + 1e-10 / 12).epsilon(1e-15));
+}
+
+TEST_CASE("Flat neighbour array of the codon state space") {
+    CodonStateSpace cod(Universal);
+    for (int i = 0; i < cod.GetNstate(); i++) {
+        const auto &neighbors = cod.GetNeighbors(i);
+        REQUIRE(cod.GetNneighbor(i) == static_cast<int>(neighbors.size()));
+        const CodonStateSpace::Neighbor *neighbor = cod.GetNeighborArray(i);
+        for (int k = 0; k < cod.GetNneighbor(i); k++) {
+            int j = neighbor[k].codon;
+            CHECK(j == neighbors[k]);
+            int pos = cod.GetDifferingPosition(i, j);
+            CHECK(neighbor[k].nucfrom == cod.GetCodonPosition(pos, i));
+            CHECK(neighbor[k].nucto == cod.GetCodonPosition(pos, j));
+            if (cod.Synonymous(i, j)) {
+                CHECK(neighbor[k].aapair == -1);
+            } else {
+                int a = cod.Translation(i);
+                int b = cod.Translation(j);
+                int p = neighbor[k].aapair % cod.GetNaaPair();
+                CHECK(cod.GetAAPairFrom(p) == std::min(a, b));
+                CHECK(cod.GetAAPairTo(p) == std::max(a, b));
+                CHECK((neighbor[k].aapair >= cod.GetNaaPair()) == (a > b));
+            }
+        }
+    }
+}
+
+TEST_CASE("Codon matrices released by Trim are recomputed identically") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> nucstat{0.2, 0.3, 0.1, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, nucstat, true);
+    SimpleArray<vector<double>> fitnessarray(4, vector<double>(Naa, 0));
+    for (int j = 0; j < 4; j++) {
+        for (int a = 0; a < Naa; a++) { fitnessarray[j][a] = ((a + j) % 7 + 1) / 80.0; }
+    }
+    vector<double> popsize{0.5, 1.0, 2.0};
+    MutSelNeCodonMatrixBidimArray matrices(&cod, &nucmatrix, &fitnessarray, popsize, 5);
+    for (int j = 0; j < 4; j++) { matrices.UpdateColCodonMatrices(j); }
+    // dense arrays only allocated on first use
+    CHECK(matrices.GetNdense() == 0);
+
+    int Nstate = cod.GetNstate();
+    vector<double> up(Nstate + 1, 0);
+    for (int k = 0; k < Nstate; k++) { up[k] = (k % 3 + 1) / 3.0; }
+    // a row of the rates and a propagated vector, for each matrix
+    auto snapshot = [&](int i, int j) {
+        const SubMatrix &m = matrices.GetVal(i, j);
+        vector<double> ret(2 * Nstate + 1);
+        for (int k = 0; k < Nstate; k++) { ret[k] = m(7, k); }
+        m.BackwardPropagate(up.data(), ret.data() + Nstate, 0.3);
+        return ret;
+    };
+    vector<vector<double>> ref;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) { ref.push_back(snapshot(i, j)); }
+    }
+    CHECK(matrices.GetNdense() == 12);
+
+    matrices.Trim();
+    CHECK(matrices.GetNdense() == 5);
+    CHECK(matrices.GetNrelease() == 7);
+
+    // the most recently used matrices are kept by the next Trim
+    for (int j = 0; j < 4; j++) { CHECK(snapshot(1, j) == ref[4 + j]); }
+    matrices.Trim();
+    CHECK(matrices.GetNdense() == 5);
+    for (int j = 0; j < 4; j++) { CHECK(matrices.GetVal(1, j).HasDenseStorage()); }
+
+    // and matrices whose values are out of date are released
+    matrices.UpdateColCodonMatrices(0);
+    matrices.Trim();
+    CHECK(matrices.GetNdense() == 4);
+    CHECK(!matrices.GetVal(1, 0).HasDenseStorage());
+
+    // released matrices give exactly the same results once recomputed
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) { CHECK(snapshot(i, j) == ref[i * 4 + j]); }
+    }
+}
+
+TEST_CASE("Batch diagonalisation does not depend on the number of threads") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> nucstat{0.2, 0.3, 0.1, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, nucstat, true);
+    SimpleArray<vector<double>> fitnessarray(4, vector<double>(Naa, 0));
+    for (int j = 0; j < 4; j++) {
+        for (int a = 0; a < Naa; a++) { fitnessarray[j][a] = ((a + 2 * j) % 5 + 1) / 60.0; }
+    }
+    vector<double> popsize{0.5, 1.0, 2.0};
+    SimpleArray<int> occupancy(4, 1);
+    occupancy[2] = 0;
+
+    int Nstate = cod.GetNstate();
+    vector<double> up(Nstate + 1, 0);
+    for (int k = 0; k < Nstate; k++) { up[k] = (k % 4 + 1) / 4.0; }
+    // propagated vectors of the occupied columns, after a batch update on nthread
+    // threads (or lazily, if nthread is 0)
+    auto propagate = [&](int nthread) {
+        MutSelNeCodonMatrixBidimArray matrices(&cod, &nucmatrix, &fitnessarray, popsize);
+        for (int j = 0; j < 4; j++) { matrices.UpdateColCodonMatrices(j); }
+        nucmatrix.CorruptMatrix();
+        if (nthread) {
+            ThreadPool::SetNthreads(nthread);
+            matrices.UpdateDiagonalisations(occupancy);
+            ThreadPool::SetNthreads(1);
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    CHECK(matrices.GetVal(i, j).HasDenseStorage() == (occupancy[j] != 0));
+                }
+            }
+        }
+        vector<double> ret;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                if (occupancy[j]) {
+                    vector<double> down(Nstate + 1);
+                    matrices.GetVal(i, j).BackwardPropagate(up.data(), down.data(), 0.2);
+                    ret.insert(ret.end(), down.begin(), down.end());
+                }
+            }
+        }
+        return ret;
+    };
+    vector<double> ref = propagate(0);
+    CHECK(propagate(1) == ref);
+    CHECK(propagate(4) == ref);
+}
+
+TEST_CASE("Restore brings back the state of the matrix saved by Backup") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> nucstat{0.2, 0.3, 0.1, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, nucstat, true);
+    vector<double> aa(Naa);
+    for (int a = 0; a < Naa; a++) { aa[a] = (a % 6 + 1) / 70.0; }
+    AAMutSelOmegaCodonSubMatrix matrix(&cod, &nucmatrix, aa, 1.0, 1.0);
+    matrix.CorruptMatrix();
+
+    int Nstate = cod.GetNstate();
+    vector<double> up(Nstate + 1, 0);
+    for (int k = 0; k < Nstate; k++) { up[k] = (k % 3 + 1) / 3.0; }
+    // a row of the rates and of their logs, the equilibrium frequencies, and a
+    // propagated vector
+    auto snapshot = [&]() {
+        vector<double> ret(4 * Nstate + 1);
+        for (int k = 0; k < Nstate; k++) {
+            ret[k] = matrix(5, k);
+            ret[Nstate + k] = (k != 5) ? matrix.LogRate(5, k) : 0;
+            ret[2 * Nstate + k] = matrix.Stationary(k);
+        }
+        matrix.BackwardPropagate(up.data(), ret.data() + 3 * Nstate, 0.3);
+        return ret;
+    };
+    vector<double> ref = snapshot();
+    uint64_t version = matrix.GetVersion();
+    int ndiag = SubMatrix::GetNdiag();
+
+    // rejected proposal: the saved state is back, without recomputation
+    vector<double> bk = aa;
+    matrix.Backup();
+    aa[3] *= 2;
+    matrix.CorruptMatrix();
+    vector<double> proposed = snapshot();
+    CHECK(proposed != ref);
+    aa = bk;
+    matrix.Restore();
+    CHECK(matrix.GetVersion() == version);
+    CHECK(snapshot() == ref);
+    CHECK(SubMatrix::GetNdiag() == ndiag + 1);
+
+    // accepted proposal, followed by a rejected one
+    matrix.Backup();
+    aa[3] *= 2;
+    matrix.CorruptMatrix();
+    CHECK(snapshot() == proposed);
+    bk = aa;
+    matrix.Backup();
+    aa[7] *= 3;
+    matrix.CorruptMatrix();
+    CHECK(snapshot() != proposed);
+    aa = bk;
+    matrix.Restore();
+    CHECK(snapshot() == proposed);
+
+    // nothing to restore if the matrix has not changed since Backup
+    version = matrix.GetVersion();
+    matrix.Backup();
+    matrix.Restore();
+    CHECK(matrix.GetVersion() == version);
+    CHECK(snapshot() == proposed);
+}
+
+// gives access to the powers of the uniformized matrix and to the jump tables
+class TestMGOmegaCodonSubMatrix : public MGOmegaCodonSubMatrix {
+  public:
+    TestMGOmegaCodonSubMatrix(
+        const CodonStateSpace *instatespace, const SubMatrix *inNucMatrix, double inomega)
+        : SubMatrix(instatespace->GetNstate(), false),
+          CodonSubMatrix(instatespace, false),
+          MGOmegaCodonSubMatrix(instatespace, inNucMatrix, inomega) {}
+
+    double GetPower(int n, int i, int j) const { return Power(n, i, j); }
+
+    // probability of a jump from i to j, as given by the alias tables
+    double GetJumpProb(int i, int j) const {
+        if (!jumpflag) { ActivateJumpTables(); }
+        int offset = jumpsparse ? sparsestart[i] : i * Nstate;
+        int n = jumpsparse ? GetNnonzero(i) : Nstate;
+        double p = 0;
+        for (int k = 0; k < n; k++) {
+            int kept = jumpsparse ? sparsecol[offset + k] : k;
+            int alias = jumpalias[offset + k];
+            int other = jumpsparse ? sparsecol[offset + alias] : alias;
+            double keep = jumpprob[offset + k];
+            p += ((kept == j) * keep + (other == j) * (1 - keep)) / n;
+        }
+        return p;
+    }
+};
+
+TEST_CASE("Sparse and dense sampling of codon substitution histories agree") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, stat, true);
+    TestMGOmegaCodonSubMatrix matrix(&cod, &nucmatrix, 0.3);
+    REQUIRE(matrix.IsSparse());
+    int Nstate = matrix.GetNstate();
+
+    // sparse rows hold exactly the non-null off-diagonal rates
+    int nerror = 0;
+    for (int i = 0; i < Nstate; i++) {
+        int nnonnull = 0;
+        for (int j = 0; j < Nstate; j++) { nnonnull += (j != i) && (matrix(i, j) != 0); }
+        nerror += (nnonnull != matrix.GetNnonzero(i));
+        for (int k = 0; k < matrix.GetNnonzero(i); k++) {
+            nerror += (matrix.GetSparseRow(i)[k] != matrix(i, matrix.GetSparseColumns(i)[k]));
+        }
+    }
+    CHECK(nerror == 0);
+
+    // same uniformized transitions for the same random numbers
+    uint64_t key = RandomStream::MakeKey(7, 0);
+    auto draws = [&](bool sparse) {
+        SubMatrix::SetSparseSampling(sparse);
+        matrix.CorruptMatrix();
+        RandomStream stream(key, 0, 0);
+        RandomStreamScope scope(stream);
+        vector<int> ret;
+        for (int i = 0; i < Nstate; i++) {
+            ret.push_back(matrix.DrawUniformizedTransition(i, (7 * i) % Nstate, 5 + i % 5));
+        }
+        return ret;
+    };
+    CHECK(draws(true) == draws(false));
+
+    // powers of the uniformized matrix
+    auto powers = [&](bool sparse) {
+        SubMatrix::SetSparseSampling(sparse);
+        matrix.CorruptMatrix();
+        vector<double> ret;
+        for (int n = 1; n <= 8; n++) {
+            for (int i = 0; i < Nstate; i++) { ret.push_back(matrix.GetPower(n, i, (3 * i) % Nstate)); }
+        }
+        return ret;
+    };
+    vector<double> sparsepow = powers(true);
+    vector<double> densepow = powers(false);
+    SubMatrix::SetSparseSampling(true);
+    double maxdiff = 0;
+    for (size_t k = 0; k < sparsepow.size(); k++) {
+        maxdiff = std::max(maxdiff, fabs(sparsepow[k] - densepow[k]));
+    }
+    CHECK(maxdiff < 1e-14);
+}
+
+TEST_CASE("Alias tables of the jump chain give the normalised rates") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, stat, true);
+    TestMGOmegaCodonSubMatrix matrix(&cod, &nucmatrix, 0.3);
+    int Nstate = matrix.GetNstate();
+
+    for (bool sparse : {true, false}) {
+        SubMatrix::SetSparseSampling(sparse);
+        matrix.CorruptMatrix();
+        double maxdiff = 0;
+        for (int i = 0; i < Nstate; i++) {
+            for (int j = 0; j < Nstate; j++) {
+                double p = (j == i) ? 0 : -matrix(i, j) / matrix(i, i);
+                maxdiff = std::max(maxdiff, fabs(matrix.GetJumpProb(i, j) - p));
+            }
+        }
+        CHECK(maxdiff < 1e-14);
+
+        // empirical frequencies of the next state
+        const int ndraw = 100000;
+        int state = 5;
+        vector<int> count(Nstate, 0);
+        for (int n = 0; n < ndraw; n++) { count[matrix.DrawOneStep(state)]++; }
+        double maxfreqdiff = 0;
+        for (int j = 0; j < Nstate; j++) {
+            double freq = static_cast<double>(count[j]) / ndraw;
+            maxfreqdiff = std::max(maxfreqdiff, fabs(freq - matrix.GetJumpProb(state, j)));
+        }
+        CHECK(count[state] == 0);
+        CHECK(maxfreqdiff < 0.01);
+    }
+    SubMatrix::SetSparseSampling(true);
+}
+
+TEST_CASE("Powers of the uniformized matrix are computed and recycled on demand") {
+    CodonStateSpace cod(Universal);
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix nucmatrix(Nnuc, rr, stat, true);
+    TestMGOmegaCodonSubMatrix matrix(&cod, &nucmatrix, 0.3);
+    int Nstate = matrix.GetNstate();
+    size_t powersize = Nstate * Nstate * sizeof(double);
+    SubMatrix::FreePowerPool();
+    size_t cachesize = SubMatrix::GetPowerCacheSize();
+
+    // nothing allocated unless uniformization is used
+    vector<double> up(Nstate, 1.0);
+    vector<double> down(Nstate);
+    matrix.BackwardPropagate(up.data(), down.data(), 0.5);
+    CHECK(matrix.GetNpower() == 0);
+    CHECK(SubMatrix::GetPowerCacheSize() == cachesize);
+
+    // reference: R^n, R = I + Q / mu
+    EMatrix R = EMatrix::Identity(Nstate, Nstate);
+    double mu = 0;
+    for (int i = 0; i < Nstate; i++) { mu = std::max(mu, -matrix(i, i)); }
+    for (int i = 0; i < Nstate; i++) {
+        for (int j = 0; j < Nstate; j++) { R(i, j) += matrix(i, j) / mu; }
+    }
+    const int npower = 30;
+    for (bool sparse : {true, false}) {
+        SubMatrix::SetSparseSampling(sparse);
+        matrix.CorruptMatrix();
+        matrix.GetPower(npower, 0, 0);
+        CHECK(matrix.GetNpower() == npower);
+        EMatrix ref = R;
+        double maxdiff = 0;
+        for (int n = 1; n <= npower; n++) {
+            for (int i = 0; i < Nstate; i++) {
+                for (int j = 0; j < Nstate; j++) {
+                    maxdiff = std::max(maxdiff, fabs(matrix.GetPower(n, i, j) - ref(i, j)));
+                }
+            }
+            ref = ref * R;
+        }
+        CHECK(maxdiff < 1e-12);
+    }
+    SubMatrix::SetSparseSampling(true);
+    CHECK(SubMatrix::GetPowerCacheSize() > cachesize + npower * powersize);
+
+    // the memory of the powers is kept for the next ones
+    matrix.CorruptMatrix();
+    CHECK(matrix.GetNpower() == 0);
+    CHECK(SubMatrix::GetPowerCacheSize() == cachesize);
+    CHECK(SubMatrix::GetPowerPoolSize() == npower * powersize);
+    TestMGOmegaCodonSubMatrix other(&cod, &nucmatrix, 0.5);
+    other.GetPower(10, 0, 0);
+    CHECK(SubMatrix::GetPowerPoolSize() == (npower - 10) * powersize);
+
+    // and released on demand, least recently used matrices first
+    matrix.GetPower(20, 0, 0);
+    vector<const SubMatrix *> matrices{&matrix, &other};
+    SubMatrix::TrimPowerCaches(matrices, SubMatrix::GetPowerCacheSize());
+    CHECK(SubMatrix::GetPowerPoolSize() == 0);
+    CHECK(matrix.GetNpower() == 20);
+    SubMatrix::TrimPowerCaches(matrices, cachesize + 15 * powersize);
+    CHECK(matrix.GetNpower() == 0);
+    CHECK(other.GetNpower() == 10);
+    CHECK(SubMatrix::GetPowerCacheSize() + SubMatrix::GetPowerPoolSize() <=
+          cachesize + 15 * powersize);
+    SubMatrix::TrimPowerCaches(matrices, cachesize);
+    CHECK(other.GetNpower() == 0);
+    CHECK(SubMatrix::GetPowerCacheSize() == cachesize);
+    CHECK(SubMatrix::GetPowerPoolSize() == 0);
+}
+
+TEST_CASE("Adaptive path sampling agrees with the fixed accept-reject sampler") {
+    istringstream treestream("((t0:1,t1:1):1,(t2:1,(t3:1,t4:1):1):1);");
+    NHXParser parser{treestream};
+    auto tree = make_from_parser(parser);
+
+    // (FileSequenceAlignment only reads from files)
+    const int nsite = 100;
+    string alifile = "pathsampling_test.ali";
+    ofstream ali(alifile);
+    ali << 5 << ' ' << nsite << '\n';
+    uint64_t x = 11;
+    for (int i = 0; i < 5; i++) {
+        ali << 't' << i << '\t';
+        for (int j = 0; j < nsite; j++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            ali << "ACGT"[(x >> 33) % 4];
+        }
+        ali << '\n';
+    }
+    ali.close();
+    FileSequenceAlignment data(alifile);
+    remove(alifile.c_str());
+
+    vector<double> rr{1.0, 2.0, 0.5, 0.7, 3.0, 1.2};
+    vector<double> stat{0.1, 0.2, 0.3, 0.4};
+    GTRSubMatrix matrix(4, rr, stat, true);
+    // long branches, along which accept-reject often fails
+    SimpleBranchArray<double> branchlength(*tree, 1.5);
+
+    // mean and standard error (over cycles) of the number of substitutions and
+    // of the time spent in state 0
+    struct Summary {
+        double meansub, sesub, meantime, setime;
+        PhyloProcess::PathSamplingStat stat;
+        int mintrials;
+    };
+    auto sample = [&](bool adaptive, int maxtrial) {
+        PhyloProcess process(tree.get(), &data, &branchlength, nullptr, &matrix);
+        process.SetAdaptivePathSampling(adaptive);
+        process.SetMaxTrial(maxtrial);
+        process.Unfold();
+        const int ncycle = 300;
+        double s1 = 0, s2 = 0, t1 = 0, t2 = 0;
+        for (int cycle = 0; cycle < ncycle; cycle++) {
+            process.ResampleSub();
+            PathSuffStat suffstat;
+            suffstat.AddSuffStat(process);
+            double nsub = 0;
+            for (int k = 0; k < suffstat.GetNpair(); k++) { nsub += suffstat.GetPairCountAt(k); }
+            double time = suffstat.GetWaitingTime(0);
+            s1 += nsub;
+            s2 += nsub * nsub;
+            t1 += time;
+            t2 += time * time;
+        }
+        Summary ret;
+        ret.meansub = s1 / ncycle;
+        ret.sesub = sqrt((s2 / ncycle - ret.meansub * ret.meansub) / ncycle);
+        ret.meantime = t1 / ncycle;
+        ret.setime = sqrt((t2 / ncycle - ret.meantime * ret.meantime) / ncycle);
+        ret.stat = process.GetPathSamplingStat();
+        ret.mintrials = maxtrial;
+        for (Tree::NodeIndex node = 0; node < Tree::NodeIndex(tree->nb_nodes()); node++) {
+            for (bool change : {false, true}) {
+                ret.mintrials = std::min(ret.mintrials, process.GetAcceptRejectTrials(node, change));
+            }
+        }
+        return ret;
+    };
+
+    Summary fixed = sample(false, 1000);
+    Summary adaptive = sample(true, 1000);
+    // almost always uniformized
+    Summary uniformized = sample(false, 1);
+
+    CHECK(fixed.mintrials == 1000);
+    CHECK(adaptive.mintrials < 1000);
+    CHECK(uniformized.stat.nuni > fixed.stat.nuni);
+    for (const Summary &other : {adaptive, uniformized}) {
+        CHECK(other.stat.npath == fixed.stat.npath);
+        CHECK(fabs(other.meansub - fixed.meansub) <
+              5 * sqrt(other.sesub * other.sesub + fixed.sesub * fixed.sesub));
+        CHECK(fabs(other.meantime - fixed.meantime) <
+              5 * sqrt(other.setime * other.setime + fixed.setime * fixed.setime));
+    }
+}